@@ -0,0 +1,218 @@
+#include "block.hpp"
+#include "diffusion.hpp"
+#include "generators.hpp"
+#include "hamiltonian.hpp"
+#include "observables.hpp"
+#include "quantum_state.hpp"
+#include <benchmark/benchmark.h>
+
+namespace {
+auto number_sites(std::string const& name) -> int
+{
+    return name == "5x5" ? 25 : 12;
+}
+
+auto BM_HeisenbergPerSpin(benchmark::State& state, std::string const& name)
+{
+    constexpr std::size_t pool_size   = 1 << 12;
+    auto const            hamiltonian = bench::load_hamiltonian(name);
+    auto const spins = bench::random_spins(pool_size, number_sites(name));
+    QuantumState        psi{pool_size, 1 << 16, 1};
+    QuantumStateBuilder builder{psi};
+    builder.start();
+    std::size_t i = 0;
+    for (auto _ : state) {
+        hamiltonian(spins[i], 1.0, builder);
+        i = (i + 1) % pool_size;
+    }
+    builder.stop();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_HeisenbergPerSpin, 5x5, std::string{"5x5"});
+BENCHMARK_CAPTURE(BM_HeisenbergPerSpin, Kagome12, std::string{"Kagome-12"});
+
+/// Cost of the Hamiltonian alone: contributions go to a buffer which is
+/// cleared regularly. `range(0)` is 0 for the scalar and 1 for the batched
+/// overload.
+auto BM_HeisenbergKernel(benchmark::State& state, std::string const& name)
+{
+    constexpr std::size_t pool_size   = 1 << 12;
+    constexpr auto        batch       = Heisenberg::batch_size;
+    auto const            hamiltonian = bench::load_hamiltonian(name);
+    auto const spins = bench::random_spins(pool_size, number_sites(name));
+    std::vector<std::complex<double>>     coeffs(batch, 1.0);
+    std::vector<QuantumState::value_type> buffer;
+    QuantumStateBuilder                   builder{buffer};
+    std::size_t                           i = 0;
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            for (std::size_t j = 0; j < batch; ++j) {
+                hamiltonian(spins[i + j], 1.0, builder);
+            }
+        }
+        else {
+            hamiltonian(spins.data() + i, coeffs.data(), batch, builder);
+        }
+        i = (i + batch) % pool_size;
+        if (i == 0) { buffer.clear(); }
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(batch) * state.iterations());
+}
+BENCHMARK_CAPTURE(BM_HeisenbergKernel, 5x5, std::string{"5x5"})->Arg(0)->Arg(1);
+
+/// All-to-all dipolar couplings 1/|i - j|³ on a chain of 24 spins, given as
+/// an edge list with one spec per pair (`range(0) == 0`) or as a
+/// CouplingMatrix (`range(0) == 1`).
+auto BM_AllToAll(benchmark::State& state)
+{
+    constexpr auto                     n         = 24;
+    constexpr std::size_t              pool_size = 1 << 10;
+    std::vector<double>                couplings(n * n);
+    std::vector<Heisenberg::spec_type> specs;
+    for (auto i = 0; i < n; ++i) {
+        for (auto j = 0; j < n; ++j) {
+            if (i == j) { continue; }
+            auto const r = std::abs(i - j);
+            auto const coupling = 1.0 / (r * r * r);
+            couplings[static_cast<std::size_t>(i * n + j)] = coupling;
+            if (i < j) { specs.push_back({coupling, {{i, j}}}); }
+        }
+    }
+    auto const hamiltonian =
+        state.range(0) == 0
+            ? Hamiltonian{Heisenberg{std::move(specs)}}
+            : Hamiltonian{CouplingMatrix{n, std::move(couplings)}};
+    auto const spins = bench::random_spins(pool_size, n);
+    std::vector<QuantumState::value_type> buffer;
+    QuantumStateBuilder                   builder{buffer};
+    std::size_t                           i = 0;
+    for (auto _ : state) {
+        hamiltonian(spins[i], 1.0, builder);
+        i = (i + 1) % pool_size;
+        if (i == 0) { buffer.clear(); }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AllToAll)->Arg(0)->Arg(1);
+
+/// One sweep of `measure` over a random 5x5 state of 10⁵ elements split into
+/// `range(0)` shards.
+auto BM_Observables(benchmark::State& state)
+{
+    constexpr std::size_t count = 100'000;
+    auto const number_shards    = static_cast<std::size_t>(state.range(0));
+    auto const edges            = bonds(bench::load_hamiltonian("5x5"));
+    auto const psi = bench::random_state(count, 25, number_shards);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(measure(psi, edges));
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+BENCHMARK(BM_Observables)
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+/// Runs a few truncated steps first so that the state actually has
+/// `soft_max` elements, and then measures one full step including `shrink`.
+auto BM_DiffusionStep(benchmark::State& state, std::string const& name)
+{
+    constexpr double      lambda = 10.0;
+    constexpr std::size_t warmup = 10;
+    auto const        soft_max    = static_cast<std::size_t>(state.range(0));
+    Hamiltonian const hamiltonian = bench::load_hamiltonian(name);
+    auto              psi         = bench::load_state(name, soft_max, 1);
+    for (std::size_t i = 0; i < warmup; ++i) {
+        psi = diffusion_step(lambda, hamiltonian, psi);
+        psi.shrink();
+    }
+    for (auto _ : state) {
+        auto h_psi = diffusion_step(lambda, hamiltonian, psi);
+        h_psi.shrink();
+        benchmark::DoNotOptimize(h_psi.size());
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(psi.size()) * state.iterations());
+}
+/// 〈ψ|H|ψ〉 of a state like the one of BM_DiffusionStep. `range(1)` is 1 if
+/// the Heisenberg is hidden behind a lambda, which forces `energy` to
+/// accumulate H|ψ〉 instead of looking up the connected configurations.
+auto BM_Energy(benchmark::State& state, std::string const& name)
+{
+    constexpr double      lambda = 10.0;
+    constexpr std::size_t warmup = 10;
+    auto const        soft_max   = static_cast<std::size_t>(state.range(0));
+    auto const        heisenberg = bench::load_hamiltonian(name);
+    Hamiltonian const hamiltonian =
+        state.range(1) == 0
+            ? Hamiltonian{heisenberg}
+            : Hamiltonian{[&heisenberg](auto const spin, auto const coeff,
+                              auto& builder) {
+                  heisenberg(spin, coeff, builder);
+              }};
+    auto psi = bench::load_state(name, soft_max, 1);
+    for (std::size_t i = 0; i < warmup; ++i) {
+        psi = diffusion_step(lambda, heisenberg, psi);
+        psi.shrink();
+    }
+    psi.freeze();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(energy(hamiltonian, psi));
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(psi.size()) * state.iterations());
+}
+BENCHMARK_CAPTURE(BM_Energy, 5x5, std::string{"5x5"})
+    ->ArgsProduct({{10'000, 100'000}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_CAPTURE(BM_DiffusionStep, 5x5, std::string{"5x5"})
+    ->RangeMultiplier(10)
+    ->Range(1'000, 100'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DiffusionStep, Kagome12, std::string{"Kagome-12"})
+    ->RangeMultiplier(10)
+    ->Range(1'000, 100'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+/// Same as BM_DiffusionStep, but for a block of `range(1)` states. Items are
+/// elements times states, so the rate is comparable with BM_DiffusionStep.
+auto BM_BlockDiffusionStep(benchmark::State& state, std::string const& name)
+{
+    constexpr double      lambda = 10.0;
+    constexpr std::size_t warmup = 10;
+    auto const        soft_max    = static_cast<std::size_t>(state.range(0));
+    auto const        block_size  = static_cast<std::size_t>(state.range(1));
+    Hamiltonian const hamiltonian = bench::load_hamiltonian(name);
+    auto              psi         = bench::load_state(name, soft_max, 1);
+    for (std::size_t i = 0; i < warmup; ++i) {
+        psi = diffusion_step(lambda, hamiltonian, psi);
+        psi.shrink();
+    }
+    std::vector<QuantumState> columns;
+    for (std::size_t j = 0; j < block_size; ++j) {
+        columns.push_back(diffusion_step(lambda, hamiltonian, psi));
+        columns.back().scale(std::polar(1.0, static_cast<double>(j)));
+        columns.back().shrink();
+    }
+    auto const block = BlockState::from_columns(columns);
+    for (auto _ : state) {
+        auto h_block = diffusion_step(lambda, hamiltonian, block);
+        h_block.shrink();
+        benchmark::DoNotOptimize(h_block.size());
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(block.size())
+                            * static_cast<std::int64_t>(block_size)
+                            * state.iterations());
+}
+BENCHMARK_CAPTURE(BM_BlockDiffusionStep, 5x5, std::string{"5x5"})
+    ->ArgsProduct({{10'000}, {1, 4, 16}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+} // namespace
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "hamiltonian.hpp"
+#include "quantum_state.hpp"
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Synthetic inputs for the benchmarks. Everything is seeded, so that two runs
+// of the suite see exactly the same data.
+namespace bench {
+
+inline auto random_spin(int const n, std::mt19937_64& generator) -> SpinVector
+{
+    std::bernoulli_distribution dist;
+    std::vector<int>            spins(static_cast<std::size_t>(n));
+    for (auto& s : spins) {
+        s = dist(generator);
+    }
+    return SpinVector{std::begin(spins), std::end(spins)};
+}
+
+inline auto random_spins(std::size_t const count, int const n,
+    std::uint64_t const seed = 42) -> std::vector<SpinVector>
+{
+    std::mt19937_64         generator{seed};
+    std::vector<SpinVector> spins;
+    spins.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        spins.push_back(random_spin(n, generator));
+    }
+    return spins;
+}
+
+/// Returns a state with `count` distinct random configurations of `n` spins
+/// and normally distributed amplitudes. `n` should be large enough for
+/// 2ⁿ ≫ count, otherwise generation slows down because of collisions.
+inline auto random_state(std::size_t const count, int const n,
+    std::size_t const number_workers, std::uint64_t const seed = 42)
+    -> QuantumState
+{
+    std::mt19937_64                  generator{seed};
+    std::normal_distribution<double> amplitude;
+    QuantumState psi{count, count, number_workers};
+    while (psi.size() < count) {
+        psi.insert({random_spin(n, generator),
+            std::complex{amplitude(generator), amplitude(generator)}});
+    }
+    return psi;
+}
+
+inline auto load_hamiltonian(std::string const& name) -> Heisenberg
+{
+    std::ifstream in{std::string{LANCZOS_DATA_DIR} + "/" + name
+                     + ".hamiltonian"};
+    Heisenberg    hamiltonian;
+    if (!(in >> hamiltonian) && !in.eof()) {
+        throw std::runtime_error{"Failed to parse '" + name + "'."};
+    }
+    return hamiltonian;
+}
+
+inline auto load_state(std::string const& name, std::size_t const soft_max,
+    std::size_t const number_workers) -> QuantumState
+{
+    std::ifstream in{std::string{LANCZOS_DATA_DIR} + "/" + name + ".in"};
+    QuantumState  psi{soft_max, 0, number_workers};
+    psi.max_growth(
+        static_cast<double>(load_hamiltonian(name).number_edges() + 1));
+    in >> psi;
+    return psi;
+}
+
+} // namespace bench
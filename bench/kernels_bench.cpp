@@ -0,0 +1,59 @@
+#include "kernels.hpp"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+namespace {
+/// Skips the benchmark if the CPU does not support `range(0)`.
+auto selected_kernels(benchmark::State& state) -> Kernels const*
+{
+    auto const isa = static_cast<Isa>(state.range(0));
+    if (!supported(isa)) {
+        state.SkipWithError("instruction set not supported");
+        return nullptr;
+    }
+    state.SetLabel(to_string(isa));
+    return &kernels(isa);
+}
+
+auto BM_SquaredNorm(benchmark::State& state)
+{
+    auto const* kernel = selected_kernels(state);
+    if (kernel == nullptr) { return; }
+    std::vector<std::complex<double>> xs(1 << 16, {0.5, -0.25});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(kernel->squared_norm(xs.data(), xs.size()));
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(xs.size()) * state.iterations());
+}
+BENCHMARK(BM_SquaredNorm)->DenseRange(0, 3);
+
+auto BM_Antiparallel(benchmark::State& state)
+{
+    auto const* kernel = selected_kernels(state);
+    if (kernel == nullptr) { return; }
+    constexpr auto                   n = 25;
+    std::mt19937_64                  generator{42};
+    std::uniform_int_distribution<>  site{0, n - 1};
+    std::vector<std::pair<int, int>> edges(64);
+    for (auto& edge : edges) {
+        edge = {site(generator), site(generator)};
+    }
+    std::uint64_t spins[kernel_lanes];
+    for (auto& x : spins) {
+        x = generator() >> (64 - n);
+    }
+    std::uint64_t masks[kernel_lanes];
+    int           counts[kernel_lanes];
+    for (auto _ : state) {
+        kernel->antiparallel(
+            spins, edges.data(), edges.size(), n, masks, counts);
+        benchmark::DoNotOptimize(masks);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(kernel_lanes) * state.iterations());
+}
+BENCHMARK(BM_Antiparallel)->DenseRange(0, 3);
+} // namespace
@@ -0,0 +1,160 @@
+#include "generators.hpp"
+#include "quantum_state.hpp"
+#include <benchmark/benchmark.h>
+#include <sstream>
+
+namespace {
+// Number of sites used for synthetic states. Large enough to make collisions
+// negligible even for 10⁸ configurations.
+constexpr int synthetic_sites = 64;
+
+auto BM_BuilderThroughput(benchmark::State& state)
+{
+    constexpr std::size_t count  = 1 << 20;
+    auto const number_workers    = static_cast<std::size_t>(state.range(0));
+    auto const spins = bench::random_spins(count / 16, synthetic_sites);
+    for (auto _ : state) {
+        state.PauseTiming();
+        QuantumState psi{count, count, number_workers};
+        state.ResumeTiming();
+        {
+            QuantumStateBuilder builder{psi};
+            builder.start();
+            for (std::size_t i = 0; i < count; ++i) {
+                builder += {1.0, spins[i % spins.size()]};
+            }
+            builder.stop();
+        }
+        benchmark::DoNotOptimize(psi.size());
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+BENCHMARK(BM_BuilderThroughput)
+    ->RangeMultiplier(2)
+    ->Range(1, 64)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+auto BM_Shrink(benchmark::State& state)
+{
+    auto const count = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto psi = bench::random_state(count, synthetic_sites, 1);
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(psi.shrink());
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+BENCHMARK(BM_Shrink)
+    ->RangeMultiplier(10)
+    ->Range(100'000, 100'000'000)
+    ->Iterations(3)
+    ->Unit(benchmark::kMillisecond);
+
+/// Removes half of the elements of a state with 8 shards, either by sorting
+/// all of them or from the summaries of the workers.
+template <bool Summarised>
+auto BM_ShrinkHalf(benchmark::State& state)
+{
+    auto const count  = static_cast<std::size_t>(state.range(0));
+    auto const source = bench::random_state(count, synthetic_sites, 1);
+    for (auto _ : state) {
+        state.PauseTiming();
+        QuantumState psi{count / 2, count, 8};
+        {
+            QuantumStateBuilder builder{psi};
+            if (Summarised) { builder.summarise(count / 2); }
+            builder.start();
+            source.for_each([&builder](auto const& x) {
+                builder += {x.second, x.first};
+            });
+            builder.stop();
+            if (Summarised) { psi.summaries(builder.summaries()); }
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(psi.shrink());
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_ShrinkHalf, false)
+    ->Name("BM_ShrinkHalf")
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ShrinkHalf, true)
+    ->Name("BM_ShrinkHalfSummarised")
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+template <bool Binary>
+auto BM_Write(benchmark::State& state)
+{
+    auto const count = static_cast<std::size_t>(state.range(0));
+    auto const psi   = bench::random_state(count, synthetic_sites, 1);
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        std::ostringstream out;
+        if constexpr (Binary) { write_binary(out, psi); }
+        else {
+            out << psi;
+        }
+        bytes += out.str().size();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Write, false)
+    ->Name("BM_WriteText")
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Write, true)
+    ->Name("BM_WriteBinary")
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+template <bool Binary>
+auto BM_Read(benchmark::State& state)
+{
+    auto const count = static_cast<std::size_t>(state.range(0));
+    auto const psi   = bench::random_state(count, synthetic_sites, 1);
+    std::ostringstream out;
+    if constexpr (Binary) { write_binary(out, psi); }
+    else {
+        out << psi;
+    }
+    auto const serialised = out.str();
+    for (auto _ : state) {
+        std::istringstream in{serialised};
+        QuantumState       result{count, count, 1};
+        if constexpr (Binary) { read_binary(in, result); }
+        else {
+            in >> result;
+        }
+        benchmark::DoNotOptimize(result.size());
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(serialised.size())
+                            * state.iterations());
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Read, false)
+    ->Name("BM_ReadText")
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Read, true)
+    ->Name("BM_ReadBinary")
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond);
+} // namespace
@@ -0,0 +1,87 @@
+#include "spin_map.hpp"
+#include <benchmark/benchmark.h>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+namespace {
+template <class Hasher>
+using Bytell = ska::bytell_hash_map<SpinVector, std::complex<double>, Hasher>;
+template <class Hasher>
+using Flat = ska::flat_hash_map<SpinVector, std::complex<double>, Hasher>;
+template <class Hasher>
+using Swiss = SwissMap<SpinVector, std::complex<double>, Hasher>;
+template <class Hasher>
+using Std = std::unordered_map<SpinVector, std::complex<double>, Hasher>;
+
+/// All configurations of 20 spins with 10 spins up. Unlike random spins they
+/// only differ in a few bytes, like the configurations of a real state.
+auto sector() -> std::vector<SpinVector>
+{
+    constexpr int           n = 20;
+    std::vector<SpinVector> spins;
+    // Gosper's hack enumerates the integers with 10 bits set in order.
+    for (std::uint64_t x = (1u << (n / 2)) - 1; x < (1u << n);) {
+        spins.push_back(SpinVector::from_bits(x, n));
+        auto const lowest = x & -x;
+        auto const ripple = x + lowest;
+        x                 = (((ripple ^ x) >> 2) / lowest) | ripple;
+    }
+    return spins;
+}
+
+template <class Hasher>
+auto BM_SpinHash(benchmark::State& state)
+{
+    auto const   spins = sector();
+    Hasher const hash{};
+    std::size_t  i   = 0;
+    std::size_t  sum = 0;
+    for (auto _ : state) {
+        sum += hash(spins[i]);
+        i = i + 1 < spins.size() ? i + 1 : 0;
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations());
+}
+
+/// Adds 8 contributions to every configuration of `sector()` in a scattered
+/// order, the way `Updater` accumulates H|ψ〉 into its shard.
+template <class Map>
+auto BM_SpinMapAccumulate(benchmark::State& state)
+{
+    auto const spins = sector();
+    auto const count = 8 * spins.size();
+    for (auto _ : state) {
+        Map table;
+        for (std::size_t i = 0; i < count; ++i) {
+            auto const& spin  = spins[(i * 7919) % spins.size()];
+            auto        where = table.find(spin);
+            if (where == table.end()) { table.emplace(spin, 1.0); }
+            else {
+                where->second += 1.0;
+            }
+        }
+        benchmark::DoNotOptimize(table.size());
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(count) * state.iterations());
+}
+
+#define SPIN_MAP_BENCHMARKS(Hasher)                                            \
+    BENCHMARK_TEMPLATE(BM_SpinHash, Hasher);                                   \
+    BENCHMARK_TEMPLATE(BM_SpinMapAccumulate, Bytell<Hasher>)                   \
+        ->Unit(benchmark::kMillisecond);                                       \
+    BENCHMARK_TEMPLATE(BM_SpinMapAccumulate, Flat<Hasher>)                     \
+        ->Unit(benchmark::kMillisecond);                                       \
+    BENCHMARK_TEMPLATE(BM_SpinMapAccumulate, Swiss<Hasher>)                    \
+        ->Unit(benchmark::kMillisecond);                                       \
+    BENCHMARK_TEMPLATE(BM_SpinMapAccumulate, Std<Hasher>)                      \
+        ->Unit(benchmark::kMillisecond)
+
+SPIN_MAP_BENCHMARKS(SpinHasher);
+SPIN_MAP_BENCHMARKS(MultiplyShiftHasher);
+#if defined(__SSE4_2__)
+SPIN_MAP_BENCHMARKS(Crc32cHasher);
+#endif
+} // namespace
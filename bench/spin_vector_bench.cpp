@@ -0,0 +1,48 @@
+#include "generators.hpp"
+#include "spin_chain.hpp"
+#include <benchmark/benchmark.h>
+
+namespace {
+constexpr std::size_t pool_size = 1 << 12;
+
+auto BM_SpinVectorHash(benchmark::State& state)
+{
+    auto const spins =
+        bench::random_spins(pool_size, static_cast<int>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(spins[i].hash());
+        i = (i + 1) % pool_size;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SpinVectorHash)->Arg(25)->Arg(64)->Arg(112);
+
+auto BM_SpinVectorEqual(benchmark::State& state)
+{
+    auto const spins =
+        bench::random_spins(pool_size, static_cast<int>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(spins[i] == spins[(i + 1) % pool_size]);
+        i = (i + 1) % pool_size;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SpinVectorEqual)->Arg(25)->Arg(64)->Arg(112);
+
+auto BM_SpinVectorFlip(benchmark::State& state)
+{
+    auto const  n     = static_cast<int>(state.range(0));
+    auto const  spins = bench::random_spins(pool_size, n);
+    std::size_t i     = 0;
+    int         j     = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(spins[i].flipped({j, (j + 1) % n}));
+        i = (i + 1) % pool_size;
+        j = (j + 1) % n;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SpinVectorFlip)->Arg(25)->Arg(64)->Arg(112);
+} // namespace
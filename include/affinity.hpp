@@ -0,0 +1,63 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/// \brief Assignment of shards to cores and NUMA nodes.
+///
+/// Shards are split into contiguous blocks, one block per NUMA node. Since
+/// `spin_to_index` uses the leading bits of a configuration, this means that
+/// each node owns a contiguous range of the configuration space.
+class Placement {
+    std::vector<int> _cpus;
+    std::vector<int> _nodes;
+
+  public:
+    /// Distributes `number_shards` shards over the cores this process is
+    /// allowed to run on, spreading them evenly across NUMA nodes.
+    static auto spread(std::size_t number_shards) -> Placement;
+
+    auto size() const noexcept { return _cpus.size(); }
+    auto cpu(std::size_t const shard) const { return _cpus.at(shard); }
+    auto node(std::size_t const shard) const { return _nodes.at(shard); }
+};
+
+/// Pins the calling thread to `cpu` and makes it prefer memory local to
+/// `node`. Placement is only a performance hint, so failure is reported by
+/// the return value rather than by an exception.
+auto pin_current_thread(int cpu, int node) noexcept -> bool;
+
+/// Undoes `pin_current_thread`: lets the calling thread run on any core the
+/// process may use and allocate memory on its local node.
+auto unpin_current_thread() noexcept -> bool;
@@ -0,0 +1,160 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include "diffusion.hpp"
+#include "quantum_state.hpp"
+#include "spin_map.hpp"
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+/// \brief Several states |ψ₀〉, …, |ψₖ₋₁〉stored on a common set of
+/// configurations.
+///
+/// Every configuration (row) holds `block_size()` amplitudes, one per state
+/// (column). Applying H to the block enumerates H|σ〉and looks up every
+/// connected configuration only once for all k states, so the cost of the
+/// Hamiltonian and of the hash tables is shared between the columns.
+///
+/// Rows are distributed between shards by `spin_to_index`, like the elements
+/// of a QuantumState. Within a shard, rows are stored contiguously and
+/// indexed by a hash table.
+class BlockState {
+  public:
+    using map_type = SpinMap<std::size_t>;
+
+  private:
+    struct Shard {
+        map_type                          index; ///< Spin → row
+        std::vector<SpinVector>           keys;
+        std::vector<std::complex<double>> amplitudes; ///< Row-major
+    };
+
+    std::size_t        _block_size;
+    std::size_t        _soft_max_size;
+    std::vector<Shard> _shards;
+
+  public:
+    BlockState(std::size_t block_size, std::size_t soft_max,
+        std::size_t number_shards);
+
+    BlockState(BlockState const&) = delete;
+    BlockState(BlockState&&)      = default;
+    BlockState& operator=(BlockState const&) = delete;
+    BlockState& operator=(BlockState&&) = default;
+
+    /// Combines `columns` into a block. Number of shards and `soft_max` are
+    /// taken from the first state.
+    static auto from_columns(std::vector<QuantumState> const& columns)
+        -> BlockState;
+    /// Returns a copy of column `j` as an ordinary state.
+    auto column(std::size_t j) const -> QuantumState;
+
+    auto block_size() const noexcept { return _block_size; }
+    auto soft_max() const noexcept { return _soft_max_size; }
+    auto number_shards() const noexcept { return _shards.size(); }
+    /// Returns the number of rows.
+    auto size() const noexcept -> std::size_t;
+
+    /// Returns the row of `spin`, inserting a row of zeros if needed.
+    auto row(SpinVector const& spin) -> std::complex<double>*;
+    /// Returns the row of `spin` or `nullptr` if there is none.
+    auto find(SpinVector const& spin) const -> std::complex<double> const*;
+    /// Makes room for `count` rows in total.
+    auto reserve(std::size_t count) -> void;
+
+    /// Calls `fn(spin, row)` for every row of shard `i`.
+    template <class Function>
+    auto for_each_in_shard(std::size_t i, Function&& fn) const -> void;
+    template <class Function>
+    auto for_each(Function&& fn) const -> void;
+
+    /// Returns an empty block with the same parameters.
+    auto empty_successor() const -> BlockState;
+
+    /// Returns 〈ψⱼ|ψⱼ〉for every column j.
+    auto squared_norms() const -> std::vector<double>;
+    /// Normalises every column.
+    auto normalize() -> BlockState&;
+    /// Orthonormalises the columns using modified Gram–Schmidt. Column j
+    /// becomes orthogonal to columns 0, …, j - 1, so repeated filtering
+    /// converges to the j'th lowest eigenstate instead of the ground state.
+    /// Throws if the columns are linearly dependent.
+    auto orthonormalize() -> BlockState&;
+
+    /// Keeps the `soft_max()` rows with the largest Σⱼ|ψⱼ|². Returns the
+    /// discarded squared norm summed over all columns.
+    auto shrink() -> double;
+
+  private:
+    /// Returns Σ conj(ψᵢ)·ψⱼ over all rows.
+    auto dot(std::size_t i, std::size_t j) const -> std::complex<double>;
+    /// Performs ψⱼ += scale·ψᵢ, or ψⱼ *= scale if i == j.
+    auto axpy(std::complex<double> scale, std::size_t i, std::size_t j)
+        -> void;
+};
+
+template <class Function>
+auto BlockState::for_each_in_shard(std::size_t const i, Function&& fn) const
+    -> void
+{
+    TCM_ASSERT(i < number_shards());
+    auto const& shard = _shards[i];
+    for (std::size_t r = 0; r < shard.keys.size(); ++r) {
+        fn(shard.keys[r], shard.amplitudes.data() + r * _block_size);
+    }
+}
+
+template <class Function>
+auto BlockState::for_each(Function&& fn) const -> void
+{
+    for (std::size_t i = 0; i < number_shards(); ++i) {
+        for_each_in_shard(i, fn);
+    }
+}
+
+/// Performs one step of `diffusion_step` for every column of the block and
+/// normalises the columns.
+auto diffusion_step(double, Hamiltonian const&, BlockState const&)
+    -> BlockState;
+
+/// Returns 〈ψⱼ|H|ψⱼ〉for every column j.
+auto energies(Hamiltonian const&, BlockState const&)
+    -> std::vector<std::complex<double>>;
+
+/// Block version of `diffusion_loop`: applies the filter to all columns,
+/// truncates the block to `soft_max()` rows and normalises (or, if
+/// `orthogonalize`, orthonormalises) the columns after every iteration.
+auto diffusion_loop(double, PolynomialFilter const&, Hamiltonian const&,
+    BlockState const&, std::size_t, bool orthogonalize) -> BlockState;
@@ -0,0 +1,135 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include "hamiltonian.hpp"
+#include "spin_chain.hpp"
+#include <complex>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+/// \file
+/// \brief Dense representation of states of small systems.
+///
+/// If the Hilbert space (or the S^z sector the state lives in) is small
+/// enough, amplitudes are stored in a plain array indexed by the rank of the
+/// configuration. H|ψ〉 is then computed without any hashing: every element
+/// of the result gathers its contributions from the elements it is connected
+/// to, so the array can be split between threads without synchronisation.
+
+class QuantumState;
+
+/// \brief Configurations of `number_spins() ≤ 64` spins, optionally
+/// restricted to a fixed number of spins up.
+///
+/// Configurations are ranked in increasing order of `SpinVector::bits`, i.e.
+/// in the order of `SpinVector::operator<`. Within a sector, the rank of `x`
+/// is found with two table lookups, `_high[x >> low_bits] + _low[x & mask]`
+/// (H. Q. Lin, Phys. Rev. B 42, 6561 (1990)), where both tables have about
+/// 2^(number_spins / 2) entries.
+class DenseBasis {
+    int                        _number_spins;
+    std::optional<int>         _number_up;
+    int                        _low_bits;
+    std::vector<std::uint64_t> _states;
+    std::vector<std::uint64_t> _low;
+    std::vector<std::uint64_t> _high;
+
+  public:
+    static constexpr auto npos = std::numeric_limits<std::size_t>::max();
+
+    /// All 2^`number_spins` configurations if `number_up` is `nullopt`, and
+    /// those with exactly `*number_up` spins up otherwise.
+    DenseBasis(int number_spins, std::optional<int> number_up);
+
+    /// Returns the size of the basis without constructing it.
+    static auto dimension(int number_spins, std::optional<int> number_up)
+        -> std::size_t;
+
+    auto number_spins() const noexcept { return _number_spins; }
+    auto number_up() const noexcept { return _number_up; }
+    auto size() const noexcept -> std::size_t
+    {
+        return _number_up.has_value() ? _states.size()
+                                      : (std::size_t{1} << _number_spins);
+    }
+
+    /// Returns the configuration of rank `i` as `SpinVector::bits`.
+    auto bits(std::size_t const i) const noexcept -> std::uint64_t
+    {
+        TCM_ASSERT(i < size());
+        return _number_up.has_value() ? _states[i] : i;
+    }
+
+    auto spin(std::size_t const i) const noexcept -> SpinVector
+    {
+        return SpinVector::from_bits(bits(i), _number_spins);
+    }
+
+    /// Returns the rank of `x`, which must be part of the basis.
+    auto index(std::uint64_t const x) const noexcept -> std::size_t
+    {
+        if (!_number_up.has_value()) { return x; }
+        auto const mask = (std::uint64_t{1} << _low_bits) - 1;
+        return _high[x >> _low_bits] + _low[x & mask];
+    }
+
+    /// Returns the rank of `spin` or `npos` if `spin` is not part of the
+    /// basis.
+    auto find(SpinVector const& spin) const noexcept -> std::size_t;
+};
+
+/// Returns the smallest basis containing all configurations of `psi`: the
+/// sector of their number of spins up if it is the same for all of them, and
+/// the whole Hilbert space otherwise. Returns `nullopt` if `psi` is empty, if
+/// the configurations have different lengths, or if there are more than 64
+/// spins.
+auto smallest_basis(QuantumState const& psi)
+    -> std::optional<std::pair<int, std::optional<int>>>;
+
+/// Returns the number of bytes `diffusion_loop` needs with Backend::dense at
+/// its peak: the initial state, the state of the previous iteration and the
+/// three vectors of the Chebyshev recurrence are alive at once, `averaging`
+/// adds the trial vector |φ〉 and H|φ〉, and the basis stores the
+/// configurations of a sector.
+auto dense_footprint(std::size_t dimension, bool averaging) noexcept
+    -> std::size_t;
+
+/// Returns α·H|x〉+ β|x〉+ γ|y〉for a state `x` (and `y`, if not `nullptr`)
+/// with Backend::dense. `hamiltonian` must hold a Heisenberg or a
+/// CouplingMatrix, which are required to conserve the number of spins up.
+auto apply_dense(Hamiltonian const& hamiltonian, std::complex<double> alpha,
+    std::complex<double> beta, QuantumState const& x,
+    std::complex<double> gamma, QuantumState const* y) -> QuantumState;
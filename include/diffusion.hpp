@@ -31,13 +31,164 @@
 
 #pragma once
 
+#include "config.hpp"
 #include "hamiltonian.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
 class QuantumState;
+struct IterationMetrics;
+
+/// \brief Polynomial in H which is applied between two consecutive
+/// truncations of the state.
+///
+/// `power` computes (Λ - H)ᵏ|ψ〉. `chebyshev` computes Tₖ((c - H)/e)|ψ〉where
+/// Tₖ is the Chebyshev polynomial of the first kind and [c - e, c + e] =
+/// [lower, Λ] is the part of the spectrum which should be suppressed.
+struct PolynomialFilter {
+    enum class Kind { power, chebyshev };
+
+    Kind        kind   = Kind::power;
+    std::size_t degree = 1;
+    double      lower  = 0.0;
+};
+
+/// \brief Evaluates P(H)|ψ〉 for the given filter P.
+///
+/// `apply(α, β, x, γ, y)` must return α·H|x〉+ β|x〉+ γ|y〉, where `y` is a
+/// pointer which may be `nullptr`. This allows the same recurrences to be
+/// used for any representation of the state.
+template <class State, class Apply>
+auto evaluate_filter(double const lambda, PolynomialFilter const& filter,
+    State const& psi, Apply&& apply) -> State
+{
+    if (filter.degree == 0) {
+        throw_with_trace(
+            std::runtime_error{"Degree of the filter must be positive!"});
+    }
+    switch (filter.kind) {
+    case PolynomialFilter::Kind::power: {
+        auto y = apply(-1.0, lambda, psi, 0.0, nullptr);
+        for (auto k = 1ul; k < filter.degree; ++k) {
+            y = apply(-1.0, lambda, y, 0.0, nullptr);
+        }
+        return y;
+    }
+    case PolynomialFilter::Kind::chebyshev: {
+        if (!(filter.lower < lambda)) {
+            throw_with_trace(std::runtime_error{
+                "Chebyshev filter: lower bound of the suppressed interval "
+                "must be smaller than Λ."});
+        }
+        auto const center     = 0.5 * (lambda + filter.lower);
+        auto const half_width = 0.5 * (lambda - filter.lower);
+
+        // Three-term recurrence with t = (c - H) / e:
+        //     y₀ = |ψ〉, y₁ = t|ψ〉, yₖ₊₁ = 2t·yₖ - yₖ₋₁.
+        // Only the last two vectors are kept alive.
+        std::optional<State> previous_storage;
+        State const*         previous = std::addressof(psi);
+        auto current =
+            apply(-1.0 / half_width, center / half_width, psi, 0.0, nullptr);
+        for (auto k = 1ul; k < filter.degree; ++k) {
+            auto next = apply(-2.0 / half_width, 2.0 * center / half_width,
+                current, -1.0, previous);
+            previous_storage = std::move(current);
+            previous         = std::addressof(*previous_storage);
+            current          = std::move(next);
+        }
+        return current;
+    }
+#if defined(BOOST_GCC)
+    // GCC fails to notice that all cases have already been handled.
+    default: TCM_ASSERT(false); std::terminate();
+#endif
+    }
+}
+
+/// Returns how many vectors besides |ψ〉 `evaluate_filter` keeps alive at the
+/// same time.
+inline auto live_vectors(PolynomialFilter const& filter) noexcept
+    -> std::size_t
+{
+    std::size_t const most =
+        filter.kind == PolynomialFilter::Kind::chebyshev ? 3 : 2;
+    return std::min(std::max<std::size_t>(filter.degree, 1), most);
+}
 
 auto diffusion_step(double, Hamiltonian const&, QuantumState const&)
     -> QuantumState;
 
-auto diffusion_loop(double, Hamiltonian const&, QuantumState const&,
-    std::size_t) -> QuantumState;
+/// Applies the filter to |ψ〉 and normalises the result. No truncation is
+/// performed, i.e. all intermediate vectors are kept exactly. If `metrics` is
+/// not `nullptr`, timings and counters are added to it.
+auto filter_step(double, PolynomialFilter const&, Hamiltonian const&,
+    QuantumState const&, IterationMetrics* metrics = nullptr) -> QuantumState;
+
+/// \brief Projected energy estimator averaged over iterations.
+///
+/// With stochastic truncation the state of every iteration is a noisy but
+/// unbiased estimate of the filtered state. 〈ψ|H|ψ〉/ 〈ψ|ψ〉 is quadratic in
+/// |ψ〉, so the noise biases it. Instead, the state of iteration `skip` is
+/// fixed as a trial vector |φ〉 and E = Σᵢ〈φ|H|ψᵢ〉/ Σᵢ〈φ|ψᵢ〉 is
+/// accumulated, which is linear in |ψᵢ〉 and cheap, since H|φ〉 is computed
+/// only once.
+struct EnergyAverage {
+    std::size_t          skip        = 0; ///< Iterations to ignore
+    std::size_t          count       = 0; ///< Iterations with an Eᵢ
+    std::size_t          skipped     = 0; ///< Iterations with 〈φ|ψᵢ〉= 0
+    std::complex<double> numerator   = 0.0; ///< Σᵢ〈φ|H|ψᵢ〉
+    std::complex<double> denominator = 0.0; ///< Σᵢ〈φ|ψᵢ〉
+    double               sum         = 0.0; ///< Σᵢ Eᵢ
+    double               sum_squares = 0.0; ///< Σᵢ Eᵢ²
+
+    /// Adds 〈φ|H|ψᵢ〉 and 〈φ|ψᵢ〉 of one iteration and returns Eᵢ. If
+    /// 〈φ|ψᵢ〉= 0, which stochastic truncation can produce, Eᵢ does not exist
+    /// and nothing is returned. The sums of `mean` still include the
+    /// iteration.
+    auto add(std::complex<double> const h_overlap,
+        std::complex<double> const overlap) noexcept -> std::optional<double>
+    {
+        numerator += h_overlap;
+        denominator += overlap;
+        if (overlap == 0.0) {
+            ++skipped;
+            return std::nullopt;
+        }
+        auto const energy = (h_overlap / overlap).real();
+        ++count;
+        sum += energy;
+        sum_squares += energy * energy;
+        return energy;
+    }
+
+    auto mean() const noexcept -> double
+    {
+        return (numerator / denominator).real();
+    }
+
+    /// Standard error of the per-iteration estimates Eᵢ assuming they are
+    /// uncorrelated. Consecutive iterations are correlated, so this is a
+    /// lower bound.
+    auto standard_error() const noexcept -> double
+    {
+        if (count < 2) { return 0.0; }
+        auto const n        = static_cast<double>(count);
+        auto const variance = (sum_squares - sum * sum / n) / (n - 1.0);
+        return std::sqrt(std::max(variance, 0.0) / n);
+    }
+};
+
+/// If `metrics` is not `nullptr`, one JSON object per iteration is written to
+/// it (see IterationMetrics). If `average` is not `nullptr`, the energy of
+/// every iteration past `average->skip` is computed and added to it.
+auto diffusion_loop(double, PolynomialFilter const&, Hamiltonian const&,
+    QuantumState const&, std::size_t, std::ostream* metrics = nullptr,
+    EnergyAverage* average = nullptr) -> QuantumState;
 
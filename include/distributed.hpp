@@ -0,0 +1,103 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "diffusion.hpp"
+#include "quantum_state.hpp"
+#include <complex>
+#include <cstddef>
+#include <iosfwd>
+#include <mpi.h>
+
+/// \brief A QuantumState partitioned between MPI ranks.
+///
+/// Every configuration is owned by exactly one rank (see `owner`). Within a
+/// rank, the owned part is an ordinary QuantumState with its own shards and
+/// Updater threads. All member functions except `local` and `owner` are
+/// collective, i.e. must be called by all ranks of the communicator.
+class DistributedState {
+    MPI_Comm     _comm;
+    int          _rank;
+    int          _size;
+    QuantumState _local;
+
+  public:
+    DistributedState(MPI_Comm comm, QuantumState local);
+
+    DistributedState(DistributedState const&) = delete;
+    DistributedState(DistributedState&&)      = default;
+    DistributedState& operator=(DistributedState const&) = delete;
+    DistributedState& operator=(DistributedState&&) = default;
+
+    /// Distributes `psi`, which is only read on `root`, between the ranks.
+    /// `psi` on the other ranks is only used as a template for the
+    /// parameters (soft_max, shards, ...) of the local part.
+    static auto scatter(MPI_Comm, QuantumState const& psi, int root = 0)
+        -> DistributedState;
+
+    auto comm() const noexcept { return _comm; }
+    auto rank() const noexcept { return _rank; }
+    auto owner(SpinVector const& spin) const noexcept -> int
+    {
+        return static_cast<int>(spin.hash() % static_cast<std::size_t>(_size));
+    }
+
+    auto local() noexcept -> QuantumState& { return _local; }
+    auto local() const noexcept -> QuantumState const& { return _local; }
+
+    auto empty_successor() const -> DistributedState;
+
+    /// Total number of elements on all ranks.
+    auto size() const -> std::size_t;
+    auto normalize() -> DistributedState&;
+
+    /// Keeps the `soft_max()` globally largest elements. The threshold is
+    /// found by bisection over the bit patterns of |cᵢ|², which costs at most
+    /// 64 reductions of a single integer. Returns the discarded norm.
+    auto shrink() -> double;
+
+    /// Adds `generated`, which may contain configurations owned by any rank,
+    /// to this state. Contributions are bucketed per destination and
+    /// exchanged in batches with MPI_Alltoallv.
+    auto accumulate(QuantumState const& generated) -> void;
+
+    /// Streams the state to `out` on `root` in the same text format as
+    /// `operator<<(std::ostream&, QuantumState const&)`. The full state is
+    /// never held in memory of a single rank.
+    auto write(std::ostream& out, int root = 0) const -> void;
+};
+
+auto energy(Hamiltonian const&, DistributedState const&)
+    -> std::complex<double>;
+
+auto diffusion_loop(double, PolynomialFilter const&, Hamiltonian const&,
+    DistributedState const&, std::size_t) -> DistributedState;
@@ -33,6 +33,7 @@
 
 #include <complex>
 #include <functional>
+#include <iosfwd>
 #include <vector>
 
 class SpinVector;
@@ -72,10 +73,92 @@ class Heisenberg {
     Heisenberg& operator=(Heisenberg const&) = default;
     Heisenberg& operator=(Heisenberg&&) noexcept = default;
 
+    /// Performs |ψ〉+= c * H|σ〉. Without `with_diagonal`, only the
+    /// off-diagonal terms are generated (see `QuantumState::cache_diagonal`).
+    auto operator()(SpinVector, std::complex<double>, QuantumStateBuilder&,
+        bool with_diagonal = true) const -> void;
+
+    /// Maximal number of configurations processed by the batched overload.
+    static constexpr std::size_t batch_size = 8;
+
+    /// Performs |ψ〉+= cᵢ * H|σᵢ〉for all i < count ≤ batch_size, or only its
+    /// off-diagonal part without `with_diagonal`.
+    ///
+    /// The alignment of every edge is determined for all configurations at
+    /// once using shifts and XORs on 64-bit words (`Kernels::antiparallel`,
+    /// vectorised for the instruction set of the CPU). Diagonal terms are
+    /// then obtained with popcounts and off-diagonal ones by iterating over
+    /// the set bits. Configurations of more than 64 spins are handled one by
+    /// one.
+    auto operator()(SpinVector const* spins, std::complex<double> const* coeffs,
+        std::size_t count, QuantumStateBuilder&,
+        bool with_diagonal = true) const -> void;
+
+    /// Stores 〈σᵢ|H|σᵢ〉in `out[i]` for all i < count ≤ batch_size.
+    auto diagonal(SpinVector const* spins, std::size_t count,
+        std::complex<double>* out) const -> void;
+
+    auto specs() const noexcept -> std::vector<spec_type> const&
+    {
+        return _specs;
+    }
+
+    /// Returns the total number of edges. H|σ〉 contains at most
+    /// `number_edges() + 1` distinct configurations.
+    auto number_edges() const noexcept -> std::size_t;
+
+    friend auto operator>>(std::istream&, Heisenberg&) -> std::istream&;
+};
+
+/// \brief Heisenberg Hamiltonian with a dense matrix of couplings,
+/// H = ½∑ᵢ≠ⱼ Jᵢⱼ σᵢ·σⱼ, i.e. ∑ᵢ<ⱼ Jᵢⱼ σᵢ·σⱼ for a symmetric J.
+///
+/// Meant for long-range models, where almost all pairs of spins interact and
+/// an edge list would be quadratic in size. Jᵢⱼ and Jⱼᵢ are merged into one
+/// coupling when the matrix is constructed, so every pair produces a single
+/// contribution. For configurations of at most 64 spins, H|σ〉 only visits
+/// the antiparallel pairs (spins up × spins down, found with bit scans), and
+/// the diagonal is obtained in the same pass from the sum of all couplings.
+class CouplingMatrix {
+    int                 _number_spins;
+    std::vector<double> _couplings; ///< Symmetric, zero diagonal, row-major.
+    double              _total;     ///< ∑ᵢ<ⱼ Jᵢⱼ
+
+  public:
+    CouplingMatrix() noexcept : _number_spins{0}, _couplings{}, _total{0.0} {}
+
+    /// Constructs the operator from a row-major n×n matrix, n =
+    /// `number_spins`. Diagonal elements are ignored.
+    CouplingMatrix(int number_spins, std::vector<double> couplings);
+
+    auto number_spins() const noexcept -> int { return _number_spins; }
+
+    /// Returns the (symmetrised) coupling of spins i and j.
+    auto coupling(int const i, int const j) const noexcept -> double
+    {
+        return _couplings[static_cast<std::size_t>(i * _number_spins + j)];
+    }
+
     /// Performs |ψ〉+= c * H|σ〉.
     auto operator()(
         SpinVector, std::complex<double>, QuantumStateBuilder&) const -> void;
 
-    friend auto operator>>(std::istream&, Heisenberg&) -> std::istream&;
+    /// Returns the number of pairs with a non-zero coupling. H|σ〉 contains at
+    /// most `number_edges() + 1` distinct configurations.
+    auto number_edges() const noexcept -> std::size_t;
+
+    /// Binary format: the magic "LANCZOSJ", the number of spins n as a
+    /// uint64 and the n×n matrix as row-major doubles, all native-endian.
+    friend auto read_binary(std::istream&, CouplingMatrix&) -> std::istream&;
+    friend auto write_binary(std::ostream&, CouplingMatrix const&)
+        -> std::ostream&;
 };
 
+/// Returns whether `in` starts with a binary coupling matrix. The position
+/// of `in` is left unchanged.
+auto is_binary_couplings(std::istream& in) -> bool;
+
+/// Returns `number_edges()` of the Heisenberg or CouplingMatrix held by
+/// `hamiltonian`.
+auto number_edges(Hamiltonian const& hamiltonian) -> std::size_t;
+
@@ -0,0 +1,98 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/// \file
+/// \brief Hot loops compiled for several instruction sets.
+///
+/// Every kernel is a plain loop which the compiler vectorises. The same
+/// source is compiled once per instruction set and the best variant the CPU
+/// supports is selected at runtime, so a single binary runs everywhere and
+/// still uses AVX-512 where it is available.
+
+/// Instruction sets for which the kernels are compiled, in increasing order.
+enum class Isa { generic, sse4_2, avx2, avx512 };
+
+/// Number of configurations processed by `Kernels::antiparallel`.
+constexpr std::size_t kernel_lanes = 8;
+
+/// Table of kernel variants for one instruction set.
+struct Kernels {
+    /// Returns ∑ᵢ |xᵢ|².
+    auto (*squared_norm)(std::complex<double> const* x, std::size_t n)
+        -> double;
+    /// Stores |xᵢ|² in `out[i]`.
+    auto (*norms)(std::complex<double> const* x, std::size_t n, double* out)
+        -> void;
+    /// Multiplies all xᵢ by `c`.
+    auto (*scale)(std::complex<double>* x, std::size_t n,
+        std::complex<double> c) -> void;
+    /// Returns the number of xᵢ < `threshold`.
+    auto (*count_less)(double const* x, std::size_t n, double threshold)
+        -> std::size_t;
+    /// For each of the `kernel_lanes` configurations of `n ≤ 64` spins (in
+    /// the format of `SpinVector::bits`), sets bit e of `masks[lane]` if the
+    /// spins of `edges[e]` are antiparallel and stores the number of such
+    /// edges in `counts[lane]`. At most 64 edges are processed.
+    auto (*antiparallel)(std::uint64_t const* spins,
+        std::pair<int, int> const* edges, std::size_t number_edges, int n,
+        std::uint64_t* masks, int* counts) -> void;
+};
+
+auto to_string(Isa isa) -> char const*;
+
+/// Returns whether `isa` was compiled into the binary and is supported by
+/// the CPU.
+auto supported(Isa isa) noexcept -> bool;
+
+/// Returns the best instruction set which is `supported`.
+auto detected_isa() noexcept -> Isa;
+
+/// Returns the instruction set of the kernels returned by `kernels()`.
+auto current_isa() noexcept -> Isa;
+
+/// Makes `kernels()` return the variants for `isa`. Throws if `isa` is not
+/// `supported`. Should be called before any worker threads are started.
+auto select_isa(Isa isa) -> void;
+
+/// Returns the kernels compiled for `isa`, which must be `supported`.
+auto kernels(Isa isa) noexcept -> Kernels const&;
+
+/// Returns the kernels for `current_isa()`, which is `detected_isa()` unless
+/// changed by `select_isa`.
+auto kernels() noexcept -> Kernels const&;
@@ -0,0 +1,117 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+#include <optional>
+#include <vector>
+
+class QuantumState;
+class QuantumStateBuilder;
+
+/// \brief Measures wall-clock time between consecutive calls to `lap`.
+class Stopwatch {
+    using clock_type = std::chrono::steady_clock;
+
+    clock_type::time_point _start;
+
+  public:
+    Stopwatch() noexcept : _start{clock_type::now()} {}
+
+    /// Returns the time in seconds since construction or the previous call
+    /// to `lap`.
+    auto lap() noexcept -> double
+    {
+        auto const now = clock_type::now();
+        auto const dt  = std::chrono::duration<double>{now - _start}.count();
+        _start         = now;
+        return dt;
+    }
+};
+
+/// \brief State of one shard at the end of the accumulation phase.
+struct ShardMetrics {
+    std::size_t size;
+    std::size_t bucket_count;
+    double      load_factor;
+    std::size_t rehashes;
+    std::size_t stalls;
+    /// Configurations evicted (or turned away) to stay within the limit
+    std::size_t dropped;
+    double      idle; ///< Time between this and the last worker finishing
+};
+
+/// \brief Everything we know about one iteration of `diffusion_loop`.
+///
+/// Timings are in seconds. If the filter applies H several times per
+/// iteration, timings and counters are summed over all applications, while
+/// the shard statistics describe the last accumulated vector.
+struct IterationMetrics {
+    std::size_t iteration              = 0;
+    double      apply_time             = 0.0; ///< Producers applying H
+    double      drain_time             = 0.0; ///< Emptying queues, merging runs
+    double      normalize_time         = 0.0;
+    double      shrink_time            = 0.0; ///< Truncation and `freeze`
+    std::size_t generated              = 0; ///< Number of contributions to H|ψ〉
+    std::size_t unique                 = 0; ///< Size before truncation
+    std::size_t kept                   = 0; ///< Size after truncation
+    double      discarded_squared_norm = 0.0; ///< Σ|cᵢ|² removed by truncation
+    std::size_t spilled_bytes          = 0; ///< Written to disk (Backend::sort)
+    /// Configurations evicted from the tables to stay within the memory
+    /// limit (see `UpdaterStatistics::dropped`)
+    std::size_t dropped                = 0;
+    /// Largest number of bytes held by the states, tables, queues and
+    /// buffers at the end of an accumulation.
+    std::size_t memory_bytes           = 0;
+
+    /// Projected energy 〈φ|H|ψᵢ〉/〈φ|ψᵢ〉 after truncation, with the fixed
+    /// trial vector |φ〉 of `EnergyAverage` (only computed when averaging).
+    std::optional<double> energy;
+
+    std::vector<ShardMetrics> shards;
+
+    /// Accumulates counters of a builder which has just been stopped, and
+    /// records the shard statistics of the state it was filling.
+    auto record(QuantumStateBuilder const&, QuantumState const&) -> void;
+
+    /// Records that `bytes` are in use, keeping the maximum.
+    auto record_memory(std::size_t const bytes) noexcept -> void
+    {
+        memory_bytes = std::max(memory_bytes, bytes);
+    }
+};
+
+/// Writes the metrics as a single-line JSON object (without the newline).
+auto operator<<(std::ostream&, IterationMetrics const&) -> std::ostream&;
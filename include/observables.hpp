@@ -0,0 +1,78 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include "hamiltonian.hpp"
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+/// \file
+/// \brief Expectation values beyond the energy.
+///
+/// All observables are measured in a single parallel sweep over the shards
+/// of a state: every thread accumulates into its own `Observables`, which
+/// are summed at the end. Spins are spin-½ operators, S = σ/2.
+
+class QuantumState;
+
+/// \brief Expectation values in a state |ψ〉, normalised by 〈ψ|ψ〉.
+struct Observables {
+    int number_spins = 0;
+    /// 〈Sᶻᵢ Sᶻⱼ〉 as a row-major `number_spins × number_spins` matrix.
+    std::vector<double> szsz;
+    /// Pairs (i, j) for which 〈Sᵢ·Sⱼ〉 is measured.
+    std::vector<std::pair<int, int>> bonds;
+    /// 〈Sᵢ·Sⱼ〉 for every element of `bonds`.
+    std::vector<double> bond_values;
+    /// Probability of k spins up, i.e. of Sᶻ = k - number_spins / 2, for
+    /// k = 0, ..., number_spins.
+    std::vector<double> magnetisation;
+
+    /// Returns the static structure factor Sᶻᶻ(q) = 1/N ∑ᵢⱼ e^{iq(i - j)}
+    /// 〈Sᶻᵢ Sᶻⱼ〉 with the sites placed on a line in the order of their
+    /// indices. For other geometries, it can be formed from `szsz`.
+    auto structure_factor(double q) const -> double;
+};
+
+/// Returns the edges of the Heisenberg or CouplingMatrix held by
+/// `hamiltonian`, each pair only once and with i < j.
+auto bonds(Hamiltonian const& hamiltonian) -> std::vector<std::pair<int, int>>;
+
+/// Measures `Observables` of `psi`, whose configurations must all have the
+/// same length, for the given bonds.
+auto measure(QuantumState const& psi, std::vector<std::pair<int, int>> bonds)
+    -> Observables;
+
+/// Writes `x` as one JSON object, including Sᶻᶻ(q) for q = 2πk/N.
+auto operator<<(std::ostream& out, Observables const& x) -> std::ostream&;
@@ -0,0 +1,149 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// \brief Threads which are kept alive between tasks.
+///
+/// A task is handed to an idle thread, or to a new one if all threads are
+/// busy, so tasks never wait for each other. This matters because workers
+/// of a QuantumStateBuilder spin until the producers, which may be tasks
+/// themselves, are done. Threads are only joined when the pool is
+/// destroyed, so a long-running process creates them once rather than for
+/// every accumulation.
+class ThreadPool {
+    std::mutex                             _mutex;
+    std::condition_variable                _wake;
+    std::deque<std::packaged_task<void()>> _tasks;
+    std::vector<std::thread>               _threads;
+    std::size_t                            _idle;
+    bool                                   _stopping;
+
+    auto work() -> void
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        for (;;) {
+            ++_idle;
+            _wake.wait(
+                lock, [this]() { return _stopping || !_tasks.empty(); });
+            --_idle;
+            if (_tasks.empty()) { return; }
+            auto task = std::move(_tasks.front());
+            _tasks.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+  public:
+    ThreadPool()
+        : _mutex{}, _wake{}, _tasks{}, _threads{}, _idle{0}, _stopping{false}
+    {}
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for (auto& thread : _threads) {
+            thread.join();
+        }
+    }
+
+    /// Runs `fn()` on a thread of the pool. The future rethrows what `fn`
+    /// threw.
+    template <class Function> auto submit(Function&& fn) -> std::future<void>
+    {
+        std::packaged_task<void()> task{std::forward<Function>(fn)};
+        auto                       result = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _tasks.push_back(std::move(task));
+            if (_idle < _tasks.size()) {
+                _threads.emplace_back([this]() { work(); });
+            }
+        }
+        _wake.notify_one();
+        return result;
+    }
+
+    /// Number of threads created so far.
+    auto size() -> std::size_t
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _threads.size();
+    }
+};
+
+/// The pool shared by the whole process.
+inline auto thread_pool() -> ThreadPool&
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+/// Calls `fn(i)` for every `i` in `[0, n)`, each on its own thread of
+/// `thread_pool()`, and waits for all of them. If some calls throw, the
+/// first exception is rethrown after all calls have returned.
+template <class Function>
+auto parallel_for(std::size_t const n, Function&& fn) -> void
+{
+    if (n == 1) {
+        fn(std::size_t{0});
+        return;
+    }
+    std::vector<std::future<void>> calls;
+    calls.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        calls.push_back(thread_pool().submit([i, &fn]() { fn(i); }));
+    }
+    for (auto& call : calls) {
+        call.wait();
+    }
+    for (auto& call : calls) {
+        call.get();
+    }
+}
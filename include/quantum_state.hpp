@@ -31,20 +31,28 @@
 
 #pragma once
 
+#include "affinity.hpp"
+#include "dense.hpp"
+#include "parallel.hpp"
 #include "spin_chain.hpp"
+#include "spin_map.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <complex>
+#include <functional>
+#include <future>
 #include <iosfwd>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
 #include <thread>
 #include <vector>
 
 #include <boost/lockfree/spsc_queue.hpp>
-#include <flat_hash_map/bytell_hash_map.hpp>
-
-struct SpinHasher {
-    auto operator()(SpinVector x) const noexcept { return x.hash(); }
-};
 
 static constexpr auto spin_to_index(
     SpinVector spin, std::size_t number_workers) noexcept -> std::size_t
@@ -56,11 +64,74 @@ static constexpr auto spin_to_index(
     return std::to_integer<std::size_t>(*spin.data() >> (8 - used_bits));
 }
 
+/// How H|ψ〉 is accumulated.
+enum class Backend {
+    hash, ///< Contributions are merged into sharded hash tables as they come
+    sort, ///< Contributions are buffered, radix-sorted and merged
+    dense, ///< All amplitudes of a DenseBasis are stored (no truncation)
+};
+
+/// How `QuantumState::shrink` reduces the state to `soft_max` elements.
+enum class Truncation {
+    largest,    ///< Keep the largest elements (deterministic, but biased)
+    stochastic, ///< Round small elements stochastically (unbiased)
+};
+
+/// \brief What the worker of a shard reports once its queue has drained.
+struct ShardSummary {
+    double squared_norm = 0.0;
+    /// Squared magnitudes of the largest elements of the shard in decreasing
+    /// order, at most as many as were asked for (see
+    /// `QuantumStateBuilder::summarise`).
+    std::vector<double> largest;
+    /// Number and squared norm of the elements which the worker removed
+    /// because the truncation would remove them anyway. They are not part of
+    /// `squared_norm`.
+    std::size_t pruned      = 0;
+    double      pruned_norm = 0.0;
+};
+
+class Heisenberg;
+
+/// \brief Spare hash tables which states hand on to their successors.
+///
+/// Allocating a large table and touching its pages for the first time is a
+/// noticeable part of an accumulation, and a server runs many of them. A
+/// state which has a cache gives its tables to it when it is frozen, and
+/// `QuantumState::reserve` takes them back instead of allocating new ones.
+/// At most `capacity` bytes are kept, the rest is freed. May be used from
+/// several threads.
+class TableCache {
+  public:
+    using map_type = SpinMap<std::complex<double>>;
+
+  private:
+    std::mutex            _mutex;
+    std::vector<map_type> _tables;
+    std::size_t           _capacity;
+    std::size_t           _bytes;
+
+  public:
+    explicit TableCache(std::size_t const capacity)
+        : _mutex{}, _tables{}, _capacity{capacity}, _bytes{0}
+    {}
+
+    /// Clears `table` and keeps it if there is room.
+    auto put(map_type&& table) -> void;
+    /// Returns a spare table with room for `count` elements, but only one
+    /// which `map_type::reserve(count)` would have given the same number of
+    /// buckets, so that a recycled table never takes more memory than a new
+    /// one.
+    auto take(std::size_t count) -> std::optional<map_type>;
+
+    auto size() -> std::size_t;
+    auto bytes() -> std::size_t;
+};
+
 class QuantumState {
 
   public:
-    using map_type =
-        ska::bytell_hash_map<SpinVector, std::complex<double>, SpinHasher>;
+    using map_type   = SpinMap<std::complex<double>>;
     using value_type = map_type::value_type;
 
   private:
@@ -68,22 +139,104 @@ class QuantumState {
     std::vector<std::pair<SpinVector, double>> _entries;
     std::size_t                                _soft_max_size;
     std::size_t                                _hard_max_size;
+    /// Number of elements of H|ψ〉 per element of |ψ〉 in the last
+    /// accumulation (0 if unknown). `next_capacity` reserves for this ratio.
+    double _growth;
+    /// Upper bound on `_growth`, i.e. the number of edges + 1.
+    double _max_growth;
+    /// Where the workers filling the shards should run (optional).
+    std::shared_ptr<Placement const> _placement;
+    /// Per-shard capacity which will be reserved by the workers themselves,
+    /// so that the tables are first touched on the right NUMA node.
+    std::size_t _deferred_capacity;
+    /// Accumulation backend, inherited by `empty_successor`.
+    Backend _backend;
+    /// Sorted representation: `_keys` are strictly increasing and
+    /// `_amplitudes[i]` belongs to `_keys[i]`. Only used if `_sorted`, in
+    /// which case `_maps` are empty.
+    std::vector<SpinVector>           _keys;
+    std::vector<std::complex<double>> _amplitudes;
+    bool                              _sorted;
+    /// Memory budget in bytes for accumulation (0 means unlimited).
+    std::size_t _memory_limit;
+    /// Squared norm of elements which were dropped while the state was being
+    /// accumulated (see `merge_runs`), but which `normalize` and `shrink`
+    /// should still account for.
+    double _discarded;
+    /// Truncation strategy and the seed of its random numbers, inherited by
+    /// `empty_successor`.
+    Truncation    _truncation;
+    std::uint64_t _seed;
+    /// Number of `empty_successor` calls which led to this state. Mixed into
+    /// the seed so that every iteration draws different random numbers.
+    std::uint64_t _generation;
+    /// Magnitude of the largest element removed by the last truncation,
+    /// relative to the norm of the state at that time (0 if none). `shrink`
+    /// assumes that the state is normalised.
+    double _cutoff;
+    /// |H|ψ〉| / |ψ〉| observed during the last accumulation (0 if unknown).
+    /// Only measured if `_screening` is positive.
+    double _norm_growth;
+    /// Screening factor, see `screening_threshold`.
+    double _screening;
+    /// Dense representation: `_amplitudes[i]` belongs to `_basis->spin(i)`.
+    /// Only used with Backend::dense, in which case `_maps` and `_keys` are
+    /// empty.
+    std::shared_ptr<DenseBasis const> _basis;
+    /// One summary per shard, or empty. See `summaries`.
+    std::vector<ShardSummary> _summaries;
+    /// Where tables are recycled (optional), inherited by `empty_successor`.
+    std::shared_ptr<TableCache> _table_cache;
+    /// 〈σ|H|σ〉 for every configuration of a frozen state, aligned with
+    /// `_keys`, and the H it belongs to. Empty unless `cache_diagonal` has
+    /// been called since the configurations last changed.
+    std::vector<std::complex<double>> _diagonal;
+    std::shared_ptr<Heisenberg const> _diagonal_of;
+
+    /// Extra room reserved on top of the predicted size, so that small
+    /// fluctuations between iterations and shards do not trigger a rehash.
+    static constexpr double growth_slack = 1.1;
+    /// Range of screening factors used by `tighten_screening`. Larger factors
+    /// make the state size oscillate.
+    static constexpr double min_screening = 0.01;
+    static constexpr double max_screening = 0.1;
 
   public:
     static constexpr auto round_down_to_power_of_two(std::size_t) noexcept
         -> std::size_t;
 
+    /// \param hard_max Total capacity of the tables (summed over all shards).
+    ///                 0 means that the capacity is chosen automatically (see
+    ///                 `next_capacity`).
     QuantumState(
         std::size_t soft_max, std::size_t hard_max, std::size_t number_workers)
-        : _maps{}
+        : _maps(number_workers)
         , _entries{}
         , _soft_max_size{soft_max}
         , _hard_max_size{hard_max}
+        , _growth{0.0}
+        , _max_growth{std::numeric_limits<double>::infinity()}
+        , _placement{}
+        , _deferred_capacity{0}
+        , _backend{Backend::hash}
+        , _keys{}
+        , _amplitudes{}
+        , _sorted{false}
+        , _memory_limit{0}
+        , _discarded{0.0}
+        , _truncation{Truncation::largest}
+        , _seed{0}
+        , _generation{0}
+        , _cutoff{0.0}
+        , _norm_growth{0.0}
+        , _screening{0.0}
+        , _basis{}
+        , _summaries{}
+        , _table_cache{}
+        , _diagonal{}
+        , _diagonal_of{}
     {
-        _maps.reserve(number_workers);
-        for (std::size_t i = 0; i < number_workers; ++i) {
-            _maps.emplace_back(hard_max);
-        }
+        reserve(hard_max);
     }
 
     QuantumState(QuantumState const&) = delete;
@@ -92,38 +245,312 @@ class QuantumState {
     QuantumState& operator=(QuantumState&&) = default;
 
     auto clear() -> void;
-    auto insert(value_type &&) -> std::pair<map_type::iterator, bool>;
 
-    auto find(SpinVector const& spin) -> std::optional<map_type::iterator>
+    /// Makes room for `count` elements in total. Capacity is split evenly
+    /// between the shards. If the state has a placement, allocation is
+    /// deferred until the workers of a QuantumStateBuilder start.
+    auto reserve(std::size_t count) -> void;
+    /// Inserts `x` unless its spin is already present. A frozen state is
+    /// thawed first.
+    auto insert(value_type&& x) -> std::pair<map_type::iterator, bool>;
+    auto erase(SpinVector const& spin) -> std::size_t;
+
+    /// Returns a pointer to the amplitude of `spin` or `nullptr` if `spin` is
+    /// not part of the state.
+    auto find(SpinVector const& spin) const -> std::complex<double> const*;
+
+    /// Replaces the contents by `keys` and `amplitudes`. `keys` must be
+    /// strictly increasing.
+    auto assign_sorted(std::vector<SpinVector>   keys,
+        std::vector<std::complex<double>> amplitudes) -> void;
+    /// Returns whether the state is stored as sorted arrays rather than as
+    /// hash tables.
+    auto sorted() const noexcept { return _sorted; }
+
+    /// Moves the contents of the hash tables into sorted arrays (one array of
+    /// spins, one of amplitudes). Meant for read-only phases: iteration
+    /// becomes a linear scan, `find` a search in a sorted array, and memory
+    /// usage drops to 32 bytes per element. Shards are sorted in parallel.
+    auto freeze() -> void;
+    /// Moves the sorted arrays back into the hash tables. Only needed to
+    /// modify the state in place, since H|ψ〉 is always accumulated into a new
+    /// state.
+    auto thaw() -> void;
+
+    /// Freezes the state and stores 〈σ|H|σ〉 next to the amplitude of every
+    /// configuration σ. `apply` then lets the workers add the diagonal part
+    /// of (αH + β)|ψ〉 to their own shards (see
+    /// `QuantumStateBuilder::diagonal_from`), so that it never goes through
+    /// the queues, and `energy` reads it instead of recomputing it. Costs 16
+    /// bytes per element. Dropped whenever the configurations change.
+    auto cache_diagonal(std::shared_ptr<Heisenberg const> hamiltonian)
+        -> void;
+    /// Returns whether the diagonal of `hamiltonian` is cached.
+    auto has_diagonal(Heisenberg const& hamiltonian) const noexcept -> bool;
+
+    /// Use `make_dense` to switch to Backend::dense.
+    auto backend(Backend const value) noexcept -> void
+    {
+        TCM_ASSERT(value != Backend::dense && _basis == nullptr);
+        _backend = value;
+    }
+    auto backend() const noexcept { return _backend; }
+
+    /// Moves the contents into an array of amplitudes over `basis` and
+    /// switches to Backend::dense. Throws if some configuration is not part
+    /// of `basis`. A dense state is never truncated, and `insert` and `erase`
+    /// are not supported.
+    auto make_dense(std::shared_ptr<DenseBasis const> basis) -> void;
+    auto basis() const noexcept -> DenseBasis const* { return _basis.get(); }
+
+    /// Amplitudes of a state with Backend::dense, indexed by rank in
+    /// `basis()`. The const overload may also be used on a frozen state, in
+    /// which case `amplitudes()[i]` belongs to `keys()[i]`.
+    auto amplitudes() noexcept -> std::vector<std::complex<double>>&
+    {
+        TCM_ASSERT(_basis != nullptr);
+        return _amplitudes;
+    }
+    auto amplitudes() const noexcept -> std::vector<std::complex<double>> const&
+    {
+        TCM_ASSERT(_basis != nullptr || _sorted);
+        return _amplitudes;
+    }
+
+    /// Configurations of a frozen state in increasing order.
+    auto keys() const noexcept -> std::vector<SpinVector> const&
+    {
+        TCM_ASSERT(_sorted);
+        return _keys;
+    }
+
+    /// Limits the memory used while H|ψ〉 is accumulated from this state,
+    /// including the state itself. With Backend::hash, the tables of
+    /// `empty_successor` are sized to fit, and once they are full, their
+    /// smallest elements are evicted (see `table_budget`). With Backend::sort,
+    /// contributions which do not fit are spilled to disk. Inherited by
+    /// `empty_successor`.
+    auto memory_limit(std::size_t const bytes) noexcept -> void
+    {
+        _memory_limit = bytes;
+    }
+    auto memory_limit() const noexcept { return _memory_limit; }
+
+    /// Returns the number of bytes allocated by the state: its tables, its
+    /// sorted or dense arrays and the scratch space of `shrink`.
+    auto memory_usage() const noexcept -> std::size_t;
+
+    /// Returns how many bytes each table of `empty_successor(held)` may
+    /// occupy such that this state, `held` bytes of other states, the
+    /// successor and the queues of a QuantumStateBuilder stay within
+    /// `memory_limit()`, or 0 if there is no limit. The budget suffices for
+    /// `soft_max()` elements in any case.
+    auto table_budget(std::size_t held = 0) const -> std::size_t;
+
+    /// Returns the largest `soft_max` for which accumulating H|ψ〉 with
+    /// `number_workers` shards is expected to fit into `bytes`, where
+    /// |H|ψ〉| ≤ `growth`·|ψ〉| and `vectors` states of that size are alive at
+    /// the same time (besides ψ).
+    static auto soft_max_within(std::size_t bytes, double growth,
+        std::size_t vectors, std::size_t number_workers, Backend backend)
+        -> std::size_t;
+
+    /// Records that elements with total squared norm `norm` have been
+    /// dropped from the state before it was stored.
+    auto add_discarded(double const norm) noexcept -> void
+    {
+        _discarded += norm;
+    }
+    auto discarded() const noexcept { return _discarded; }
+
+    auto truncation(
+        Truncation const kind, std::uint64_t const seed = 0) noexcept -> void
     {
-        auto& table = _maps.at(spin_to_index(spin, _maps.size()));
-        auto  where = table.find(spin);
-        if (where != table.end()) { return {where}; }
-        return std::nullopt;
+        _truncation = kind;
+        _seed       = seed;
     }
+    auto truncation() const noexcept { return _truncation; }
+    auto seed() const noexcept { return _seed; }
+    auto generation() const noexcept { return _generation; }
 
-    auto shrink() -> void;
+    auto cutoff(double const value) noexcept -> void { _cutoff = value; }
+    auto cutoff() const noexcept { return _cutoff; }
+
+    /// Enables screening of the contributions to H|ψ〉 (0 disables it).
+    /// Inherited by `empty_successor`.
+    auto screening(double const factor) noexcept -> void
+    {
+        _screening = factor;
+    }
+    auto screening() const noexcept { return _screening; }
+
+    /// Doubles the screening factor (or enables screening), up to
+    /// `max_screening`. Used when an accumulation ran out of memory.
+    auto tighten_screening() noexcept -> void
+    {
+        _screening = std::max(_screening,
+            std::clamp(2.0 * _screening, min_screening, max_screening));
+    }
+
+    /// Returns the magnitude below which contributions to H|ψ〉 are unlikely
+    /// to survive the truncation which follows the accumulation:
+    /// factor · cutoff · |H|ψ〉|, where the last two are estimated from the
+    /// previous iteration. Returns 0 if screening is disabled or nothing is
+    /// known yet.
+    auto screening_threshold() const -> double;
+
+    /// Reduces the state to (about) `soft_max()` elements using the
+    /// truncation strategy of the state. Returns the squared norm of the
+    /// difference between the old and the new state, including
+    /// `discarded()`.
+    ///
+    /// Truncation::largest removes the smallest elements until at most
+    /// `soft_max()` remain. Truncation::stochastic keeps elements with
+    /// |ψᵢ| ≥ τ as they are and replaces every other element by τ·ψᵢ/|ψᵢ|
+    /// with probability |ψᵢ|/τ and by 0 otherwise. τ is chosen such that
+    /// `soft_max()` elements remain on average. The result equals |ψ〉in
+    /// expectation. The state is frozen as a side effect.
+    ///
+    /// If nothing has been removed, `cutoff()` is reset to 0. Dense states
+    /// are kept as they are.
+    auto shrink() -> double;
+    /// Normalises the state as if the discarded elements were still part of
+    /// it.
     auto normalize() -> QuantumState&;
+    /// Returns 〈ψ|ψ〉.
+    auto squared_norm() const -> double;
+    /// Performs |ψ〉*= scale.
+    auto scale(std::complex<double> scale) -> void;
+
+    /// Attaches the summaries which the workers computed while the state was
+    /// accumulated. `squared_norm` then sums the partial norms and `shrink`
+    /// (Truncation::largest) picks the threshold from the candidates instead
+    /// of sorting the whole state. Elements the workers pruned count as
+    /// discarded. `scale` keeps the summaries up to date, any other
+    /// modification drops them.
+    auto summaries(std::vector<ShardSummary> value) -> void;
+    auto summaries() const noexcept -> std::vector<ShardSummary> const&
+    {
+        return _summaries;
+    }
 
     constexpr auto soft_max() const noexcept { return _soft_max_size; }
     constexpr auto hard_max() const noexcept { return _hard_max_size; }
     auto number_workers() const noexcept { return _maps.size(); }
+    /// Returns the number of elements. For a dense state these are the
+    /// non-zero amplitudes, which takes a pass over the array.
+    auto size() const noexcept -> std::size_t;
+
+    /// Sets the upper bound on |H|σ〉| (including |σ〉 itself) used before any
+    /// growth has been observed.
+    auto max_growth(double const value) noexcept -> void
+    {
+        _max_growth = value;
+    }
+
+    /// Returns the capacity which a state holding H|ψ〉 should have. If
+    /// `hard_max` was given explicitly, it is used as is. Otherwise the size
+    /// is extrapolated from the growth observed in the previous accumulation,
+    /// capped by `max_growth`.
+    auto next_capacity() const noexcept -> std::size_t;
+
+    /// Pins the worker of shard `i` to `placement->cpu(i)`. The placement is
+    /// inherited by `empty_successor`.
+    auto placement(std::shared_ptr<Placement const> placement) -> void;
+    auto placement() const noexcept -> Placement const*
+    {
+        return _placement.get();
+    }
+    auto deferred_capacity() const noexcept { return _deferred_capacity; }
+
+    /// Recycles tables through `cache`: `freeze` gives the tables to it and
+    /// `reserve` takes them back. States with a placement allocate their
+    /// tables from the pinned workers, so that memory is local to their
+    /// node, and only give tables away. Inherited by `empty_successor`.
+    auto table_cache(std::shared_ptr<TableCache> cache) noexcept -> void
+    {
+        _table_cache = std::move(cache);
+    }
+
+    /// Returns an empty state with the same parameters whose tables are sized
+    /// to hold H|ψ〉, but no more than `table_budget(held)`.
+    auto empty_successor(std::size_t held = 0) const -> QuantumState;
+
+    /// Records the growth after this state has been accumulated from
+    /// `source`.
+    auto observe_growth(QuantumState const& source) noexcept -> void;
 
-    constexpr auto& tables() & noexcept { return _maps; }
+    /// Mutable access drops the summaries.
+    auto tables() & noexcept -> std::vector<map_type>&
+    {
+        _summaries.clear();
+        return _maps;
+    }
+    constexpr auto const& tables() const& noexcept { return _maps; }
+
+    /// Calls `fn` for every element. Elements of different shards are
+    /// interleaved. Zero amplitudes of a dense state are skipped.
+    template <class Function>
+    auto for_each(Function&& fn) const -> void;
+
+    /// Calls `fn` for every element of shard `i`, i.e. every element whose
+    /// `spin_to_index` is `i`. Different shards may be traversed concurrently.
+    template <class Function>
+    auto for_each_in_shard(std::size_t i, Function&& fn) const -> void;
 
+    /// Same as `for_each_in_shard`, but calls `fn(element, diagonal)` with
+    /// the cached 〈σ|H|σ〉 of the element.
+    /// \precondition `has_diagonal` for some H.
     template <class Function>
-    auto for_each(Function&&) const -> void;
+    auto for_each_diagonal_in_shard(std::size_t i, Function&& fn) const
+        -> void;
 
     friend auto operator>>(std::istream&, QuantumState&) -> std::istream&;
     friend auto operator<<(std::ostream&, QuantumState const&) -> std::ostream&;
 
+    /// Binary counterparts of `operator>>` and `operator<<`. The format is
+    /// native-endian and is meant for checkpoints rather than for exchange.
+    friend auto read_binary(std::istream&, QuantumState&) -> std::istream&;
+    friend auto write_binary(std::ostream&, QuantumState const&)
+        -> std::ostream&;
+
   private:
-    auto remove_least(std::size_t count) -> void;
+    auto drop_diagonal() noexcept -> void
+    {
+        _diagonal    = {};
+        _diagonal_of = nullptr;
+    }
+    auto remove_least(std::size_t count) -> double;
+    /// Same as `remove_least`, but the threshold is chosen from the
+    /// candidates of the workers and shards are pruned in parallel.
+    auto remove_least_summarised(
+        std::vector<ShardSummary> const& summaries, std::size_t count)
+        -> double;
+    auto remove_least_sorted(std::size_t count) -> double;
+    auto round_stochastically() -> double;
+    /// Returns the range of `_keys` (or of `_amplitudes` of a dense state)
+    /// which belongs to shard `i`.
+    auto shard_range(std::size_t i) const noexcept
+        -> std::pair<std::size_t, std::size_t>;
 };
 
 template <class Function>
 auto QuantumState::for_each(Function&& fn) const -> void
 {
+    if (_sorted) {
+        for (std::size_t i = 0; i < _keys.size(); ++i) {
+            fn(value_type{_keys[i], _amplitudes[i]});
+        }
+        return;
+    }
+    if (_basis != nullptr) {
+        for (std::size_t i = 0; i < _amplitudes.size(); ++i) {
+            if (_amplitudes[i] != 0.0) {
+                fn(value_type{_basis->spin(i), _amplitudes[i]});
+            }
+        }
+        return;
+    }
     std::vector<std::pair<map_type::const_iterator, map_type::const_iterator>>
         xs;
     xs.reserve(number_workers());
@@ -143,86 +570,426 @@ auto QuantumState::for_each(Function&& fn) const -> void
     }
 }
 
+template <class Function>
+auto QuantumState::for_each_in_shard(std::size_t const i, Function&& fn) const
+    -> void
+{
+    TCM_ASSERT(i < number_workers());
+    if (_sorted) {
+        auto const [first, last] = shard_range(i);
+        for (auto j = first; j < last; ++j) {
+            fn(value_type{_keys[j], _amplitudes[j]});
+        }
+        return;
+    }
+    if (_basis != nullptr) {
+        auto const [first, last] = shard_range(i);
+        for (auto j = first; j < last; ++j) {
+            if (_amplitudes[j] != 0.0) {
+                fn(value_type{_basis->spin(j), _amplitudes[j]});
+            }
+        }
+        return;
+    }
+    for (auto const& x : _maps[i]) {
+        fn(x);
+    }
+}
+
+template <class Function>
+auto QuantumState::for_each_diagonal_in_shard(
+    std::size_t const i, Function&& fn) const -> void
+{
+    TCM_ASSERT(_sorted && _diagonal.size() == _keys.size());
+    auto const [first, last] = shard_range(i);
+    for (auto j = first; j < last; ++j) {
+        fn(value_type{_keys[j], _amplitudes[j]}, _diagonal[j]);
+    }
+}
+
+/// \brief Counters collected by an Updater while the builder is running.
+struct UpdaterStatistics {
+    std::size_t generated = 0; ///< Number of elements pushed into the queue
+    std::size_t stalls    = 0; ///< Number of pushes which found the queue full
+    std::size_t rehashes  = 0; ///< Number of times the table has grown
+    /// Number of configurations which were evicted to keep the table within
+    /// its limit, and their squared norm
+    std::size_t dropped      = 0;
+    double      dropped_norm = 0.0;
+    /// When the worker had emptied its queue and summarised the shard
+    std::chrono::steady_clock::time_point finished;
+};
+
 class Updater {
     using value_type = QuantumState::value_type;
+
+  public:
+    static constexpr std::size_t queue_capacity = 1024;
+    /// Memory held by the queue of an updater.
+    static constexpr std::size_t queue_bytes =
+        queue_capacity * sizeof(value_type);
+
+  private:
     using queue_type = boost::lockfree::spsc_queue<value_type,
-        boost::lockfree::capacity<1024>>;
+        boost::lockfree::capacity<queue_capacity>>;
     using map_type   = QuantumState::map_type;
 
   public:
-    Updater(map_type& table)
-        : _table{std::addressof(table)}, _queue{}, _done{true}, _worker{}
+    /// \param cpu      Core to pin the worker to, or -1.
+    /// \param node     NUMA node of `cpu`.
+    /// \param capacity Number of elements to reserve from within the worker.
+    Updater(map_type& table, int const cpu = -1, int const node = 0,
+        std::size_t const capacity = 0)
+        : _table{std::addressof(table)}
+        , _queue{}
+        , _done{true}
+        , _worker{}
+        , _statistics{}
+        , _bucket_count{0}
+        , _cpu{cpu}
+        , _node{node}
+        , _capacity{capacity}
+        , _summarise{false}
+        , _keep{0}
+        , _prune{false}
+        , _limit{0}
+        , _summary{}
+        , _source{nullptr}
+        , _shard{0}
+        , _alpha{0.0}
+        , _beta{0.0}
     {
     }
 
   private:
+    /// Returns whether one more element keeps the table within `_limit`,
+    /// counting both bucket arrays while it is rehashed.
+    auto fits() const noexcept -> bool
+    {
+        using mapped_type  = map_type::mapped_type;
+        auto const size    = _table->size() + 1;
+        auto const buckets = _table->bucket_count();
+        if (static_cast<double>(size)
+            <= _table->max_load_factor() * static_cast<double>(buckets)) {
+            return spin_map_bytes<mapped_type>(buckets, size) <= _limit;
+        }
+        return spin_map_bytes<mapped_type>(buckets, size - 1)
+                   + spin_map_bytes<mapped_type>(
+                       2 * std::max<std::size_t>(buckets, 1), size)
+               <= _limit;
+    }
+
+    /// Makes room in a full table by evicting the elements below the median
+    /// magnitude of a sample. The sample consists of every k-th element in
+    /// the order of the table, so that it spans all buckets rather than
+    /// the configurations whose hashes happen to come first.
+    auto evict() -> void
+    {
+        TCM_TRACE_SCOPE("evict");
+        std::array<double, 256> sample;
+        std::size_t             count  = 0;
+        auto const              stride =
+            std::max<std::size_t>(_table->size() / sample.size(), 1);
+        std::size_t position = 0;
+        for (auto const& [_, coeff] : *_table) {
+            if (count == sample.size()) { break; }
+            if (position++ % stride == 0) {
+                sample[count++] = std::norm(coeff);
+            }
+        }
+        if (count == 0) { return; }
+        auto const median = std::begin(sample) + count / 2;
+        std::nth_element(
+            std::begin(sample), median, std::begin(sample) + count);
+        for (auto i = _table->begin(); i != _table->end();) {
+            auto const norm = std::norm(i->second);
+            if (norm < *median) {
+                ++_statistics.dropped;
+                _statistics.dropped_norm += norm;
+                i = _table->erase(i);
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+
     auto unsafe_process(value_type value)
     {
         auto where = _table->find(value.first);
-        if (where == _table->end()) { _table->insert(value); }
+        if (where == _table->end()) {
+            if (_limit != 0 && !fits()) {
+                evict();
+                // Only if all elements are equally large.
+                if (!fits()) {
+                    ++_statistics.dropped;
+                    _statistics.dropped_norm += std::norm(value.second);
+                    return;
+                }
+            }
+            _table->insert(value);
+            if (_table->bucket_count() != _bucket_count) {
+                ++_statistics.rehashes;
+                _bucket_count = _table->bucket_count();
+            }
+        }
         else {
             where->second += value.second;
         }
     }
 
+    /// Runs on the worker right after the queue has drained, so a shard is
+    /// summarised, and pruned if asked to, while the other workers are still
+    /// busy.
+    auto summarise() -> void
+    {
+        TCM_TRACE_SCOPE("summarise");
+        _summary.squared_norm = 0.0;
+        _summary.largest.clear();
+        _summary.pruned      = 0;
+        _summary.pruned_norm = 0.0;
+        auto& largest        = _summary.largest;
+        if (_keep != 0) {
+            largest.reserve(_table->size());
+            for (auto const& [_, coeff] : *_table) {
+                largest.push_back(std::norm(coeff));
+            }
+            if (largest.size() > _keep) {
+                std::nth_element(std::begin(largest),
+                    std::begin(largest)
+                        + static_cast<std::ptrdiff_t>(_keep - 1),
+                    std::end(largest), std::greater<>{});
+                largest.resize(_keep);
+            }
+            std::sort(
+                std::begin(largest), std::end(largest), std::greater<>{});
+        }
+        // No element of the shard below its `_keep`-th largest can survive
+        // the truncation to `_keep` elements.
+        auto const threshold =
+            _prune && !largest.empty() && _table->size() > _keep
+                ? largest.back()
+                : 0.0;
+        for (auto i = _table->begin(); i != _table->end();) {
+            auto const norm = std::norm(i->second);
+            if (norm < threshold) {
+                ++_summary.pruned;
+                _summary.pruned_norm += norm;
+                i = _table->erase(i);
+            }
+            else {
+                _summary.squared_norm += norm;
+                ++i;
+            }
+        }
+    }
+
   public:
     auto start()
     {
         TCM_ASSERT(_done);
         TCM_ASSERT(_queue.empty());
-        TCM_ASSERT(!_worker.joinable());
+        TCM_ASSERT(!_worker.valid());
         _done   = false;
-        _worker = std::thread{[this]() {
-            value_type x;
-            while (!_done) {
+        _worker = thread_pool().submit([this]() {
+            if (_cpu >= 0) { pin_current_thread(_cpu, _node); }
+            if (_capacity > 0) {
+                TCM_TRACE_SCOPE("reserve");
+                _table->reserve(_capacity);
+                _capacity = 0;
+            }
+            _bucket_count = _table->bucket_count();
+            if (_limit != 0) {
+                // A table may always fill the buckets it has been given.
+                auto const room = static_cast<std::size_t>(
+                    _table->max_load_factor()
+                    * static_cast<float>(_bucket_count));
+                _limit = std::max(_limit,
+                    spin_map_bytes<map_type::mapped_type>(_bucket_count, room));
+            }
+            if (_source != nullptr) {
+                TCM_TRACE_SCOPE("diagonal");
+                _source->for_each_diagonal_in_shard(
+                    _shard, [this](auto const& x, auto const diagonal) {
+                        unsafe_process(
+                            {x.first, (_beta + _alpha * diagonal) * x.second});
+                    });
+                _source = nullptr;
+            }
+            {
+                TCM_TRACE_SCOPE("drain");
+                value_type x;
+                while (!_done) {
+                    while (_queue.pop(x))
+                        unsafe_process(x);
+                }
                 while (_queue.pop(x))
                     unsafe_process(x);
             }
-            while (_queue.pop(x))
-                unsafe_process(x);
-        }};
+            if (_summarise) { summarise(); }
+            _statistics.finished = std::chrono::steady_clock::now();
+            // The thread goes back to the pool and may run anything next.
+            if (_cpu >= 0) { unpin_current_thread(); }
+        });
     }
 
     auto stop()
     {
         TCM_ASSERT(!_done);
-        TCM_ASSERT(_worker.joinable());
+        TCM_ASSERT(_worker.valid());
         _done = true;
-        _worker.join();
+        _worker.get();
         TCM_ASSERT(_queue.empty());
     }
 
     auto operator()(std::pair<SpinVector, std::complex<double>> value) -> void
     {
         if (_done) { start(); }
-        while (!_queue.push(value))
-            ;
+        ++_statistics.generated;
+        if (!_queue.push(value)) {
+            TCM_TRACE_SCOPE("queue full");
+            ++_statistics.stalls;
+            while (!_queue.push(value))
+                ;
+        }
+    }
+
+    /// \precondition The updater must be stopped.
+    auto statistics() const noexcept -> UpdaterStatistics const&
+    {
+        return _statistics;
+    }
+
+    /// Asks the worker to summarise its shard once the queue has drained,
+    /// including the `count` largest elements. If `prune`, the smaller ones
+    /// are removed right away.
+    auto keep(std::size_t const count, bool const prune = false) noexcept
+        -> void
+    {
+        _summarise = true;
+        _keep      = count;
+        _prune     = prune && count != 0;
+    }
+    auto summarised() const noexcept { return _summarise; }
+
+    /// Bytes the table may occupy (0 means unlimited). Once the table is
+    /// full, its smaller half is evicted, so that the largest amplitudes are
+    /// kept whatever the order of the contributions. A configuration which is
+    /// contributed to after its eviction starts over.
+    auto limit(std::size_t const bytes) noexcept -> void { _limit = bytes; }
+
+    /// \precondition The updater must be stopped.
+    auto summary() noexcept -> ShardSummary& { return _summary; }
+
+    /// Makes the worker add (β + α·〈σ|H|σ〉)·c for every element (σ, c) of
+    /// shard `shard` of `source` before it drains the queue, using the
+    /// diagonal cached in `source`. `source` must stay alive until the worker
+    /// has started.
+    auto diagonal_from(QuantumState const& source, std::size_t const shard,
+        std::complex<double> const alpha,
+        std::complex<double> const beta) noexcept -> void
+    {
+        _source = std::addressof(source);
+        _shard  = shard;
+        _alpha  = alpha;
+        _beta   = beta;
     }
 
   private:
-    map_type*        _table;
-    queue_type       _queue;
-    std::atomic_bool _done;
-    std::thread      _worker;
+    map_type*            _table;
+    queue_type           _queue;
+    std::atomic_bool     _done;
+    std::future<void>    _worker;
+    UpdaterStatistics    _statistics;
+    std::size_t          _bucket_count;
+    int                  _cpu;
+    int                  _node;
+    std::size_t          _capacity;
+    bool                 _summarise;
+    std::size_t          _keep;
+    bool                 _prune;
+    std::size_t          _limit;
+    ShardSummary         _summary;
+    /// See `diagonal_from`.
+    QuantumState const*  _source;
+    std::size_t          _shard;
+    std::complex<double> _alpha;
+    std::complex<double> _beta;
+};
+
+/// \brief Decides which contributions to H|ψ〉 are worth generating.
+///
+/// Contributions with magnitude at least `threshold` pass unchanged. Smaller
+/// ones are dropped or, if `stochastic`, replaced by threshold·c/|c| with
+/// probability |c|/threshold (which is unbiased). A threshold of 0 lets
+/// everything through.
+class Screening {
+    double                                 _threshold;
+    bool                                   _stochastic;
+    std::mt19937_64                        _generator;
+    std::uniform_real_distribution<double> _uniform;
+
+  public:
+    Screening() noexcept : Screening{0.0, false, 0} {}
+
+    Screening(double const threshold, bool const stochastic,
+        std::uint64_t const seed) noexcept
+        : _threshold{threshold}
+        , _stochastic{stochastic}
+        , _generator{seed}
+        , _uniform{0.0, threshold}
+    {
+    }
+
+    auto threshold() const noexcept { return _threshold; }
+    auto stochastic() const noexcept { return _stochastic; }
+
+    /// Returns the amplitude to generate instead of `coeff`, 0 meaning that
+    /// nothing should be generated.
+    auto operator()(std::complex<double> const coeff) -> std::complex<double>
+    {
+        auto const magnitude = std::abs(coeff);
+        if (magnitude >= _threshold) { return coeff; }
+        if (!_stochastic || !(_uniform(_generator) < magnitude)) {
+            return 0.0;
+        }
+        return coeff * (_threshold / magnitude);
+    }
 };
 
 class QuantumStateBuilder {
     std::vector<std::unique_ptr<Updater>> _updaters;
+    /// If not `nullptr`, contributions are appended here instead of being sent
+    /// to the updaters.
+    std::vector<QuantumState::value_type>* _buffer;
+    Screening                              _screening;
 
   public:
     using value_type = QuantumState::value_type;
 
-    QuantumStateBuilder(QuantumState& psi) : _updaters{}
+    QuantumStateBuilder(QuantumState& psi)
+        : _updaters{}, _buffer{nullptr}, _screening{}
     {
         TCM_ASSERT(
             psi.number_workers() > 0
             && ((psi.number_workers() & (psi.number_workers() - 1)) == 0));
         _updaters.reserve(psi.number_workers());
-        for (auto& table : psi.tables()) {
-            _updaters.emplace_back(std::make_unique<Updater>(table));
+        auto const* placement = psi.placement();
+        for (std::size_t i = 0; i < psi.number_workers(); ++i) {
+            _updaters.emplace_back(std::make_unique<Updater>(psi.tables()[i],
+                placement != nullptr ? placement->cpu(i) : -1,
+                placement != nullptr ? placement->node(i) : 0,
+                psi.deferred_capacity()));
         }
     }
 
+    /// Constructs a builder which only collects contributions in `buffer`.
+    /// Duplicates are not merged. No threads are involved.
+    explicit QuantumStateBuilder(std::vector<value_type>& buffer)
+        : _updaters{}, _buffer{std::addressof(buffer)}, _screening{}
+    {
+    }
+
     QuantumStateBuilder(QuantumStateBuilder const&) = delete;
     QuantumStateBuilder(QuantumStateBuilder&&)      = delete;
     QuantumStateBuilder& operator=(QuantumStateBuilder const&) = delete;
@@ -230,19 +997,103 @@ class QuantumStateBuilder {
 
     auto start() -> void
     {
+        TCM_TRACE_SCOPE("start workers");
         std::for_each(
             begin(_updaters), end(_updaters), [](auto& x) { x->start(); });
     }
 
     auto stop() -> void
     {
+        TCM_TRACE_SCOPE("stop workers");
         std::for_each(
             begin(_updaters), end(_updaters), [](auto& x) { x->stop(); });
     }
 
+    /// Screening applied by Hamiltonians before they generate off-diagonal
+    /// contributions.
+    auto screening() noexcept -> Screening& { return _screening; }
+    auto screening(Screening screening) noexcept -> void
+    {
+        _screening = std::move(screening);
+    }
+
+    auto updaters() const noexcept
+        -> std::vector<std::unique_ptr<Updater>> const&
+    {
+        return _updaters;
+    }
+
+    /// Asks every worker to summarise its shard, reporting the squared norm
+    /// and its `keep` largest elements (see `ShardSummary`). Without it the
+    /// workers skip the pass over their shards. If `prune`, every worker also
+    /// removes the elements of its shard below its `keep`-th largest, which a
+    /// truncation to `keep` elements would remove anyway. A shard is then
+    /// mostly truncated while the others are still being accumulated. Must
+    /// be called before `start`.
+    auto summarise(std::size_t const keep, bool const prune = false) noexcept
+        -> void
+    {
+        for (auto& updater : _updaters) {
+            updater->keep(keep, prune);
+        }
+    }
+
+    /// Makes the workers add the diagonal part of (αH + β)|x〉 to their own
+    /// shards from the diagonal cached in `x` (see
+    /// `QuantumState::cache_diagonal`), so that only the off-diagonal terms
+    /// are pushed into the queues. Must be called before `start`.
+    auto diagonal_from(QuantumState const& x, std::complex<double> const alpha,
+        std::complex<double> const beta) noexcept -> void
+    {
+        TCM_ASSERT(x.number_workers() == _updaters.size());
+        for (std::size_t i = 0; i < _updaters.size(); ++i) {
+            _updaters[i]->diagonal_from(x, i, alpha, beta);
+        }
+    }
+
+    /// Limits the memory of every table to `bytes`, see `Updater::limit`.
+    /// Must be called before `start`.
+    auto limit(std::size_t const bytes) noexcept -> void
+    {
+        for (auto& updater : _updaters) {
+            updater->limit(bytes);
+        }
+    }
+
+    /// Returns the number of configurations which were evicted because they
+    /// did not fit into the limit, and their squared norm.
+    /// \precondition The builder must be stopped.
+    auto dropped() const noexcept -> std::pair<std::size_t, double>
+    {
+        std::pair<std::size_t, double> total{0, 0.0};
+        for (auto const& updater : _updaters) {
+            total.first += updater->statistics().dropped;
+            total.second += updater->statistics().dropped_norm;
+        }
+        return total;
+    }
+
+    /// Moves the summaries out of the workers. They are empty unless
+    /// `summarise` has been called.
+    /// \precondition The builder must be stopped.
+    auto summaries() -> std::vector<ShardSummary>
+    {
+        std::vector<ShardSummary> summaries;
+        summaries.reserve(_updaters.size());
+        for (auto& updater : _updaters) {
+            if (!updater->summarised()) { return {}; }
+            summaries.push_back(std::move(updater->summary()));
+        }
+        return summaries;
+    }
+
     auto operator+=(std::pair<std::complex<double>, SpinVector> const& x)
         -> QuantumStateBuilder&
     {
+        if (_buffer != nullptr) {
+            _buffer->emplace_back(x.second, x.first);
+            return *this;
+        }
         TCM_ASSERT(_updaters.size() < (1ul << 8));
         (*_updaters.at(spin_to_index(x.second, _updaters.size())))(
             {x.second, x.first});
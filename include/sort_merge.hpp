@@ -0,0 +1,144 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "quantum_state.hpp"
+#include <future>
+#include <vector>
+
+/// \file
+/// \brief Accumulation of H|ψ〉 by sorting instead of hashing.
+///
+/// Every producer appends its contributions to a private buffer, which is then
+/// radix-sorted and reduced into a run of strictly increasing spins. The runs
+/// of all producers are finally merged shard by shard into a sorted
+/// QuantumState. Memory access is sequential throughout, which pays off when
+/// H|ψ〉 is much larger than the caches.
+///
+/// If the buffers are bounded (see QuantumState::memory_limit), full buffers
+/// are sorted and written to temporary files, and the final merge streams
+/// over them.
+
+/// Sorts `xs` by spin and sums the amplitudes of equal spins, so that the
+/// spins become strictly increasing. `scratch` is used as temporary storage.
+auto sort_and_reduce(std::vector<QuantumState::value_type>& xs,
+    std::vector<QuantumState::value_type>&                  scratch) -> void;
+
+/// \brief Sorted, duplicate-free run of contributions stored on disk.
+///
+/// The file is created in `std::filesystem::temp_directory_path()` (i.e.
+/// `$TMPDIR`) and unlinked right away, so it disappears together with the
+/// object or the process.
+class SpilledRun {
+    int                      _fd;
+    std::size_t              _size;
+    std::vector<std::size_t> _shard_offsets;
+
+  public:
+    /// Writes `xs` to disk. `xs` must be sorted and duplicate-free.
+    SpilledRun(std::vector<QuantumState::value_type> const& xs,
+        std::size_t number_shards);
+    SpilledRun(SpilledRun const&) = delete;
+    SpilledRun(SpilledRun&&) noexcept;
+    SpilledRun& operator=(SpilledRun const&) = delete;
+    SpilledRun& operator=(SpilledRun&&) noexcept;
+    ~SpilledRun();
+
+    auto size() const noexcept { return _size; }
+    auto bytes() const noexcept
+    {
+        return _size * sizeof(QuantumState::value_type);
+    }
+
+    /// Returns the range of elements belonging to shard `i`.
+    auto shard(std::size_t const i) const noexcept
+    {
+        return std::make_pair(_shard_offsets[i], _shard_offsets[i + 1]);
+    }
+
+    /// Reads `count` elements starting with element `first` into `out`.
+    auto read(std::size_t first, std::size_t count,
+        QuantumState::value_type* out) const -> void;
+};
+
+/// \brief Collects the contributions of one producer.
+///
+/// Use `buffer()` as the target of a QuantumStateBuilder and call `poll()`
+/// regularly. Once the buffer holds `capacity` elements, it is handed over to
+/// a background task which sorts it and writes it to disk while the producer
+/// keeps filling a second buffer.
+class RunCollector {
+    using value_type = QuantumState::value_type;
+
+    std::vector<value_type> _buffer;
+    std::vector<value_type> _spare;
+    std::vector<value_type> _scratch;
+    std::vector<SpilledRun> _spilled;
+    std::future<SpilledRun> _pending;
+    std::size_t             _capacity;
+    std::size_t             _number_shards;
+    std::size_t             _generated;
+
+  public:
+    /// \param capacity Maximal number of buffered elements, 0 means unlimited.
+    RunCollector(std::size_t capacity, std::size_t number_shards);
+
+    auto buffer() noexcept -> std::vector<value_type>& { return _buffer; }
+
+    /// Spills the buffer if it is full.
+    auto poll() -> void
+    {
+        if (_capacity != 0 && _buffer.size() >= _capacity) { spill(); }
+    }
+
+    /// Waits for pending writes and sorts what remains in the buffer, which
+    /// then becomes `run()`.
+    auto finish() -> void;
+
+    auto run() noexcept -> std::vector<value_type>& { return _buffer; }
+    auto spilled() noexcept -> std::vector<SpilledRun>& { return _spilled; }
+    /// Total number of contributions collected by the time of `finish()`.
+    auto generated() const noexcept { return _generated; }
+
+  private:
+    auto spill() -> void;
+};
+
+/// Merges runs produced by `sort_and_reduce` (in memory or on disk) and stores
+/// the result in `psi`. If `keep` is not 0 and there are runs on disk, only
+/// the `keep` largest elements are stored and the rest is recorded in
+/// `psi.discarded()`; the merge then runs on one thread and uses memory for
+/// `keep` elements only. Otherwise shards are merged in parallel, one thread
+/// per shard of `psi`. Returns the number of distinct spins encountered.
+auto merge_runs(std::vector<std::vector<QuantumState::value_type>> const& runs,
+    QuantumState& psi, std::vector<SpilledRun> const& spilled = {},
+    std::size_t keep = 0) -> std::size_t;
@@ -172,6 +172,30 @@ class SpinVector {
         return _data.spin;
     }
 
+    /// Returns the first `min(size(), 64)` spins as an integer with spin 0
+    /// being the most significant bit. The order of these integers agrees
+    /// with `operator<`.
+    auto bits() const noexcept -> std::uint64_t
+    {
+        TCM_ASSERT(size() > 0);
+        auto const n = std::min<int>(size(), 64);
+        return __builtin_bswap64(static_cast<std::uint64_t>(_data.as_ints[0]))
+               >> (64 - n);
+    }
+
+    /// Inverse of `bits`: constructs a configuration of `n ≤ 64` spins from
+    /// the `n` least significant bits of `x`.
+    static auto from_bits(std::uint64_t const x, int const n) TCM_NOEXCEPT
+        -> SpinVector
+    {
+        TCM_ASSERT(0 < n && n <= 64);
+        SpinVector spin;
+        spin._data.as_ints[0] =
+            static_cast<long long>(__builtin_bswap64(x << (64 - n)));
+        spin._data.size = static_cast<std::uint16_t>(n);
+        return spin;
+    }
+
     auto print(std::ostream& out) const -> std::ostream&
     {
         auto const to_char = [](Spin const x) TCM_NOEXCEPT -> char {
@@ -203,6 +227,22 @@ class SpinVector {
                != 0xFFFF;
     }
 
+    /// Lexicographic order with spin 0 being the most significant, i.e. the
+    /// order of `data()` as a big-endian number. Sizes are compared last,
+    /// which only matters for configurations of different systems.
+    auto operator<(SpinVector const other) const noexcept -> bool
+    {
+        auto const x = std::make_pair(
+            __builtin_bswap64(static_cast<std::uint64_t>(_data.as_ints[0])),
+            __builtin_bswap64(static_cast<std::uint64_t>(_data.as_ints[1])));
+        auto const y = std::make_pair(
+            __builtin_bswap64(
+                static_cast<std::uint64_t>(other._data.as_ints[0])),
+            __builtin_bswap64(
+                static_cast<std::uint64_t>(other._data.as_ints[1])));
+        return x < y;
+    }
+
     auto hash() const noexcept -> std::size_t
     {
         static_assert(sizeof(_data.as_ints[0]) == sizeof(std::size_t));
@@ -211,6 +251,14 @@ class SpinVector {
         return seed;
     }
 
+    /// Returns the 16 bytes of the configuration (including its length) as
+    /// two native-endian words. Meant for hash functions.
+    auto words() const noexcept -> std::pair<std::uint64_t, std::uint64_t>
+    {
+        return {static_cast<std::uint64_t>(_data.as_ints[0]),
+            static_cast<std::uint64_t>(_data.as_ints[1])};
+    }
+
   private:
 #if defined(BOOST_GCC)
 #pragma GCC diagnostic push
@@ -0,0 +1,155 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "spin_chain.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#include "swiss_map.hpp"
+#include <flat_hash_map/bytell_hash_map.hpp>
+#include <flat_hash_map/flat_hash_map.hpp>
+
+/// \file
+/// \brief Hash tables keyed by spin configurations.
+///
+/// Lookups and insertions into these tables are the innermost loop of
+/// accumulating H|ψ〉, so the table and the hash function are chosen when the
+/// library is compiled rather than at runtime: CMake options
+/// `LANCZOS_SPIN_MAP` and `LANCZOS_SPIN_HASH` select `SpinMap` and
+/// `DefaultSpinHasher` below. `bench/spin_map_bench.cpp` measures all
+/// combinations on the access pattern of `Updater`.
+
+/// `boost::hash_combine` of the two words of the configuration.
+struct SpinHasher {
+    auto operator()(SpinVector const& x) const noexcept { return x.hash(); }
+};
+
+/// \brief Multiply-add-shift hashing of the 128-bit key.
+///
+/// Returns the upper half of a·lo + b·hi + c computed modulo 2¹²⁸, which
+/// mixes every bit of the key into the high bits that Fibonacci hashing
+/// (used by both ska tables) looks at.
+struct MultiplyShiftHasher {
+    __extension__ using uint128 = unsigned __int128;
+
+    static constexpr auto join(std::uint64_t const high,
+        std::uint64_t const low) noexcept -> uint128
+    {
+        return (uint128{high} << 64) | low;
+    }
+
+    auto operator()(SpinVector const& x) const noexcept -> std::size_t
+    {
+        constexpr auto a = join(0x9e3779b97f4a7c15, 0xf39cc0605cedc835);
+        constexpr auto b = join(0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9);
+        constexpr auto c = join(0x27d4eb2f165667c5, 0x85ebca77c2b2ae63);
+        auto const [lo, hi] = x.words();
+        return static_cast<std::size_t>((a * lo + b * hi + c) >> 64);
+    }
+};
+
+#if defined(__SSE4_2__)
+/// CRC32-C of the two words of the configuration (one instruction per word),
+/// spread over 64 bits. Requires SSE4.2 at compile time.
+struct Crc32cHasher {
+    auto operator()(SpinVector const& x) const noexcept -> std::size_t
+    {
+        auto const [lo, hi] = x.words();
+        auto const crc      = _mm_crc32_u64(_mm_crc32_u64(0, lo), hi);
+        return static_cast<std::size_t>(crc * 0x9e3779b97f4a7c15);
+    }
+};
+#endif
+
+#if defined(TCM_SPIN_HASH_MULTIPLY_SHIFT)
+using DefaultSpinHasher = MultiplyShiftHasher;
+#elif defined(TCM_SPIN_HASH_CRC32C)
+#if !defined(__SSE4_2__)
+#error "LANCZOS_SPIN_HASH=crc32c requires SSE4.2, e.g. LANCZOS_NATIVE=ON."
+#endif
+using DefaultSpinHasher = Crc32cHasher;
+#else
+using DefaultSpinHasher = SpinHasher;
+#endif
+
+#if defined(TCM_SPIN_MAP_FLAT)
+/// Robin Hood hashing with linear probing.
+template <class Value, class Hasher = DefaultSpinHasher>
+using SpinMap = ska::flat_hash_map<SpinVector, Value, Hasher>;
+#elif defined(TCM_SPIN_MAP_SWISS)
+/// Open addressing with a separate array of control bytes probed 8 at a
+/// time.
+template <class Value, class Hasher = DefaultSpinHasher>
+using SpinMap = SwissMap<SpinVector, Value, Hasher>;
+#elif defined(TCM_SPIN_MAP_STD)
+/// Separate chaining, for reference.
+template <class Value, class Hasher = DefaultSpinHasher>
+using SpinMap = std::unordered_map<SpinVector, Value, Hasher>;
+#else
+/// Open addressing with chains of buckets linked by jump distances.
+template <class Value, class Hasher = DefaultSpinHasher>
+using SpinMap = ska::bytell_hash_map<SpinVector, Value, Hasher>;
+#endif
+
+/// Approximate number of bytes allocated by a `SpinMap<Value>` with
+/// `bucket_count` buckets which holds `size` elements.
+template <class Value>
+constexpr auto spin_map_bytes(
+    std::size_t const bucket_count, std::size_t const size) noexcept
+    -> std::size_t
+{
+    using element_type = std::pair<SpinVector, Value>;
+#if defined(TCM_SPIN_MAP_FLAT)
+    // Every slot stores its distance from the ideal slot, padded.
+    static_cast<void>(size);
+    return bucket_count * (alignof(element_type) + sizeof(element_type));
+#elif defined(TCM_SPIN_MAP_STD)
+    // Every node holds the next pointer and the cached hash.
+    return bucket_count * sizeof(void*)
+           + size * (sizeof(element_type) + 2 * sizeof(void*));
+#else
+    // One control byte per slot: blocks of 8 slots share 8 control bytes
+    // (bytell), or all control bytes form an array of their own (swiss).
+    static_cast<void>(size);
+    return bucket_count * (1 + sizeof(element_type));
+#endif
+}
+
+/// Approximate number of bytes allocated by `map`.
+template <class Map> auto memory_usage(Map const& map) noexcept -> std::size_t
+{
+    return spin_map_bytes<typename Map::mapped_type>(
+        map.bucket_count(), map.size());
+}
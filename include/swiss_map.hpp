@@ -0,0 +1,465 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+/// \brief Open-addressing hash table in the style of SwissTable.
+///
+/// Control bytes and elements live in two separate arrays. The control byte
+/// of a slot is either empty, deleted or the 7 low bits of the hash of
+/// its element. Probing loads a group of 8 control bytes as one word and
+/// compares them all at once (SWAR, so no particular instruction set is
+/// needed). Elements are only touched when their control byte matches,
+/// which is one in 128 for unrelated keys, so most probes never leave the
+/// control array. Groups are probed in triangular order.
+///
+/// Only the subset of the `std::unordered_map` interface which the code
+/// uses is provided. Iterators and references are invalidated by any
+/// insertion which grows the table.
+template <class Key, class Value, class Hasher = std::hash<Key>>
+class SwissMap {
+  public:
+    using key_type    = Key;
+    using mapped_type = Value;
+    using value_type  = std::pair<Key, Value>;
+    using size_type   = std::size_t;
+    using hasher      = Hasher;
+
+  private:
+    static constexpr std::size_t   group_width  = 8;
+    static constexpr std::uint64_t lsbs         = 0x0101010101010101;
+    static constexpr std::uint64_t msbs         = 0x8080808080808080;
+    static constexpr std::uint8_t  empty_slot   = 0x80;
+    static constexpr std::uint8_t  deleted_slot = 0xfe;
+
+    union Slot {
+        value_type value;
+        Slot() noexcept {}
+        ~Slot() {}
+    };
+
+    std::unique_ptr<std::uint8_t[]> _control;
+    std::unique_ptr<Slot[]>         _slots;
+    std::size_t                     _capacity; ///< 0 or a power of 2 ≥ 8
+    std::size_t                     _size;
+    std::size_t                     _deleted;
+    float                           _max_load_factor;
+    Hasher                          _hash;
+
+    static auto is_full(std::uint8_t const c) noexcept { return c < 0x80; }
+
+    /// Spreads the hash over both halves, so that neither the group index
+    /// (high bits) nor the control byte (low bits) depends on a few bits of
+    /// `hash` only.
+    auto mix(Key const& key) const noexcept -> std::uint64_t
+    {
+        __extension__ using uint128 = unsigned __int128;
+        auto const product = static_cast<uint128>(_hash(key))
+                             * uint128{0x9e3779b97f4a7c15};
+        return static_cast<std::uint64_t>(product >> 64)
+               ^ static_cast<std::uint64_t>(product);
+    }
+    static auto control_of(std::uint64_t const h) noexcept
+    {
+        return static_cast<std::uint8_t>(h & 0x7f);
+    }
+    auto group_of(std::uint64_t const h) const noexcept -> std::size_t
+    {
+        return (h >> 7) & (_capacity / group_width - 1);
+    }
+
+    auto load(std::size_t const group) const noexcept -> std::uint64_t
+    {
+        std::uint64_t word;
+        std::memcpy(&word, _control.get() + group * group_width, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        return word;
+    }
+    /// Bit 8i+7 is set if byte i of `word` equals `c`. May have false
+    /// positives right above a true one, which the key comparison filters.
+    static auto match(std::uint64_t const word, std::uint8_t const c) noexcept
+    {
+        auto const x = word ^ (lsbs * c);
+        return (x - lsbs) & ~x & msbs;
+    }
+    static auto match_empty(std::uint64_t const word) noexcept
+    {
+        // Only `empty_slot` has bit 7 set and bit 1 unset.
+        return word & ~(word << 6) & msbs;
+    }
+    static auto match_free(std::uint64_t const word) noexcept
+    {
+        return word & msbs;
+    }
+    static auto first(std::uint64_t const mask) noexcept -> std::size_t
+    {
+        return static_cast<std::size_t>(__builtin_ctzll(mask)) / 8;
+    }
+
+    auto next_group(std::size_t const group, std::size_t const step) const
+        noexcept -> std::size_t
+    {
+        return (group + step) & (_capacity / group_width - 1);
+    }
+
+    auto find_index(Key const& key, std::uint64_t const h) const noexcept
+        -> std::size_t
+    {
+        if (_capacity == 0) { return _capacity; }
+        auto const c     = control_of(h);
+        auto       group = group_of(h);
+        for (std::size_t step = 1;; ++step) {
+            auto const word = load(group);
+            for (auto mask = match(word, c); mask != 0; mask &= mask - 1) {
+                auto const i = group * group_width + first(mask);
+                if (_slots[i].value.first == key) { return i; }
+            }
+            if (match_empty(word) != 0) { return _capacity; }
+            group = next_group(group, step);
+        }
+    }
+
+    /// Returns the first empty or deleted slot on the probe sequence of `h`.
+    auto free_index(std::uint64_t const h) const noexcept -> std::size_t
+    {
+        auto group = group_of(h);
+        for (std::size_t step = 1;; ++step) {
+            auto const mask = match_free(load(group));
+            if (mask != 0) { return group * group_width + first(mask); }
+            group = next_group(group, step);
+        }
+    }
+
+    auto set_control(std::size_t const i, std::uint8_t const c) noexcept
+    {
+        _control[i] = c;
+    }
+
+    template <class... Args>
+    auto construct_at(std::size_t const i, std::uint64_t const h,
+        Args&&... args) -> void
+    {
+        ::new (static_cast<void*>(std::addressof(_slots[i].value)))
+            value_type(std::forward<Args>(args)...);
+        if (_control[i] == deleted_slot) { --_deleted; }
+        set_control(i, control_of(h));
+        ++_size;
+    }
+
+    auto destroy_all() noexcept -> void
+    {
+        for (std::size_t i = 0; i < _capacity; ++i) {
+            if (is_full(_control[i])) { _slots[i].value.~value_type(); }
+        }
+    }
+
+    auto room(std::size_t const capacity) const noexcept -> std::size_t
+    {
+        return static_cast<std::size_t>(
+            _max_load_factor * static_cast<float>(capacity));
+    }
+
+    /// Moves all elements into fresh arrays of `capacity` slots, which also
+    /// drops the tombstones.
+    auto rehash_to(std::size_t const capacity) -> void
+    {
+        auto old_control  = std::move(_control);
+        auto old_slots    = std::move(_slots);
+        auto old_capacity = _capacity;
+        _control.reset(new std::uint8_t[capacity]);
+        _slots.reset(new Slot[capacity]);
+        std::memset(_control.get(), empty_slot, capacity);
+        _capacity = capacity;
+        _size     = 0;
+        _deleted  = 0;
+        for (std::size_t i = 0; i < old_capacity; ++i) {
+            if (!is_full(old_control[i])) { continue; }
+            auto& x = old_slots[i].value;
+            auto const h = mix(x.first);
+            construct_at(free_index(h), h, std::move(x));
+            x.~value_type();
+        }
+    }
+
+    /// Makes sure that one more element can be inserted. The capacity only
+    /// depends on the number of elements, as with the other tables, so that
+    /// `Updater` can predict it: if tombstones fill the table, it is
+    /// rehashed in place.
+    auto prepare_insert() -> void
+    {
+        if (_size + _deleted + 1 <= room(_capacity)) { return; }
+        if (_size + 1 <= room(_capacity)) { rehash_to(_capacity); }
+        else {
+            rehash_to(_capacity == 0 ? group_width : 2 * _capacity);
+        }
+    }
+
+    template <class Map, class Reference> class basic_iterator {
+        Map*        _map;
+        std::size_t _i;
+
+        auto skip() noexcept
+        {
+            while (_i < _map->_capacity && !is_full(_map->_control[_i])) {
+                ++_i;
+            }
+        }
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = typename SwissMap::value_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = std::remove_reference_t<Reference>*;
+        using reference         = Reference;
+
+        basic_iterator() noexcept : _map{nullptr}, _i{0} {}
+        basic_iterator(Map* map, std::size_t const i) noexcept
+            : _map{map}, _i{i}
+        {
+            skip();
+        }
+        /// iterator → const_iterator
+        template <class Other, class OtherReference>
+        basic_iterator(
+            basic_iterator<Other, OtherReference> const& other) noexcept
+            : _map{other._map}, _i{other._i}
+        {}
+
+        auto operator*() const noexcept -> reference
+        {
+            return _map->_slots[_i].value;
+        }
+        auto operator->() const noexcept -> pointer
+        {
+            return std::addressof(_map->_slots[_i].value);
+        }
+        auto operator++() noexcept -> basic_iterator&
+        {
+            ++_i;
+            skip();
+            return *this;
+        }
+        auto operator++(int) noexcept -> basic_iterator
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        friend auto operator==(basic_iterator const& a,
+            basic_iterator const& b) noexcept -> bool
+        {
+            return a._i == b._i;
+        }
+        friend auto operator!=(basic_iterator const& a,
+            basic_iterator const& b) noexcept -> bool
+        {
+            return a._i != b._i;
+        }
+
+        template <class, class> friend class basic_iterator;
+        friend class SwissMap;
+    };
+
+  public:
+    using iterator       = basic_iterator<SwissMap, value_type&>;
+    using const_iterator = basic_iterator<SwissMap const, value_type const&>;
+
+    SwissMap() noexcept
+        : _control{}
+        , _slots{}
+        , _capacity{0}
+        , _size{0}
+        , _deleted{0}
+        , _max_load_factor{0.875f}
+        , _hash{}
+    {}
+
+    SwissMap(SwissMap const& other) : SwissMap{}
+    {
+        _max_load_factor = other._max_load_factor;
+        reserve(other.size());
+        for (auto const& x : other) {
+            insert(x);
+        }
+    }
+
+    SwissMap(SwissMap&& other) noexcept
+        : _control{std::move(other._control)}
+        , _slots{std::move(other._slots)}
+        , _capacity{std::exchange(other._capacity, 0)}
+        , _size{std::exchange(other._size, 0)}
+        , _deleted{std::exchange(other._deleted, 0)}
+        , _max_load_factor{other._max_load_factor}
+        , _hash{std::move(other._hash)}
+    {}
+
+    auto operator=(SwissMap const& other) -> SwissMap&
+    {
+        if (this != std::addressof(other)) { *this = SwissMap{other}; }
+        return *this;
+    }
+
+    auto operator=(SwissMap&& other) noexcept -> SwissMap&
+    {
+        if (this != std::addressof(other)) {
+            destroy_all();
+            _control         = std::move(other._control);
+            _slots           = std::move(other._slots);
+            _capacity        = std::exchange(other._capacity, 0);
+            _size            = std::exchange(other._size, 0);
+            _deleted         = std::exchange(other._deleted, 0);
+            _max_load_factor = other._max_load_factor;
+            _hash            = std::move(other._hash);
+        }
+        return *this;
+    }
+
+    ~SwissMap() { destroy_all(); }
+
+    auto begin() noexcept { return iterator{this, 0}; }
+    auto end() noexcept { return iterator{this, _capacity}; }
+    auto begin() const noexcept { return const_iterator{this, 0}; }
+    auto end() const noexcept { return const_iterator{this, _capacity}; }
+    auto cbegin() const noexcept { return begin(); }
+    auto cend() const noexcept { return end(); }
+
+    auto size() const noexcept { return _size; }
+    auto empty() const noexcept { return _size == 0; }
+    auto bucket_count() const noexcept { return _capacity; }
+    auto load_factor() const noexcept
+    {
+        return _capacity == 0 ? 0.0f
+                              : static_cast<float>(_size)
+                                    / static_cast<float>(_capacity);
+    }
+    auto max_load_factor() const noexcept { return _max_load_factor; }
+    /// Takes effect at the next growth. At most 7/8, so that every probe
+    /// sequence ends at an empty slot.
+    auto max_load_factor(float const value) noexcept -> void
+    {
+        _max_load_factor = std::min(value, 0.875f);
+    }
+
+    auto find(Key const& key) -> iterator
+    {
+        return iterator{this, find_index(key, mix(key))};
+    }
+    auto find(Key const& key) const -> const_iterator
+    {
+        return const_iterator{this, find_index(key, mix(key))};
+    }
+    auto count(Key const& key) const -> std::size_t
+    {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    template <class... Args>
+    auto emplace(Args&&... args) -> std::pair<iterator, bool>
+    {
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+    auto insert(value_type const& x) -> std::pair<iterator, bool>
+    {
+        return insert(value_type{x});
+    }
+    auto insert(value_type&& x) -> std::pair<iterator, bool>
+    {
+        auto const h = mix(x.first);
+        auto const i = find_index(x.first, h);
+        if (i != _capacity) { return {iterator{this, i}, false}; }
+        prepare_insert();
+        auto const j = free_index(h);
+        construct_at(j, h, std::move(x));
+        return {iterator{this, j}, true};
+    }
+
+    /// Returns the iterator following `position`.
+    auto erase(const_iterator const position) -> iterator
+    {
+        auto const i = position._i;
+        _slots[i].value.~value_type();
+        --_size;
+        // A probe only continues past a group without empty slots, so if
+        // this group has one, no other element can depend on this slot.
+        auto const group = i / group_width;
+        if (match_empty(load(group)) != 0) { set_control(i, empty_slot); }
+        else {
+            set_control(i, deleted_slot);
+            ++_deleted;
+        }
+        return iterator{this, i + 1};
+    }
+    auto erase(iterator const position) -> iterator
+    {
+        return erase(const_iterator{position});
+    }
+    auto erase(Key const& key) -> std::size_t
+    {
+        auto const i = find_index(key, mix(key));
+        if (i == _capacity) { return 0; }
+        erase(const_iterator{this, i});
+        return 1;
+    }
+
+    /// Removes all elements, but keeps the memory.
+    auto clear() noexcept -> void
+    {
+        destroy_all();
+        if (_capacity != 0) {
+            std::memset(_control.get(), empty_slot, _capacity);
+        }
+        _size    = 0;
+        _deleted = 0;
+    }
+
+    /// Makes room for `count` elements without further allocation.
+    auto reserve(std::size_t const count) -> void
+    {
+        if (count == 0) { return; }
+        auto capacity = std::max(_capacity, group_width);
+        while (room(capacity) < count) {
+            capacity *= 2;
+        }
+        if (capacity > _capacity) { rehash_to(capacity); }
+    }
+};
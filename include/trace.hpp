@@ -0,0 +1,112 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+/// \file
+/// \brief Timeline of what every thread was doing.
+///
+/// `TCM_TRACE_SCOPE("name")` records a span from that point to the end of
+/// the enclosing scope. Every thread appends its spans to a ring buffer of
+/// its own, so recording takes no locks. Spans are only recorded if the code
+/// was compiled with `TCM_TRACING` (CMake option `LANCZOS_TRACING`) and
+/// tracing was started with `start_tracing`. Otherwise the macro expands to
+/// nothing.
+
+/// Discards all spans recorded so far and starts recording. Only the last
+/// `capacity` spans of every thread are kept. No other thread may record
+/// spans at the same time. Throws if tracing was not compiled in.
+auto start_tracing(std::size_t capacity = std::size_t{1} << 16) -> void;
+auto stop_tracing() noexcept -> void;
+
+/// Writes the recorded spans in the Chrome trace format, which
+/// chrome://tracing and https://ui.perfetto.dev can open. No thread may
+/// record spans at the same time.
+auto write_trace(std::ostream&) -> void;
+
+/// Current time of `std::chrono::steady_clock` in nanoseconds.
+inline auto trace_clock() noexcept -> std::int64_t
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/// Makes sure the calling thread has a buffer and returns `trace_clock()`.
+/// A thread keeps its buffer from its first span until it exits, so threads
+/// which run at the same time never share a row of the timeline.
+auto begin_span() noexcept -> std::int64_t;
+
+/// Appends a span to the buffer of the calling thread. Times are given by
+/// `trace_clock`.
+auto record_span(
+    char const* name, std::int64_t begin, std::int64_t end) noexcept -> void;
+
+inline std::atomic_bool tracing_enabled{false};
+
+/// \brief Records the time from construction to destruction as a span.
+///
+/// `name` must outlive the trace, i.e. it should be a string literal.
+class TraceSpan {
+    char const*  _name;
+    std::int64_t _begin;
+
+  public:
+    explicit TraceSpan(char const* name) noexcept
+        : _name{tracing_enabled.load(std::memory_order_relaxed) ? name
+                                                                  : nullptr}
+        , _begin{_name != nullptr ? begin_span() : 0}
+    {
+    }
+
+    TraceSpan(TraceSpan const&) = delete;
+    TraceSpan& operator=(TraceSpan const&) = delete;
+
+    ~TraceSpan()
+    {
+        if (_name != nullptr) { record_span(_name, _begin, trace_clock()); }
+    }
+};
+
+#if defined(TCM_TRACING)
+#define TCM_TRACE_CONCAT_IMPL(a, b) a##b
+#define TCM_TRACE_CONCAT(a, b) TCM_TRACE_CONCAT_IMPL(a, b)
+#define TCM_TRACE_SCOPE(name)                                                  \
+    TraceSpan const TCM_TRACE_CONCAT(tcm_trace_span_, __LINE__) { name }
+#else
+#define TCM_TRACE_SCOPE(name) static_cast<void>(0)
+#endif
@@ -0,0 +1,84 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <streambuf>
+#include <string>
+
+/// \brief Listening UNIX domain socket.
+///
+/// A socket file left behind by a server which is no longer running is
+/// replaced. The file is removed again by the destructor.
+///
+/// Only the owner may use the socket: it is created with mode 0600, and
+/// connections from processes of other users are closed right away.
+class UnixListener {
+    int         _fd;
+    std::string _path;
+
+  public:
+    explicit UnixListener(std::string path);
+    UnixListener(UnixListener const&) = delete;
+    UnixListener& operator=(UnixListener const&) = delete;
+    ~UnixListener();
+
+    /// Waits for the next connection of a process of our own user and
+    /// returns its file descriptor.
+    auto accept() -> int;
+};
+
+/// Connects to the UNIX domain socket at `path` and returns the file
+/// descriptor.
+auto unix_connect(std::string const& path) -> int;
+
+/// \brief Buffered `std::streambuf` over a socket, which it owns.
+class SocketBuffer : public std::streambuf {
+    int  _fd;
+    char _input[4096];
+    char _output[4096];
+
+  public:
+    explicit SocketBuffer(int fd);
+    SocketBuffer(SocketBuffer const&) = delete;
+    SocketBuffer& operator=(SocketBuffer const&) = delete;
+    /// Flushes the output and closes the socket.
+    ~SocketBuffer() override;
+
+    /// Flushes the output and tells the peer that nothing more will be sent.
+    /// Reading is still possible afterwards.
+    auto shutdown_output() -> void;
+
+  protected:
+    auto underflow() -> int_type override;
+    auto overflow(int_type c) -> int_type override;
+    auto sync() -> int override;
+};
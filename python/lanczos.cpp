@@ -0,0 +1,932 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Python.h has to come before any standard header.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "dense.hpp"
+#include "diffusion.hpp"
+#include "hamiltonian.hpp"
+#include "quantum_state.hpp"
+#include <climits>
+#include <cstddef>
+#include <fstream>
+#include <initializer_list>
+#include <new>
+#include <optional>
+#include <utility>
+
+/// \file
+/// \brief Python module `lanczos`.
+///
+/// Written against the CPython and NumPy C APIs, so that nothing but their
+/// headers is needed to build it. Frozen and dense states expose their
+/// arrays to NumPy without copying, and the GIL is released while the C++
+/// code runs.
+
+namespace {
+/// A SpinVector stores up to 112 spins in 14 bytes followed by its length.
+constexpr npy_intp spin_bytes = 14;
+static_assert(sizeof(SpinVector) == 16);
+
+/// Thrown when a Python exception has already been set.
+struct python_error {};
+
+/// Returns `object` or throws `python_error` if it is null.
+auto check(PyObject* const object) -> PyObject*
+{
+    if (object == nullptr) { throw python_error{}; }
+    return object;
+}
+
+[[noreturn]] auto raise(PyObject* const type, char const* const message)
+{
+    PyErr_SetString(type, message);
+    throw python_error{};
+}
+
+/// Owning reference to a Python object.
+class Ref {
+    PyObject* _object;
+
+  public:
+    explicit Ref(PyObject* const object) : _object{check(object)} {}
+    Ref(Ref const&) = delete;
+    auto operator=(Ref const&) -> Ref& = delete;
+    ~Ref() { Py_XDECREF(_object); }
+
+    auto get() const noexcept -> PyObject* { return _object; }
+    auto release() noexcept -> PyObject*
+    {
+        return std::exchange(_object, nullptr);
+    }
+};
+
+/// Releases the GIL for the lifetime of the object. The GIL is taken back
+/// before an exception leaves the scope.
+class ReleaseGil {
+    PyThreadState* _state;
+
+  public:
+    ReleaseGil() noexcept : _state{PyEval_SaveThread()} {}
+    ReleaseGil(ReleaseGil const&) = delete;
+    auto operator=(ReleaseGil const&) -> ReleaseGil& = delete;
+    ~ReleaseGil() { PyEval_RestoreThread(_state); }
+};
+
+/// Calls `fn` and translates C++ exceptions into Python ones, returning
+/// `error` if one is raised.
+template <class R, class Function>
+auto guarded(R const error, Function&& fn) noexcept -> R
+{
+    try {
+        return fn();
+    }
+    catch (python_error const&) {
+    }
+    catch (std::invalid_argument const& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    }
+    catch (std::bad_alloc const&) {
+        PyErr_NoMemory();
+    }
+    catch (std::exception const& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return error;
+}
+
+/// Parses positional and keyword arguments, see
+/// `PyArg_ParseTupleAndKeywords`.
+template <class... Args>
+auto parse(PyObject* const args, PyObject* const kwargs,
+    char const* const format, std::initializer_list<char const*> names,
+    Args*... out) -> void
+{
+    std::vector<char*> keywords;
+    for (auto const* name : names) {
+        keywords.push_back(const_cast<char*>(name));
+    }
+    keywords.push_back(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwargs, format, keywords.data(), out...)) {
+        throw python_error{};
+    }
+}
+
+auto to_size(Py_ssize_t const value, char const* const name) -> std::size_t
+{
+    if (value < 0) {
+        PyErr_Format(PyExc_ValueError, "%s must be non-negative", name);
+        throw python_error{};
+    }
+    return static_cast<std::size_t>(value);
+}
+
+auto to_int(PyObject* const object) -> int
+{
+    auto const value = PyLong_AsLong(object);
+    if (value == -1 && PyErr_Occurred() != nullptr) { throw python_error{}; }
+    if (value < INT_MIN || value > INT_MAX) {
+        raise(PyExc_OverflowError, "integer does not fit into an int");
+    }
+    return static_cast<int>(value);
+}
+
+/// Calls `fn` for every element of the sequence `object`, which must have
+/// `size` elements unless `size` is negative.
+template <class Function>
+auto for_each_item(PyObject* const object, char const* const message,
+    Function&& fn, Py_ssize_t const size = -1) -> void
+{
+    Ref const  items{PySequence_Fast(object, message)};
+    auto const count = PySequence_Fast_GET_SIZE(items.get());
+    if (size >= 0 && count != size) { raise(PyExc_TypeError, message); }
+    for (Py_ssize_t i = 0; i < count; ++i) {
+        fn(PySequence_Fast_GET_ITEM(items.get(), i));
+    }
+}
+
+/// Python object holding a `T`. The value is empty until `__init__` sets
+/// it.
+template <class T> struct Object {
+    PyObject_HEAD
+    std::optional<T> value;
+};
+
+template <class T> auto value_of(PyObject* const self) -> T&
+{
+    auto& value = reinterpret_cast<Object<T>*>(self)->value;
+    if (!value.has_value()) {
+        raise(PyExc_RuntimeError, "object has not been initialised");
+    }
+    return *value;
+}
+
+template <class T>
+auto new_object(PyTypeObject* const type, PyObject* /*args*/,
+    PyObject* /*kwargs*/) -> PyObject*
+{
+    auto* const self = type->tp_alloc(type, 0);
+    if (self != nullptr) {
+        new (&reinterpret_cast<Object<T>*>(self)->value) std::optional<T>{};
+    }
+    return self;
+}
+
+template <class T> auto dealloc(PyObject* const self) -> void
+{
+    auto* const type = Py_TYPE(self);
+    reinterpret_cast<Object<T>*>(self)->value.~optional();
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+/// Types and enums of the module, set by `PyInit_lanczos`.
+PyTypeObject* heisenberg_type;
+PyTypeObject* coupling_matrix_type;
+PyTypeObject* filter_type;
+PyTypeObject* state_type;
+PyObject*     kind_enum;
+PyObject*     backend_enum;
+
+template <class T> auto wrap(PyTypeObject* const type, T value) -> PyObject*
+{
+    Ref self{new_object<T>(type, nullptr, nullptr)};
+    reinterpret_cast<Object<T>*>(self.get())->value.emplace(std::move(value));
+    return self.release();
+}
+
+/// Creates `enum.IntEnum(name, values)` in this module.
+auto make_enum(char const* const name, char const* const qualname,
+    std::initializer_list<std::pair<char const*, int>> values) -> PyObject*
+{
+    Ref const members{PyList_New(0)};
+    for (auto const& [member, value] : values) {
+        Ref const item{Py_BuildValue("(si)", member, value)};
+        if (PyList_Append(members.get(), item.get()) < 0) {
+            throw python_error{};
+        }
+    }
+    Ref const module{PyImport_ImportModule("enum")};
+    Ref const int_enum{PyObject_GetAttrString(module.get(), "IntEnum")};
+    Ref const args{Py_BuildValue("(sO)", name, members.get())};
+    Ref const kwargs{Py_BuildValue(
+        "{s:s,s:s}", "module", "lanczos", "qualname", qualname)};
+    return check(PyObject_Call(int_enum.get(), args.get(), kwargs.get()));
+}
+
+/// Converts a member of the IntEnum `type` to `E`.
+template <class E>
+auto to_enum(PyObject* const object, PyObject* const type) -> E
+{
+    auto const is_member = PyObject_IsInstance(object, type);
+    if (is_member < 0) { throw python_error{}; }
+    if (is_member == 0) {
+        PyErr_Format(PyExc_TypeError, "expected a member of %R", type);
+        throw python_error{};
+    }
+    return static_cast<E>(to_int(object));
+}
+
+template <class E>
+auto from_enum(E const value, PyObject* const type) -> PyObject*
+{
+    return check(PyObject_CallFunction(type, "i", static_cast<int>(value)));
+}
+
+auto open_file(std::string const& file_name, std::ios::openmode const mode)
+    -> std::fstream
+{
+    std::fstream file{file_name, mode | std::ios::binary};
+    if (!file) {
+        throw_with_trace(std::runtime_error{"Could not open '" + file_name
+                                            + "' for "
+                                            + (mode == std::ios::in
+                                                      ? "reading."
+                                                      : "writing.")});
+    }
+    return file;
+}
+
+auto read_heisenberg(std::string const& file_name) -> Heisenberg
+{
+    auto       in = open_file(file_name, std::ios::in);
+    Heisenberg hamiltonian;
+    if (!(in >> hamiltonian) && !in.eof()) {
+        throw_with_trace(
+            std::runtime_error{"Failed to parse the Hamiltonian."});
+    }
+    return hamiltonian;
+}
+
+/// Reads a coupling matrix in the binary format of `write_binary`.
+auto read_couplings(std::string const& file_name) -> CouplingMatrix
+{
+    auto           in = open_file(file_name, std::ios::in);
+    CouplingMatrix couplings;
+    if (!is_binary_couplings(in)) {
+        throw_with_trace(std::runtime_error{
+            "'" + file_name + "' does not contain a binary coupling matrix."});
+    }
+    read_binary(in, couplings);
+    return couplings;
+}
+
+auto load(QuantumState& psi, std::string const& file_name, bool const binary)
+    -> void
+{
+    auto in = open_file(file_name, std::ios::in);
+    if (binary) { read_binary(in, psi); }
+    else {
+        in >> psi;
+    }
+}
+
+auto save(QuantumState const& psi, std::string const& file_name,
+    bool const binary) -> void
+{
+    auto out = open_file(file_name, std::ios::out);
+    if (binary) { write_binary(out, psi); }
+    else {
+        out << psi;
+    }
+}
+
+/// Switches `psi` to the smallest dense basis containing it.
+auto make_dense(QuantumState& psi) -> void
+{
+    auto const sector = smallest_basis(psi);
+    if (!sector.has_value()) {
+        throw_with_trace(std::runtime_error{
+            "A dense state requires all spin configurations to have the same "
+            "length, which may not exceed 63."});
+    }
+    psi.make_dense(
+        std::make_shared<DenseBasis const>(sector->first, sector->second));
+}
+
+/// Returns a read-only array which refers to `data` and keeps `owner` alive.
+auto view(PyObject* const owner, int const type, void const* data,
+    std::initializer_list<npy_intp> shape,
+    std::initializer_list<npy_intp> strides) -> PyObject*
+{
+    // NumPy allocates memory of its own when given a null pointer.
+    static std::max_align_t empty;
+    if (data == nullptr) { data = &empty; }
+    Ref array{PyArray_New(&PyArray_Type, static_cast<int>(shape.size()),
+        const_cast<npy_intp*>(shape.begin()), type,
+        const_cast<npy_intp*>(strides.begin()), const_cast<void*>(data), 0,
+        0, nullptr)};
+    Py_INCREF(owner);
+    if (PyArray_SetBaseObject(
+            reinterpret_cast<PyArrayObject*>(array.get()), owner)
+        < 0) {
+        throw python_error{};
+    }
+    return array.release();
+}
+
+/// Calls `fn` with the Heisenberg or CouplingMatrix held by `object`.
+template <class Function>
+auto visit_hamiltonian(PyObject* const object, Function&& fn)
+{
+    if (PyObject_TypeCheck(object, heisenberg_type)) {
+        return fn(value_of<Heisenberg>(object));
+    }
+    if (PyObject_TypeCheck(object, coupling_matrix_type)) {
+        return fn(value_of<CouplingMatrix>(object));
+    }
+    raise(PyExc_TypeError,
+        "hamiltonian must be a Heisenberg or a CouplingMatrix");
+}
+
+// Heisenberg
+
+auto heisenberg_init(PyObject* self, PyObject* args, PyObject* kwargs) -> int
+{
+    return guarded(-1, [&] {
+        PyObject* specs;
+        parse(args, kwargs, "O", {"specs"}, &specs);
+        constexpr auto message =
+            "specs must be a list of (coupling, [(i, j), ...]) pairs";
+        std::vector<Heisenberg::spec_type> xs;
+        for_each_item(specs, message, [&](PyObject* const spec) {
+            PyObject* items[2];
+            auto      count = 0;
+            for_each_item(
+                spec, message, [&](auto* x) { items[count++] = x; }, 2);
+            auto const coupling = PyComplex_AsCComplex(items[0]);
+            if (PyErr_Occurred() != nullptr) { throw python_error{}; }
+            std::vector<Heisenberg::edge_type> edges;
+            for_each_item(items[1], message, [&](PyObject* const edge) {
+                int ends[2];
+                count = 0;
+                for_each_item(
+                    edge, message,
+                    [&](auto* x) { ends[count++] = to_int(x); }, 2);
+                edges.emplace_back(ends[0], ends[1]);
+            });
+            xs.emplace_back(
+                std::complex{coupling.real, coupling.imag}, std::move(edges));
+        });
+        reinterpret_cast<Object<Heisenberg>*>(self)->value.emplace(
+            std::move(xs));
+        return 0;
+    });
+}
+
+auto heisenberg_from_file(PyObject*, PyObject* args, PyObject* kwargs)
+    -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        char const* file_name;
+        parse(args, kwargs, "s", {"file_name"}, &file_name);
+        return wrap(heisenberg_type, read_heisenberg(file_name));
+    });
+}
+
+auto heisenberg_specs(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        auto const& specs = value_of<Heisenberg>(self).specs();
+        Ref         list{PyList_New(static_cast<Py_ssize_t>(specs.size()))};
+        for (std::size_t i = 0; i < specs.size(); ++i) {
+            auto const& [coupling, edges] = specs[i];
+            Ref xs{PyList_New(static_cast<Py_ssize_t>(edges.size()))};
+            for (std::size_t j = 0; j < edges.size(); ++j) {
+                PyList_SET_ITEM(xs.get(), static_cast<Py_ssize_t>(j),
+                    check(Py_BuildValue(
+                        "(ii)", edges[j].first, edges[j].second)));
+            }
+            Py_complex const c{coupling.real(), coupling.imag()};
+            PyList_SET_ITEM(list.get(), static_cast<Py_ssize_t>(i),
+                check(Py_BuildValue("(DN)", &c, xs.release())));
+        }
+        return list.release();
+    });
+}
+
+auto heisenberg_number_edges(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return PyLong_FromSize_t(value_of<Heisenberg>(self).number_edges());
+    });
+}
+
+// CouplingMatrix
+
+auto coupling_matrix_init(PyObject* self, PyObject* args, PyObject* kwargs)
+    -> int
+{
+    return guarded(-1, [&] {
+        int       number_spins;
+        PyObject* couplings;
+        parse(args, kwargs, "iO", {"number_spins", "couplings"},
+            &number_spins, &couplings);
+        std::vector<double> xs;
+        for_each_item(couplings, "couplings must be a list of floats",
+            [&xs](PyObject* const x) {
+                xs.push_back(PyFloat_AsDouble(x));
+                if (PyErr_Occurred() != nullptr) { throw python_error{}; }
+            });
+        reinterpret_cast<Object<CouplingMatrix>*>(self)->value.emplace(
+            number_spins, std::move(xs));
+        return 0;
+    });
+}
+
+auto coupling_matrix_from_file(PyObject*, PyObject* args, PyObject* kwargs)
+    -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        char const* file_name;
+        parse(args, kwargs, "s", {"file_name"}, &file_name);
+        return wrap(coupling_matrix_type, read_couplings(file_name));
+    });
+}
+
+auto coupling_matrix_coupling(PyObject* self, PyObject* args, PyObject* kwargs)
+    -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        auto const& matrix = value_of<CouplingMatrix>(self);
+        int         i;
+        int         j;
+        parse(args, kwargs, "ii", {"i", "j"}, &i, &j);
+        auto const n = matrix.number_spins();
+        if (i < 0 || i >= n || j < 0 || j >= n) {
+            raise(PyExc_IndexError, "spin index out of range");
+        }
+        return PyFloat_FromDouble(matrix.coupling(i, j));
+    });
+}
+
+auto coupling_matrix_number_spins(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return PyLong_FromLong(value_of<CouplingMatrix>(self).number_spins());
+    });
+}
+
+auto coupling_matrix_number_edges(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return PyLong_FromSize_t(
+            value_of<CouplingMatrix>(self).number_edges());
+    });
+}
+
+// PolynomialFilter
+
+auto filter_init(PyObject* self, PyObject* args, PyObject* kwargs) -> int
+{
+    return guarded(-1, [&] {
+        PyObject*  kind   = nullptr;
+        Py_ssize_t degree = 1;
+        double     lower  = 0.0;
+        parse(args, kwargs, "|Ond", {"kind", "degree", "lower"}, &kind,
+            &degree, &lower);
+        PolynomialFilter filter;
+        if (kind != nullptr) {
+            filter.kind = to_enum<PolynomialFilter::Kind>(kind, kind_enum);
+        }
+        filter.degree = to_size(degree, "degree");
+        filter.lower  = lower;
+        reinterpret_cast<Object<PolynomialFilter>*>(self)->value.emplace(
+            filter);
+        return 0;
+    });
+}
+
+auto filter_get_kind(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return from_enum(value_of<PolynomialFilter>(self).kind, kind_enum);
+    });
+}
+
+auto filter_set_kind(PyObject* self, PyObject* value, void*) -> int
+{
+    return guarded(-1, [&] {
+        if (value == nullptr) { raise(PyExc_TypeError, "cannot delete kind"); }
+        value_of<PolynomialFilter>(self).kind =
+            to_enum<PolynomialFilter::Kind>(value, kind_enum);
+        return 0;
+    });
+}
+
+auto filter_get_degree(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return PyLong_FromSize_t(value_of<PolynomialFilter>(self).degree);
+    });
+}
+
+auto filter_set_degree(PyObject* self, PyObject* value, void*) -> int
+{
+    return guarded(-1, [&] {
+        if (value == nullptr) {
+            raise(PyExc_TypeError, "cannot delete degree");
+        }
+        auto const degree = PyLong_AsSsize_t(value);
+        if (degree == -1 && PyErr_Occurred() != nullptr) {
+            throw python_error{};
+        }
+        value_of<PolynomialFilter>(self).degree = to_size(degree, "degree");
+        return 0;
+    });
+}
+
+auto filter_get_lower(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return PyFloat_FromDouble(value_of<PolynomialFilter>(self).lower);
+    });
+}
+
+auto filter_set_lower(PyObject* self, PyObject* value, void*) -> int
+{
+    return guarded(-1, [&] {
+        if (value == nullptr) { raise(PyExc_TypeError, "cannot delete lower"); }
+        auto const lower = PyFloat_AsDouble(value);
+        if (PyErr_Occurred() != nullptr) { throw python_error{}; }
+        value_of<PolynomialFilter>(self).lower = lower;
+        return 0;
+    });
+}
+
+// QuantumState
+
+auto state_init(PyObject* self, PyObject* args, PyObject* kwargs) -> int
+{
+    return guarded(-1, [&] {
+        Py_ssize_t soft_max;
+        Py_ssize_t hard_max      = 0;
+        Py_ssize_t number_shards = 1;
+        parse(args, kwargs, "n|nn", {"soft_max", "hard_max", "number_shards"},
+            &soft_max, &hard_max, &number_shards);
+        reinterpret_cast<Object<QuantumState>*>(self)->value.emplace(
+            to_size(soft_max, "soft_max"), to_size(hard_max, "hard_max"),
+            to_size(number_shards, "number_shards"));
+        return 0;
+    });
+}
+
+template <bool Save>
+auto state_load_or_save(PyObject* self, PyObject* args, PyObject* kwargs)
+    -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        auto&       psi = value_of<QuantumState>(self);
+        char const* file_name;
+        int         binary = 0;
+        parse(args, kwargs, "s|p", {"file_name", "binary"}, &file_name,
+            &binary);
+        {
+            ReleaseGil const _;
+            if constexpr (Save) { save(psi, file_name, binary != 0); }
+            else {
+                load(psi, file_name, binary != 0);
+            }
+        }
+        Py_RETURN_NONE;
+    });
+}
+
+auto state_freeze(PyObject* self, PyObject*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        auto& psi = value_of<QuantumState>(self);
+        {
+            ReleaseGil const _;
+            psi.freeze();
+        }
+        Py_RETURN_NONE;
+    });
+}
+
+auto state_length(PyObject* self) -> Py_ssize_t
+{
+    return guarded<Py_ssize_t>(-1, [&] {
+        return static_cast<Py_ssize_t>(value_of<QuantumState>(self).size());
+    });
+}
+
+auto state_frozen(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return PyBool_FromLong(value_of<QuantumState>(self).sorted());
+    });
+}
+
+auto state_get_backend(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        return from_enum(value_of<QuantumState>(self).backend(), backend_enum);
+    });
+}
+
+auto state_set_backend(PyObject* self, PyObject* value, void*) -> int
+{
+    return guarded(-1, [&] {
+        if (value == nullptr) {
+            raise(PyExc_TypeError, "cannot delete backend");
+        }
+        auto&      psi     = value_of<QuantumState>(self);
+        auto const backend = to_enum<Backend>(value, backend_enum);
+        if (backend == Backend::dense) { make_dense(psi); }
+        else {
+            psi.backend(backend);
+        }
+        return 0;
+    });
+}
+
+/// Configurations of a frozen state as an n×14 array of bytes. Spin `i` is
+/// bit `7 - i % 8` of byte `i / 8`, so `numpy.unpackbits(spins, axis=1)`
+/// unpacks them.
+auto state_spins(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        auto const& psi = value_of<QuantumState>(self);
+        if (!psi.sorted()) {
+            throw_with_trace(std::runtime_error{
+                "Spins are only available for frozen states, call freeze() "
+                "first."});
+        }
+        auto const& keys = psi.keys();
+        auto const* data = keys.empty() ? nullptr : keys.front().data();
+        return view(self, NPY_UINT8, data,
+            {static_cast<npy_intp>(keys.size()), spin_bytes},
+            {static_cast<npy_intp>(sizeof(SpinVector)), 1});
+    });
+}
+
+/// Amplitudes of a frozen state (in the order of `spins`) or of a dense one
+/// (in the order of its basis).
+auto state_amplitudes(PyObject* self, void*) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        auto const& psi = value_of<QuantumState>(self);
+        if (!psi.sorted() && psi.basis() == nullptr) {
+            throw_with_trace(std::runtime_error{
+                "Amplitudes are only available for frozen or dense states, "
+                "call freeze() first."});
+        }
+        auto const& xs = psi.amplitudes();
+        return view(self, NPY_CDOUBLE, xs.data(),
+            {static_cast<npy_intp>(xs.size())},
+            {static_cast<npy_intp>(sizeof(std::complex<double>))});
+    });
+}
+
+// Functions
+
+auto py_energy(PyObject*, PyObject* args, PyObject* kwargs) -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        PyObject* hamiltonian;
+        PyObject* psi;
+        parse(args, kwargs, "OO!", {"hamiltonian", "psi"}, &hamiltonian,
+            state_type, &psi);
+        auto const e = visit_hamiltonian(hamiltonian, [psi](auto const& h) {
+            auto const&      state = value_of<QuantumState>(psi);
+            ReleaseGil const _;
+            return energy(Hamiltonian{h}, state);
+        });
+        return PyComplex_FromDoubles(e.real(), e.imag());
+    });
+}
+
+auto py_diffusion_loop(PyObject*, PyObject* args, PyObject* kwargs)
+    -> PyObject*
+{
+    return guarded<PyObject*>(nullptr, [&] {
+        double     lambda;
+        PyObject*  filter;
+        PyObject*  hamiltonian;
+        PyObject*  psi;
+        Py_ssize_t iterations;
+        parse(args, kwargs, "dO!OO!n",
+            {"lambda_", "filter", "hamiltonian", "psi", "iterations"},
+            &lambda, filter_type, &filter, &hamiltonian, state_type, &psi,
+            &iterations);
+        auto result = visit_hamiltonian(hamiltonian, [&](auto const& h) {
+            auto const& p     = value_of<PolynomialFilter>(filter);
+            auto&       state = value_of<QuantumState>(psi);
+            auto const  count = to_size(iterations, "iterations");
+            ReleaseGil const _;
+            state.max_growth(static_cast<double>(h.number_edges() + 1));
+            return diffusion_loop(lambda, p, Hamiltonian{h}, state, count);
+        });
+        return wrap(state_type, std::move(result));
+    });
+}
+
+/// PyMethodDef wants a PyCFunction even for functions taking keywords.
+template <class Function> auto method(Function* const fn) -> PyCFunction
+{
+    return reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(fn));
+}
+
+constexpr auto with_keywords = METH_VARARGS | METH_KEYWORDS;
+
+PyMethodDef heisenberg_methods[] = {
+    {"from_file", method(&heisenberg_from_file), with_keywords | METH_STATIC,
+        "from_file(file_name)\n--\n\nReads a Hamiltonian file."},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef heisenberg_getset[] = {
+    {"specs", &heisenberg_specs, nullptr,
+        "List of (coupling, [(i, j), ...]) pairs.", nullptr},
+    {"number_edges", &heisenberg_number_edges, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PyType_Slot heisenberg_slots[] = {
+    {Py_tp_new, reinterpret_cast<void*>(&new_object<Heisenberg>)},
+    {Py_tp_init, reinterpret_cast<void*>(&heisenberg_init)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&dealloc<Heisenberg>)},
+    {Py_tp_methods, heisenberg_methods},
+    {Py_tp_getset, heisenberg_getset},
+    {Py_tp_doc, const_cast<char*>(
+                    "Heisenberg(specs)\n--\n\nTakes a list of (coupling, "
+                    "[(i, j), ...]) pairs.")},
+    {0, nullptr}};
+
+PyMethodDef coupling_matrix_methods[] = {
+    {"from_file", method(&coupling_matrix_from_file),
+        with_keywords | METH_STATIC,
+        "from_file(file_name)\n--\n\nReads a binary coupling matrix."},
+    {"coupling", method(&coupling_matrix_coupling), with_keywords,
+        "coupling(i, j)\n--\n\n"},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef coupling_matrix_getset[] = {
+    {"number_spins", &coupling_matrix_number_spins, nullptr, nullptr,
+        nullptr},
+    {"number_edges", &coupling_matrix_number_edges, nullptr, nullptr,
+        nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PyType_Slot coupling_matrix_slots[] = {
+    {Py_tp_new, reinterpret_cast<void*>(&new_object<CouplingMatrix>)},
+    {Py_tp_init, reinterpret_cast<void*>(&coupling_matrix_init)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&dealloc<CouplingMatrix>)},
+    {Py_tp_methods, coupling_matrix_methods},
+    {Py_tp_getset, coupling_matrix_getset},
+    {Py_tp_doc,
+        const_cast<char*>("CouplingMatrix(number_spins, couplings)\n--\n\n"
+                          "Takes the n×n matrix of couplings as a flat "
+                          "row-major list.")},
+    {0, nullptr}};
+
+PyGetSetDef filter_getset[] = {
+    {"kind", &filter_get_kind, &filter_set_kind, nullptr, nullptr},
+    {"degree", &filter_get_degree, &filter_set_degree, nullptr, nullptr},
+    {"lower", &filter_get_lower, &filter_set_lower, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PyType_Slot filter_slots[] = {
+    {Py_tp_new, reinterpret_cast<void*>(&new_object<PolynomialFilter>)},
+    {Py_tp_init, reinterpret_cast<void*>(&filter_init)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&dealloc<PolynomialFilter>)},
+    {Py_tp_getset, filter_getset},
+    {Py_tp_doc, const_cast<char*>(
+                    "PolynomialFilter(kind=Kind.power, degree=1, lower=0.0)")},
+    {0, nullptr}};
+
+PyMethodDef state_methods[] = {
+    {"load", method(&state_load_or_save<false>), with_keywords,
+        "load(file_name, binary=False)\n--\n\n"},
+    {"save", method(&state_load_or_save<true>), with_keywords,
+        "save(file_name, binary=False)\n--\n\n"},
+    {"freeze", &state_freeze, METH_NOARGS, "freeze()\n--\n\n"},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef state_getset[] = {
+    {"frozen", &state_frozen, nullptr, nullptr, nullptr},
+    {"backend", &state_get_backend, &state_set_backend, nullptr, nullptr},
+    {"spins", &state_spins, nullptr, nullptr, nullptr},
+    {"amplitudes", &state_amplitudes, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PyType_Slot state_slots[] = {
+    {Py_tp_new, reinterpret_cast<void*>(&new_object<QuantumState>)},
+    {Py_tp_init, reinterpret_cast<void*>(&state_init)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&dealloc<QuantumState>)},
+    {Py_tp_methods, state_methods},
+    {Py_tp_getset, state_getset},
+    {Py_mp_length, reinterpret_cast<void*>(&state_length)},
+    {Py_tp_doc,
+        const_cast<char*>("QuantumState(soft_max, hard_max=0, "
+                          "number_shards=1)")},
+    {0, nullptr}};
+
+template <class T>
+auto make_type(char const* const name, PyType_Slot* const slots)
+    -> PyTypeObject*
+{
+    PyType_Spec spec{name, static_cast<int>(sizeof(Object<T>)), 0,
+        Py_TPFLAGS_DEFAULT, slots};
+    return reinterpret_cast<PyTypeObject*>(check(PyType_FromSpec(&spec)));
+}
+
+PyMethodDef module_methods[] = {
+    {"energy", method(&py_energy), with_keywords,
+        "energy(hamiltonian, psi)\n--\n\nReturns 〈ψ|H|ψ〉."},
+    {"diffusion_loop", method(&py_diffusion_loop), with_keywords,
+        "diffusion_loop(lambda_, filter, hamiltonian, psi, iterations)\n--\n\n"
+        "Returns P(H)ⁿ|ψ〉 truncated after every application of P."},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyModuleDef module_def = {PyModuleDef_HEAD_INIT, "lanczos", nullptr, -1,
+    module_methods, nullptr, nullptr, nullptr, nullptr};
+
+/// Adds `object` to `module` under `name`, stealing the reference.
+auto add(PyObject* const module, char const* const name, PyObject* object)
+    -> void
+{
+    if (PyModule_AddObject(module, name, object) < 0) {
+        Py_DECREF(object);
+        throw python_error{};
+    }
+}
+} // namespace
+
+PyMODINIT_FUNC PyInit_lanczos();
+
+PyMODINIT_FUNC PyInit_lanczos()
+{
+    import_array();
+    return guarded<PyObject*>(nullptr, [] {
+        Ref module{PyModule_Create(&module_def)};
+        heisenberg_type =
+            make_type<Heisenberg>("lanczos.Heisenberg", heisenberg_slots);
+        coupling_matrix_type = make_type<CouplingMatrix>(
+            "lanczos.CouplingMatrix", coupling_matrix_slots);
+        filter_type = make_type<PolynomialFilter>(
+            "lanczos.PolynomialFilter", filter_slots);
+        state_type =
+            make_type<QuantumState>("lanczos.QuantumState", state_slots);
+        kind_enum = make_enum("Kind", "PolynomialFilter.Kind",
+            {{"power", static_cast<int>(PolynomialFilter::Kind::power)},
+                {"chebyshev",
+                    static_cast<int>(PolynomialFilter::Kind::chebyshev)}});
+        backend_enum = make_enum("Backend", "Backend",
+            {{"hash", static_cast<int>(Backend::hash)},
+                {"sort", static_cast<int>(Backend::sort)},
+                {"dense", static_cast<int>(Backend::dense)}});
+        if (PyObject_SetAttrString(reinterpret_cast<PyObject*>(filter_type),
+                "Kind", kind_enum)
+            < 0) {
+            throw python_error{};
+        }
+        // The module keeps its own references, the globals borrow them.
+        for (auto const& [name, object] :
+            {std::pair{"Heisenberg",
+                 reinterpret_cast<PyObject*>(heisenberg_type)},
+                std::pair{"CouplingMatrix",
+                    reinterpret_cast<PyObject*>(coupling_matrix_type)},
+                std::pair{"PolynomialFilter",
+                    reinterpret_cast<PyObject*>(filter_type)},
+                std::pair{"QuantumState",
+                    reinterpret_cast<PyObject*>(state_type)},
+                std::pair{"Backend", backend_enum}}) {
+            add(module.get(), name, object);
+        }
+        Py_DECREF(kind_enum);
+        return module.release();
+    });
+}
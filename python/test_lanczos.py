@@ -0,0 +1,37 @@
+import sys
+
+import numpy as np
+
+import lanczos
+
+# Same parameters as the dense_kagome_12 test, whose exact ground state
+# energy is -21.7795.
+hamiltonian = lanczos.Heisenberg.from_file(sys.argv[2])
+psi = lanczos.QuantumState(1000)
+psi.load(sys.argv[1])
+psi.backend = lanczos.Backend.dense
+chebyshev = lanczos.PolynomialFilter(
+    lanczos.PolynomialFilter.Kind.chebyshev, degree=10, lower=-15)
+psi = lanczos.diffusion_loop(30.0, chebyshev, hamiltonian, psi, 20)
+assert abs(lanczos.energy(hamiltonian, psi).real + 21.7795) < 1e-4
+
+# The same operator as a coupling matrix.
+n = 12
+couplings = [0.0] * (n * n)
+for coupling, edges in hamiltonian.specs:
+    for i, j in edges:
+        couplings[i * n + j] += coupling.real
+        couplings[j * n + i] += coupling.real
+matrix = lanczos.CouplingMatrix(n, couplings)
+assert matrix.number_spins == n
+expected = lanczos.energy(hamiltonian, psi)
+assert abs(lanczos.energy(matrix, psi) - expected) < 1e-10
+
+# Arrays of a frozen state refer to its memory.
+psi = lanczos.QuantumState(1000)
+psi.load(sys.argv[1])
+psi.freeze()
+spins, amplitudes = psi.spins, psi.amplitudes
+assert spins.shape == (len(psi), 14) and amplitudes.shape == (len(psi),)
+assert not amplitudes.flags.owndata and not amplitudes.flags.writeable
+assert np.all(np.unpackbits(spins, axis=1)[:, :12].sum(axis=1) == 6)
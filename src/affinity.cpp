@@ -0,0 +1,127 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "affinity.hpp"
+#include "config.hpp"
+#include <map>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(TCM_HAS_NUMA)
+#include <numa.h>
+#endif
+
+namespace {
+auto node_of_cpu(int const cpu) noexcept -> int
+{
+#if defined(TCM_HAS_NUMA)
+    if (numa_available() >= 0) {
+        auto const node = numa_node_of_cpu(cpu);
+        if (node >= 0) { return node; }
+    }
+#else
+    static_cast<void>(cpu);
+#endif
+    return 0;
+}
+} // namespace
+
+auto Placement::spread(std::size_t const number_shards) -> Placement
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        throw_with_trace(
+            std::runtime_error{"Failed to query the CPU affinity mask."});
+    }
+
+    // node -> cores of that node we may use
+    std::map<int, std::vector<int>> cores;
+    for (std::size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            auto const id = static_cast<int>(cpu);
+            cores[node_of_cpu(id)].push_back(id);
+        }
+    }
+    TCM_ASSERT(!cores.empty());
+
+    std::vector<std::vector<int> const*> nodes;
+    std::vector<int>                     node_ids;
+    for (auto const& [node, cpus] : cores) {
+        node_ids.push_back(node);
+        nodes.push_back(std::addressof(cpus));
+    }
+
+    Placement placement;
+    placement._cpus.reserve(number_shards);
+    placement._nodes.reserve(number_shards);
+    std::vector<std::size_t> next(nodes.size(), 0);
+    for (std::size_t i = 0; i < number_shards; ++i) {
+        auto const  n    = i * nodes.size() / number_shards;
+        auto const& cpus = *nodes[n];
+        placement._cpus.push_back(cpus[next[n]++ % cpus.size()]);
+        placement._nodes.push_back(node_ids[n]);
+    }
+    return placement;
+}
+
+auto pin_current_thread(int const cpu, int const node) noexcept -> bool
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    TCM_ASSERT(cpu >= 0);
+    CPU_SET(static_cast<std::size_t>(cpu), &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+#if defined(TCM_HAS_NUMA)
+    if (numa_available() >= 0) { numa_set_preferred(node); }
+#else
+    static_cast<void>(node);
+#endif
+    return true;
+}
+
+auto unpin_current_thread() noexcept -> bool
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(getpid(), sizeof(set), &set) != 0) { return false; }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+#if defined(TCM_HAS_NUMA)
+    if (numa_available() >= 0) { numa_set_localalloc(); }
+#endif
+    return true;
+}
@@ -0,0 +1,357 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "block.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+BlockState::BlockState(std::size_t const block_size,
+    std::size_t const soft_max, std::size_t const number_shards)
+    : _block_size{block_size}, _soft_max_size{soft_max}, _shards(number_shards)
+{
+    TCM_ASSERT(block_size > 0);
+    TCM_ASSERT(number_shards > 0 && (number_shards & (number_shards - 1)) == 0);
+}
+
+auto BlockState::from_columns(std::vector<QuantumState> const& columns)
+    -> BlockState
+{
+    if (columns.empty()) {
+        throw_with_trace(std::runtime_error{"Block must not be empty."});
+    }
+    BlockState block{columns.size(), columns.front().soft_max(),
+        columns.front().number_workers()};
+    block.reserve(columns.front().size());
+    for (std::size_t j = 0; j < columns.size(); ++j) {
+        columns[j].for_each(
+            [&block, j](auto const& x) { block.row(x.first)[j] = x.second; });
+    }
+    return block;
+}
+
+auto BlockState::column(std::size_t const j) const -> QuantumState
+{
+    TCM_ASSERT(j < _block_size);
+    QuantumState psi{_soft_max_size, size(), number_shards()};
+    for_each([&psi, j](auto const& spin, auto const* row) {
+        if (row[j] != 0.0) { psi.insert({spin, row[j]}); }
+    });
+    return psi;
+}
+
+auto BlockState::size() const noexcept -> std::size_t
+{
+    return std::accumulate(std::begin(_shards), std::end(_shards), 0ul,
+        [](auto const acc, auto const& x) { return acc + x.keys.size(); });
+}
+
+auto BlockState::row(SpinVector const& spin) -> std::complex<double>*
+{
+    auto& shard = _shards[spin_to_index(spin, _shards.size())];
+    auto const [where, inserted] =
+        shard.index.insert({spin, shard.keys.size()});
+    if (inserted) {
+        shard.keys.push_back(spin);
+        shard.amplitudes.resize(shard.amplitudes.size() + _block_size);
+    }
+    return shard.amplitudes.data() + where->second * _block_size;
+}
+
+auto BlockState::find(SpinVector const& spin) const
+    -> std::complex<double> const*
+{
+    auto const& shard = _shards[spin_to_index(spin, _shards.size())];
+    auto const  where = shard.index.find(spin);
+    if (where == shard.index.end()) { return nullptr; }
+    return shard.amplitudes.data() + where->second * _block_size;
+}
+
+auto BlockState::reserve(std::size_t const count) -> void
+{
+    auto const per_shard = (count + _shards.size() - 1) / _shards.size();
+    for (auto& shard : _shards) {
+        shard.index.reserve(per_shard);
+        shard.keys.reserve(per_shard);
+        shard.amplitudes.reserve(per_shard * _block_size);
+    }
+}
+
+auto BlockState::empty_successor() const -> BlockState
+{
+    return BlockState{_block_size, _soft_max_size, number_shards()};
+}
+
+auto BlockState::squared_norms() const -> std::vector<double>
+{
+    std::vector<double> norms(_block_size, 0.0);
+    for_each([this, &norms](auto const&, auto const* row) {
+        for (std::size_t j = 0; j < _block_size; ++j) {
+            norms[j] += std::norm(row[j]);
+        }
+    });
+    return norms;
+}
+
+auto BlockState::dot(std::size_t const i, std::size_t const j) const
+    -> std::complex<double>
+{
+    std::complex<double> sum = 0.0;
+    for_each([&sum, i, j](auto const&, auto const* row) {
+        sum += std::conj(row[i]) * row[j];
+    });
+    return sum;
+}
+
+auto BlockState::axpy(std::complex<double> const scale, std::size_t const i,
+    std::size_t const j) -> void
+{
+    for (auto& shard : _shards) {
+        for (std::size_t r = 0; r < shard.keys.size(); ++r) {
+            auto* row = shard.amplitudes.data() + r * _block_size;
+            if (i == j) { row[j] *= scale; }
+            else {
+                row[j] += scale * row[i];
+            }
+        }
+    }
+}
+
+auto BlockState::normalize() -> BlockState&
+{
+    auto const norms = squared_norms();
+    for (std::size_t j = 0; j < _block_size; ++j) {
+        axpy(1.0 / std::sqrt(norms[j]), j, j);
+    }
+    return *this;
+}
+
+auto BlockState::orthonormalize() -> BlockState&
+{
+    for (std::size_t j = 0; j < _block_size; ++j) {
+        auto const before = dot(j, j).real();
+        for (std::size_t i = 0; i < j; ++i) {
+            axpy(-dot(i, j), i, j);
+        }
+        auto const norm = dot(j, j).real();
+        if (!(norm > 1e-24 * before)) {
+            throw_with_trace(std::runtime_error{
+                "Gram-Schmidt: states of the block are linearly dependent."});
+        }
+        axpy(1.0 / std::sqrt(norm), j, j);
+    }
+    return *this;
+}
+
+auto BlockState::shrink() -> double
+{
+    auto const rows = size();
+    if (rows <= _soft_max_size) { return 0.0; }
+    auto const count = rows - _soft_max_size;
+
+    std::vector<std::vector<double>> weights(_shards.size());
+    std::vector<double>              all;
+    all.reserve(rows);
+    for (std::size_t i = 0; i < _shards.size(); ++i) {
+        auto const& shard = _shards[i];
+        for (std::size_t r = 0; r < shard.keys.size(); ++r) {
+            auto const* row    = shard.amplitudes.data() + r * _block_size;
+            auto const  weight = std::accumulate(row, row + _block_size, 0.0,
+                [](auto const acc, auto const x) {
+                    return acc + std::norm(x);
+                });
+            weights[i].push_back(weight);
+            all.push_back(weight);
+        }
+    }
+    auto const nth = std::begin(all) + static_cast<std::ptrdiff_t>(count - 1);
+    std::nth_element(std::begin(all), nth, std::end(all));
+    auto const threshold = all[count - 1];
+    auto       ties      = count
+                    - static_cast<std::size_t>(std::count_if(std::begin(all),
+                        std::end(all),
+                        [threshold](auto const x) { return x < threshold; }));
+
+    // Rows are compacted within their shard and the index is rebuilt.
+    double discarded = 0.0;
+    for (std::size_t i = 0; i < _shards.size(); ++i) {
+        auto&       shard = _shards[i];
+        std::size_t kept  = 0;
+        for (std::size_t r = 0; r < shard.keys.size(); ++r) {
+            auto const weight = weights[i][r];
+            if (weight < threshold || (weight == threshold && ties > 0)) {
+                if (weight == threshold) { --ties; }
+                discarded += weight;
+                continue;
+            }
+            shard.keys[kept] = shard.keys[r];
+            std::copy_n(shard.amplitudes.data() + r * _block_size, _block_size,
+                shard.amplitudes.data() + kept * _block_size);
+            ++kept;
+        }
+        shard.keys.resize(kept);
+        shard.amplitudes.resize(kept * _block_size);
+        shard.index.clear();
+        for (std::size_t r = 0; r < kept; ++r) {
+            shard.index.insert({shard.keys[r], r});
+        }
+    }
+    return discarded;
+}
+
+namespace {
+/// Contribution `coeff·source` to the row of `spin`, where `source` is a row
+/// of the block H is applied to.
+struct Contribution {
+    SpinVector                  spin;
+    std::complex<double>        coeff;
+    std::complex<double> const* source;
+};
+
+/// Returns α·H|x〉+ β|x〉+ γ|y〉.
+///
+/// Producer p enumerates H|σ〉for the rows σ of shard p of `x` once and
+/// buckets the contributions by the shard they belong to. Then every shard of
+/// the result is assembled by its own thread, which looks up each contributed
+/// configuration once and updates all k amplitudes of its row.
+auto apply(Hamiltonian const& hamiltonian, std::complex<double> const alpha,
+    std::complex<double> const beta, BlockState const& x,
+    std::complex<double> const gamma, BlockState const* y) -> BlockState
+{
+    auto const n = x.number_shards();
+    auto const k = x.block_size();
+    TCM_ASSERT(
+        y == nullptr || (y->number_shards() == n && y->block_size() == k));
+    std::vector<std::vector<std::vector<Contribution>>> buckets(
+        n, std::vector<std::vector<Contribution>>(n));
+    parallel_for(n, [&](auto const producer) {
+        auto& out = buckets[producer];
+        auto const push = [&out, n](SpinVector const& spin,
+                              std::complex<double> const coeff,
+                              std::complex<double> const* source) {
+            out[spin_to_index(spin, n)].push_back({spin, coeff, source});
+        };
+        std::vector<QuantumState::value_type> buffer;
+        QuantumStateBuilder                   builder{buffer};
+        x.for_each_in_shard(producer, [&](auto const& spin, auto const* row) {
+            buffer.clear();
+            hamiltonian(spin, alpha, builder);
+            for (auto const& [other, coeff] : buffer) {
+                push(other, coeff, row);
+            }
+            push(spin, beta, row);
+        });
+        if (y != nullptr) {
+            y->for_each_in_shard(
+                producer, [&](auto const& spin, auto const* row) {
+                    push(spin, gamma, row);
+                });
+        }
+    });
+
+    auto out = x.empty_successor();
+    out.reserve(x.size());
+    // Rows of different shards live in different tables, so the threads never
+    // touch the same data.
+    parallel_for(n, [&](auto const shard) {
+        for (auto const& producer : buckets) {
+            for (auto const& c : producer[shard]) {
+                auto* row = out.row(c.spin);
+                for (std::size_t j = 0; j < k; ++j) {
+                    row[j] += c.coeff * c.source[j];
+                }
+            }
+        }
+    });
+    return out;
+}
+} // namespace
+
+auto diffusion_step(double const lambda, Hamiltonian const& hamiltonian,
+    BlockState const& psi) -> BlockState
+{
+    auto h_psi = apply(hamiltonian, -1.0, lambda, psi, 0.0, nullptr);
+    h_psi.normalize();
+    return h_psi;
+}
+
+auto energies(Hamiltonian const& hamiltonian, BlockState const& psi)
+    -> std::vector<std::complex<double>>
+{
+    auto const h_psi = apply(hamiltonian, 1.0, 0.0, psi, 0.0, nullptr);
+    std::vector<std::complex<double>> result(psi.block_size(), 0.0);
+    psi.for_each([&h_psi, &result](auto const& spin, auto const* row) {
+        auto const* h_row = h_psi.find(spin);
+        if (h_row == nullptr) { return; }
+        for (std::size_t j = 0; j < result.size(); ++j) {
+            result[j] += std::conj(row[j]) * h_row[j];
+        }
+    });
+    return result;
+}
+
+auto diffusion_loop(double const lambda, PolynomialFilter const& filter,
+    Hamiltonian const& hamiltonian, BlockState const& psi,
+    std::size_t const iterations, bool const orthogonalize) -> BlockState
+{
+    if (iterations == 0) {
+        throw_with_trace(
+            std::runtime_error{"Number of iterations must be positive!"});
+    }
+    auto const step = [lambda, &filter, &hamiltonian](BlockState const& x) {
+        return evaluate_filter(lambda, filter, x,
+            [&hamiltonian](auto const alpha, auto const beta,
+                BlockState const& v, auto const gamma, BlockState const* w) {
+                return apply(hamiltonian, alpha, beta, v, gamma, w);
+            });
+    };
+    auto const finish = [orthogonalize](BlockState& x) {
+        if (orthogonalize) { x.orthonormalize(); }
+        else {
+            x.normalize();
+        }
+    };
+
+    std::cerr << "[1/" << iterations << "]";
+    auto state = step(psi);
+    finish(state);
+    for (auto i = 1ul; i < iterations; ++i) {
+        std::cerr << "\r[" << (i + 1) << "/" << iterations << "]";
+        state = step(state);
+        state.shrink();
+        finish(state);
+    }
+    std::cerr << std::endl;
+    return state;
+}
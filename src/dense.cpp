@@ -0,0 +1,233 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "dense.hpp"
+#include "parallel.hpp"
+#include "quantum_state.hpp"
+#include <algorithm>
+#include <thread>
+
+DenseBasis::DenseBasis(int const number_spins, std::optional<int> number_up)
+    : _number_spins{number_spins}
+    , _number_up{number_up}
+    , _low_bits{0}
+    , _states{}
+    , _low{}
+    , _high{}
+{
+    if (number_spins <= 0 || number_spins >= 64) {
+        throw_with_trace(std::runtime_error{
+            "Dense basis: number of spins must be between 1 and 63."});
+    }
+    if (!number_up.has_value()) { return; }
+    if (*number_up < 0 || *number_up > number_spins) {
+        throw_with_trace(std::runtime_error{
+            "Dense basis: invalid number of spins up."});
+    }
+
+    // Lower halves of the configurations grouped by the number of spins up,
+    // in increasing order.
+    _low_bits            = number_spins / 2;
+    auto const high_bits = number_spins - _low_bits;
+    std::vector<std::vector<std::uint64_t>> lows(
+        static_cast<std::size_t>(_low_bits) + 1);
+    _low.resize(std::size_t{1} << _low_bits);
+    for (std::uint64_t l = 0; l < _low.size(); ++l) {
+        auto& group = lows[static_cast<std::size_t>(__builtin_popcountll(l))];
+        _low[l]     = group.size();
+        group.push_back(l);
+    }
+    _states.reserve(dimension(number_spins, number_up));
+    _high.resize(std::size_t{1} << high_bits);
+    for (std::uint64_t h = 0; h < _high.size(); ++h) {
+        _high[h]     = _states.size();
+        auto const r = *number_up - __builtin_popcountll(h);
+        if (r < 0 || r > _low_bits) { continue; }
+        for (auto const l : lows[static_cast<std::size_t>(r)]) {
+            _states.push_back((h << _low_bits) | l);
+        }
+    }
+    TCM_ASSERT(_states.size() == dimension(number_spins, number_up));
+}
+
+auto DenseBasis::dimension(
+    int const number_spins, std::optional<int> const number_up) -> std::size_t
+{
+    TCM_ASSERT(number_spins > 0);
+    if (!number_up.has_value()) {
+        return number_spins < 64 ? std::size_t{1} << number_spins
+                                 : std::numeric_limits<std::size_t>::max();
+    }
+    TCM_ASSERT(0 <= *number_up && *number_up <= number_spins);
+    auto const k = std::min(*number_up, number_spins - *number_up);
+    // The intermediate product of C(63, 31) overflows 64 bits.
+    __extension__ using wide = unsigned __int128;
+    wide binomial = 1;
+    for (auto i = 1; i <= k; ++i) {
+        binomial = binomial * static_cast<unsigned>(number_spins - k + i)
+                   / static_cast<unsigned>(i);
+    }
+    return static_cast<std::size_t>(binomial);
+}
+
+auto DenseBasis::find(SpinVector const& spin) const noexcept -> std::size_t
+{
+    if (spin.size() != _number_spins) { return npos; }
+    auto const x = spin.bits();
+    if (_number_up.has_value() && __builtin_popcountll(x) != *_number_up) {
+        return npos;
+    }
+    return index(x);
+}
+
+auto smallest_basis(QuantumState const& psi)
+    -> std::optional<std::pair<int, std::optional<int>>>
+{
+    auto number_spins = -1;
+    auto number_up    = std::optional<int>{};
+    auto consistent   = true;
+    auto first        = true;
+    psi.for_each([&](auto const& x) {
+        auto const& spin = x.first;
+        if (first) {
+            number_spins = spin.size();
+            if (number_spins > 0 && number_spins < 64) {
+                number_up = __builtin_popcountll(spin.bits());
+            }
+            first = false;
+        }
+        else if (spin.size() != number_spins) {
+            consistent = false;
+        }
+        else if (number_up.has_value()
+                 && __builtin_popcountll(spin.bits()) != *number_up) {
+            number_up = std::nullopt;
+        }
+    });
+    if (first || !consistent || number_spins <= 0 || number_spins >= 64) {
+        return std::nullopt;
+    }
+    return std::pair{number_spins, number_up};
+}
+
+auto dense_footprint(std::size_t const dimension, bool const averaging) noexcept
+    -> std::size_t
+{
+    auto const vectors = averaging ? 7u : 5u;
+    return dimension
+           * (vectors * sizeof(std::complex<double>) + sizeof(std::uint64_t));
+}
+
+namespace {
+/// Returns the terms of `hamiltonian`: edge (i, j) as a mask with the bits
+/// of spins i and j set, and its coupling.
+auto dense_terms(Hamiltonian const& hamiltonian, int const number_spins)
+    -> std::vector<std::pair<std::uint64_t, std::complex<double>>>
+{
+    auto const bit = [number_spins](auto const k) {
+        return std::uint64_t{1} << (number_spins - 1 - k);
+    };
+    std::vector<std::pair<std::uint64_t, std::complex<double>>> terms;
+    if (auto const* heisenberg = hamiltonian.target<Heisenberg>()) {
+        for (auto const& [coupling, edges] : heisenberg->specs()) {
+            for (auto const& [i, j] : edges) {
+                if (i < 0 || j < 0 || i >= number_spins
+                    || j >= number_spins) {
+                    throw_with_trace(std::runtime_error{
+                        "Edge of the Hamiltonian is out of range."});
+                }
+                terms.emplace_back(bit(i) | bit(j), coupling);
+            }
+        }
+        return terms;
+    }
+    if (auto const* matrix = hamiltonian.target<CouplingMatrix>()) {
+        if (matrix->number_spins() != number_spins) {
+            throw_with_trace(std::runtime_error{
+                "Coupling matrix does not match the number of spins."});
+        }
+        for (auto i = 0; i < number_spins; ++i) {
+            for (auto j = i + 1; j < number_spins; ++j) {
+                auto const coupling = matrix->coupling(i, j);
+                if (coupling != 0.0) {
+                    terms.emplace_back(bit(i) | bit(j), coupling);
+                }
+            }
+        }
+        return terms;
+    }
+    throw_with_trace(std::runtime_error{"Backend::dense requires a Heisenberg "
+                                        "Hamiltonian or a coupling matrix."});
+}
+} // namespace
+
+auto apply_dense(Hamiltonian const& hamiltonian,
+    std::complex<double> const alpha, std::complex<double> const beta,
+    QuantumState const& x, std::complex<double> const gamma,
+    QuantumState const* y) -> QuantumState
+{
+    TCM_ASSERT(x.basis() != nullptr);
+    TCM_ASSERT(y == nullptr || y->basis() == x.basis());
+    auto const& basis = *x.basis();
+    auto const  terms = dense_terms(hamiltonian, basis.number_spins());
+
+    auto        out = x.empty_successor();
+    auto&       ys  = out.amplitudes();
+    auto const& xs  = x.amplitudes();
+    auto const* zs  = y != nullptr ? std::addressof(y->amplitudes()) : nullptr;
+    // H is symmetric, so 〈σ|H|x〉 is gathered from the configurations which
+    // H connects to σ. Every thread writes a separate range of `ys`.
+    auto const size   = basis.size();
+    auto const chunks = std::max(1u, std::thread::hardware_concurrency());
+    parallel_for(chunks, [&](auto const chunk) {
+        auto const first = size * chunk / chunks;
+        auto const last  = size * (chunk + 1) / chunks;
+        for (auto k = first; k < last; ++k) {
+            auto const           s            = basis.bits(k);
+            std::complex<double> diagonal     = 0.0;
+            std::complex<double> off_diagonal = 0.0;
+            for (auto const& [mask, coupling] : terms) {
+                auto const t = s & mask;
+                if (t == 0 || t == mask) { diagonal += coupling; }
+                else {
+                    diagonal -= coupling;
+                    off_diagonal += coupling * xs[basis.index(s ^ mask)];
+                }
+            }
+            auto value =
+                alpha * (diagonal * xs[k] + 2.0 * off_diagonal) + beta * xs[k];
+            if (zs != nullptr) { value += gamma * (*zs)[k]; }
+            ys[k] = value;
+        }
+    });
+    return out;
+}
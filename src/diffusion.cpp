@@ -30,40 +30,442 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "diffusion.hpp"
+#include "dense.hpp"
+#include "metrics.hpp"
+#include "parallel.hpp"
 #include "quantum_state.hpp"
+#include "sort_merge.hpp"
+#include "trace.hpp"
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace {
+/// Returns the screening for the producer `stream` of an accumulation into
+/// `out`. Screening is only used if the result is truncated right away.
+auto make_screening(QuantumState const& x, QuantumState const& out,
+    std::size_t const keep, std::size_t const stream) -> Screening
+{
+    if (keep == 0) { return Screening{}; }
+    std::seed_seq seed{static_cast<std::uint32_t>(out.seed()),
+        static_cast<std::uint32_t>(out.seed() >> 32),
+        static_cast<std::uint32_t>(out.generation()),
+        static_cast<std::uint32_t>(stream), 0x5c5eu};
+    std::uint32_t words[2];
+    seed.generate(std::begin(words), std::end(words));
+    return Screening{x.screening_threshold(),
+        x.truncation() == Truncation::stochastic,
+        (std::uint64_t{words[0]} << 32) | words[1]};
+}
+
+/// Formats a number of bytes for the progress output, e.g. "1.5 GiB".
+auto format_bytes(std::size_t const bytes) -> std::string
+{
+    constexpr char const* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    auto        value = static_cast<double>(bytes);
+    std::size_t unit  = 0;
+    while (value >= 1024.0 && unit + 1 < std::size(units)) {
+        value /= 1024.0;
+        ++unit;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << value << ' ' << units[unit];
+    return out.str();
+}
+
+/// \brief Generates α·H|σ〉+ β|σ〉for the elements it is given.
+///
+/// If the Hamiltonian is a Heisenberg, elements are collected into batches
+/// for its batched overload, which is much faster than calling it on every
+/// configuration separately. Without `with_diagonal`, only the off-diagonal
+/// part of α·H|σ〉is generated, because the workers add the rest from the
+/// diagonal cache (see `QuantumStateBuilder::diagonal_from`). `flush` must
+/// be called at the end.
+class Generator {
+    using value_type = QuantumState::value_type;
+
+    Hamiltonian const&   _hamiltonian;
+    Heisenberg const*    _heisenberg;
+    std::complex<double> _alpha;
+    std::complex<double> _beta;
+    QuantumStateBuilder& _builder;
+    bool                 _with_diagonal;
+    std::size_t          _count;
+    SpinVector           _spins[Heisenberg::batch_size];
+    std::complex<double> _coeffs[Heisenberg::batch_size];
+
+  public:
+    Generator(Hamiltonian const& hamiltonian, std::complex<double> const alpha,
+        std::complex<double> const beta, QuantumStateBuilder& builder,
+        bool const with_diagonal = true)
+        : _hamiltonian{hamiltonian}
+        , _heisenberg{hamiltonian.target<Heisenberg>()}
+        , _alpha{alpha}
+        , _beta{beta}
+        , _builder{builder}
+        , _with_diagonal{with_diagonal}
+        , _count{0}
+    {
+        TCM_ASSERT(with_diagonal || _heisenberg != nullptr);
+    }
+
+    auto operator()(value_type const& element) -> void
+    {
+        auto const [spin, coeff] = element;
+        if (_heisenberg == nullptr) {
+            _hamiltonian(spin, _alpha * coeff, _builder);
+            _builder += {_beta * coeff, spin};
+            return;
+        }
+        _spins[_count]  = spin;
+        _coeffs[_count] = coeff;
+        if (++_count == Heisenberg::batch_size) { flush(); }
+    }
+
+    auto flush() -> void
+    {
+        if (_count == 0) { return; }
+        std::complex<double> scaled[Heisenberg::batch_size];
+        for (std::size_t i = 0; i < _count; ++i) {
+            scaled[i] = _alpha * _coeffs[i];
+        }
+        (*_heisenberg)(_spins, scaled, _count, _builder, _with_diagonal);
+        if (_with_diagonal) {
+            for (std::size_t i = 0; i < _count; ++i) {
+                _builder += {_beta * _coeffs[i], _spins[i]};
+            }
+        }
+        _count = 0;
+    }
+};
+
+/// Implementation of `apply` for Backend::sort. There is one producer per
+/// shard of `x` and producer i traverses shard i of both `x` and `y`.
+/// `held` bytes of other states, including `y`, stay alive meanwhile.
+auto apply_sorted(IterationMetrics* metrics, Hamiltonian const& hamiltonian,
+    std::complex<double> const alpha, std::complex<double> const beta,
+    QuantumState const& x, std::complex<double> const gamma,
+    QuantumState const* y, std::size_t const keep, std::size_t const held)
+    -> QuantumState
+{
+    using value_type            = QuantumState::value_type;
+    auto const number_producers = x.number_workers();
+    auto       out              = x.empty_successor();
+    // Every producer holds up to three buffers: the one being filled, the one
+    // being written to disk, and the scratch space of the radix sort. They
+    // share the memory limit with the states which are read.
+    auto const used = x.memory_usage() + held;
+    auto const capacity =
+        out.memory_limit() > used
+            ? (out.memory_limit() - used)
+                  / (3 * number_producers * sizeof(value_type))
+            : 0;
+    if (out.memory_limit() != 0 && capacity == 0) {
+        throw_with_trace(
+            std::runtime_error{"Memory limit is too small to hold a buffer."});
+    }
+    std::vector<RunCollector> collectors;
+    collectors.reserve(number_producers);
+    for (std::size_t i = 0; i < number_producers; ++i) {
+        collectors.emplace_back(capacity, out.number_workers());
+    }
+
+    Stopwatch stopwatch;
+    parallel_for(number_producers, [&](auto const producer) {
+        TCM_TRACE_SCOPE("produce");
+        auto& collector = collectors[producer];
+        if (capacity == 0) {
+            collector.buffer().reserve(x.next_capacity() / number_producers);
+        }
+        QuantumStateBuilder builder{collector.buffer()};
+        builder.screening(make_screening(x, out, keep, producer));
+        Generator generate{hamiltonian, alpha, beta, builder};
+        x.for_each_in_shard(producer, [&](auto const& element) {
+            generate(element);
+            collector.poll();
+        });
+        generate.flush();
+        if (y != nullptr) {
+            y->for_each_in_shard(producer, [&](auto const& element) {
+                builder += {gamma * element.second, element.first};
+                collector.poll();
+            });
+        }
+        collector.finish();
+    });
+    if (metrics != nullptr) { metrics->apply_time += stopwatch.lap(); }
+
+    std::vector<std::vector<value_type>> runs;
+    std::vector<SpilledRun>              spilled;
+    auto                                 buffered = used;
+    for (auto& collector : collectors) {
+        buffered += collector.run().capacity() * sizeof(value_type);
+        if (metrics != nullptr) {
+            metrics->generated += collector.generated();
+            for (auto const& run : collector.spilled()) {
+                metrics->spilled_bytes += run.bytes();
+            }
+        }
+        runs.push_back(std::move(collector.run()));
+        std::move(std::begin(collector.spilled()),
+            std::end(collector.spilled()), std::back_inserter(spilled));
+    }
+    collectors.clear();
+    // Only the deterministic truncation can be done while merging.
+    std::size_t unique;
+    {
+        TCM_TRACE_SCOPE("merge");
+        unique = merge_runs(runs, out, spilled,
+            x.truncation() == Truncation::largest ? keep : 0);
+    }
+    out.observe_growth(x);
+    if (metrics != nullptr) {
+        metrics->drain_time += stopwatch.lap();
+        metrics->unique = unique;
+        metrics->shards.clear();
+        metrics->record_memory(
+            std::max(buffered, used + out.memory_usage()));
+    }
+    return out;
+}
+
+/// Returns α·H|x〉+ β|x〉+ γ|y〉.
+///
+/// If `keep` is not 0, the caller is going to truncate the result to `keep`
+/// elements anyway, so the backend may do it earlier if that saves memory.
+/// `last` tells that the caller is going to normalise the result. `held` is
+/// the memory of other states besides `x` and `y` which stay alive meanwhile,
+/// it counts against the memory limit.
+auto apply(IterationMetrics* metrics, Hamiltonian const& hamiltonian,
+    std::complex<double> const alpha, std::complex<double> const beta,
+    QuantumState const& x, std::complex<double> const gamma = 0.0,
+    QuantumState const* y = nullptr, std::size_t const keep = 0,
+    bool const last = false, std::size_t held = 0) -> QuantumState
+{
+    if (y != nullptr) { held += y->memory_usage(); }
+    if (x.backend() == Backend::dense) {
+        TCM_TRACE_SCOPE("apply dense");
+        Stopwatch stopwatch;
+        auto      out = apply_dense(hamiltonian, alpha, beta, x, gamma, y);
+        if (metrics != nullptr) {
+            metrics->apply_time += stopwatch.lap();
+            metrics->unique = x.basis()->size();
+            metrics->shards.clear();
+            metrics->record_memory(
+                x.memory_usage() + out.memory_usage() + held);
+        }
+        return out;
+    }
+    if (x.backend() == Backend::sort) {
+        return apply_sorted(
+            metrics, hamiltonian, alpha, beta, x, gamma, y, keep, held);
+    }
+    auto                out = x.empty_successor(held);
+    QuantumStateBuilder builder{out};
+    builder.screening(make_screening(x, out, keep, 0));
+    // Workers summarise their shards as soon as they are done, so that
+    // normalisation and truncation only combine the partial results. They
+    // also prune what the truncation to the largest elements is going to
+    // remove, while the other shards are still being accumulated. Nobody
+    // needs the norm of intermediate vectors, unless screening measures its
+    // growth.
+    if (last || out.screening() > 0.0) {
+        auto const largest = x.truncation() == Truncation::largest;
+        builder.summarise(largest ? keep : 0, largest);
+    }
+    // Every vector stays within the memory limit by evicting its smallest
+    // elements. Stochastic truncation must stay unbiased, so it exceeds the
+    // limit instead.
+    if (x.truncation() != Truncation::stochastic) {
+        builder.limit(x.table_budget(held));
+    }
+    auto const* heisenberg = hamiltonian.target<Heisenberg>();
+    auto const  cached = heisenberg != nullptr && x.has_diagonal(*heisenberg);
+    if (cached) { builder.diagonal_from(x, alpha, beta); }
+
+    Stopwatch stopwatch;
+    builder.start();
+    {
+        TCM_TRACE_SCOPE("produce");
+        Generator generate{hamiltonian, alpha, beta, builder, !cached};
+        x.for_each(generate);
+        generate.flush();
+        if (y != nullptr) {
+            y->for_each([&builder, gamma](auto const& element) {
+                builder += {gamma * element.second, element.first};
+            });
+        }
+    }
+    if (metrics != nullptr) { metrics->apply_time += stopwatch.lap(); }
+    builder.stop();
+    out.summaries(builder.summaries());
+    // Evicted configurations count as truncated, and fewer of them should be
+    // generated next time.
+    if (auto const [count, norm] = builder.dropped(); count != 0) {
+        out.add_discarded(norm);
+        out.tighten_screening();
+    }
+    out.observe_growth(x);
+    if (metrics != nullptr) {
+        metrics->drain_time += stopwatch.lap();
+        metrics->unique = out.size();
+        for (auto const& summary : out.summaries()) {
+            metrics->unique += summary.pruned;
+        }
+        metrics->record(builder, out);
+        metrics->record_memory(x.memory_usage() + out.memory_usage() + held
+                               + x.number_workers() * Updater::queue_bytes);
+    }
+    return out;
+}
+
+/// Returns 〈φ|ψ〉.
+auto overlap(QuantumState const& phi, QuantumState const& psi)
+    -> std::complex<double>
+{
+    std::complex<double> sum = 0.0;
+    phi.for_each([&sum, &psi](auto const& x) {
+        auto const* where = psi.find(x.first);
+        if (where != nullptr) { sum += std::conj(x.second) * *where; }
+    });
+    return sum;
+}
+
+/// Returns a frozen copy of `psi`.
+auto copy_of(QuantumState const& psi) -> QuantumState
+{
+    QuantumState copy{psi.soft_max(), psi.size(), psi.number_workers()};
+    psi.for_each(
+        [&copy](auto const& x) { copy.insert(QuantumState::value_type{x}); });
+    copy.freeze();
+    return copy;
+}
+
+/// See `filter_step`. `keep` is forwarded to the last application of H.
+auto filter_step_impl(double const lambda, PolynomialFilter const& filter,
+    Hamiltonian const& hamiltonian, QuantumState const& psi,
+    IterationMetrics* metrics, std::size_t const keep) -> QuantumState
+{
+    // Both recurrences apply H exactly `degree` times.
+    std::size_t calls = 0;
+    auto        result = evaluate_filter(lambda, filter, psi,
+        [metrics, &hamiltonian, &filter, &psi, &calls, keep](
+            auto const alpha, auto const beta, QuantumState const& x,
+            auto const gamma, QuantumState const* y) {
+            auto const last = ++calls == filter.degree;
+            // |ψ〉 stays alive until the step is done.
+            auto const held =
+                std::addressof(x) != std::addressof(psi)
+                        && y != std::addressof(psi)
+                    ? psi.memory_usage()
+                    : 0;
+            return apply(metrics, hamiltonian, alpha, beta, x, gamma, y,
+                last ? keep : 0, last, held);
+        });
+    Stopwatch stopwatch;
+    result.normalize();
+    if (metrics != nullptr) { metrics->normalize_time += stopwatch.lap(); }
+    return result;
+}
+} // namespace
 
 auto diffusion_step(double const lambda, Hamiltonian const& hamiltonian,
     QuantumState const& psi) -> QuantumState
 {
-    QuantumState h_psi{psi.soft_max(), psi.hard_max(), psi.number_workers()};
-    QuantumStateBuilder h_psi_builder{h_psi};
-
-    h_psi_builder.start();
-    psi.for_each([&h_psi_builder, &hamiltonian, lambda](auto const& x) {
-        auto const [spin, coeff] = x;
-        hamiltonian(spin, -coeff, h_psi_builder);
-        h_psi_builder += {coeff * lambda, spin};
-    });
-    h_psi_builder.stop();
+    auto h_psi =
+        apply(nullptr, hamiltonian, -1.0, lambda, psi, 0.0, nullptr, 0, true);
     h_psi.normalize();
     return h_psi;
 }
 
-auto diffusion_loop(double const lambda, Hamiltonian const& hamiltonian,
-    QuantumState const& psi, std::size_t const iterations) -> QuantumState
+auto filter_step(double const lambda, PolynomialFilter const& filter,
+    Hamiltonian const& hamiltonian, QuantumState const& psi,
+    IterationMetrics* metrics) -> QuantumState
+{
+    return filter_step_impl(lambda, filter, hamiltonian, psi, metrics, 0);
+}
+
+auto diffusion_loop(double const lambda, PolynomialFilter const& filter,
+    Hamiltonian const& hamiltonian, QuantumState const& psi,
+    std::size_t const iterations, std::ostream* metrics_stream,
+    EnergyAverage* average) -> QuantumState
 {
     if (iterations == 0) {
         throw_with_trace(
             std::runtime_error{"Number of iterations must be positive!"});
     }
-    std::cerr << "[1/" << iterations << "]";
-    QuantumState state = diffusion_step(lambda, hamiltonian, psi);
-    for (auto i = 1ul; i < iterations; ++i) {
+    // Metrics are always collected, since the progress reports the memory.
+    IterationMetrics  metrics;
+    IterationMetrics* metrics_ptr = std::addressof(metrics);
+    auto const progress = [iterations, &metrics, &psi](auto const i) {
         std::cerr << "\r[" << (i + 1) << "/" << iterations << "]";
-        state = diffusion_step(lambda, hamiltonian, state);
-        state.shrink();
+        if (metrics.memory_bytes == 0) { return; }
+        std::cerr << " " << format_bytes(metrics.memory_bytes);
+        if (psi.memory_limit() != 0) {
+            std::cerr << " of " << format_bytes(psi.memory_limit());
+        }
+        if (metrics.dropped != 0) {
+            std::cerr << ", " << metrics.dropped << " dropped";
+        }
+        std::cerr << "   " << std::flush;
+    };
+    auto const report = [metrics_stream, &metrics](auto const& state) {
+        if (metrics_stream == nullptr) { return; }
+        metrics.kept = state.size();
+        *metrics_stream << metrics << std::endl;
+    };
+    std::optional<QuantumState> trial;
+    std::optional<QuantumState> h_trial;
+    auto const estimate = [&](auto const i, QuantumState const& state) {
+        if (average == nullptr || i < average->skip) { return; }
+        if (!trial.has_value()) {
+            trial.emplace(copy_of(state));
+            h_trial.emplace(apply(nullptr, hamiltonian, 1.0, 0.0, *trial));
+            h_trial->freeze();
+        }
+        metrics.energy =
+            average->add(overlap(*h_trial, state), overlap(*trial, state));
+    };
+
+    // The diagonal is cached next to the amplitudes of every hash state, so
+    // that `apply` does not send it through the queues.
+    std::shared_ptr<Heisenberg const> heisenberg;
+    if (auto const* target = hamiltonian.target<Heisenberg>()) {
+        heisenberg = std::make_shared<Heisenberg const>(*target);
+    }
+    auto const freeze = [&heisenberg](QuantumState& state) {
+        if (heisenberg != nullptr && state.backend() == Backend::hash) {
+            state.cache_diagonal(heisenberg);
+        }
+        else {
+            state.freeze();
+        }
+    };
+
+    progress(0ul);
+    QuantumState state =
+        filter_step(lambda, filter, hamiltonian, psi, metrics_ptr);
+    // Until the next iteration the state is only read.
+    Stopwatch stopwatch;
+    freeze(state);
+    metrics.shrink_time = stopwatch.lap();
+    estimate(0ul, state);
+    report(state);
+    for (auto i = 1ul; i < iterations; ++i) {
+        // Reports the memory used by the previous iteration.
+        progress(i);
+        metrics = IterationMetrics{};
+        metrics.iteration = i;
+        state = filter_step_impl(lambda, filter, hamiltonian, state,
+            metrics_ptr, state.soft_max());
+        stopwatch.lap();
+        metrics.discarded_squared_norm = state.shrink();
+        freeze(state);
+        metrics.shrink_time = stopwatch.lap();
+        estimate(i, state);
+        report(state);
     }
     std::cerr << std::endl;
     return state;
 }
-
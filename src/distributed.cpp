@@ -0,0 +1,358 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "distributed.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+/// One element of a state as it travels over the wire.
+struct Packed {
+    SpinVector           spin;
+    std::complex<double> coeff;
+};
+static_assert(std::is_trivially_copyable_v<Packed>);
+
+/// Upper bound on the number of bytes sent by one rank in one round of
+/// MPI_Alltoallv. Keeps counts and displacements well within `int` and
+/// bounds the memory used by the send and receive buffers.
+constexpr std::size_t max_batch_bytes = 1ul << 28;
+
+constexpr int write_tag = 1;
+
+auto add_to(QuantumState& psi, Packed const& x) -> void
+{
+    auto const [where, inserted] = psi.insert({x.spin, x.coeff});
+    if (!inserted) { where->second += x.coeff; }
+}
+
+auto to_bits(double const x) noexcept -> std::uint64_t
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+auto from_bits(std::uint64_t const bits) noexcept -> double
+{
+    double x;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+/// Returns α·H|x〉+ β|x〉+ γ|y〉.
+auto apply(Hamiltonian const& hamiltonian, std::complex<double> const alpha,
+    std::complex<double> const beta, DistributedState const& x,
+    std::complex<double> const gamma, DistributedState const* y)
+    -> DistributedState
+{
+    // Contributions are first combined locally, so that every configuration
+    // is sent at most once per rank.
+    auto generated = x.local().empty_successor();
+    {
+        QuantumStateBuilder builder{generated};
+        builder.start();
+        x.local().for_each(
+            [&builder, &hamiltonian, alpha, beta](auto const& element) {
+                auto const [spin, coeff] = element;
+                hamiltonian(spin, alpha * coeff, builder);
+                builder += {beta * coeff, spin};
+            });
+        if (y != nullptr) {
+            y->local().for_each([&builder, gamma](auto const& element) {
+                builder += {gamma * element.second, element.first};
+            });
+        }
+        builder.stop();
+    }
+    auto out = x.empty_successor();
+    out.accumulate(generated);
+    out.local().observe_growth(x.local());
+    return out;
+}
+} // namespace
+
+DistributedState::DistributedState(MPI_Comm const comm, QuantumState local)
+    : _comm{comm}, _rank{0}, _size{1}, _local{std::move(local)}
+{
+    MPI_Comm_rank(_comm, &_rank);
+    MPI_Comm_size(_comm, &_size);
+}
+
+auto DistributedState::scatter(MPI_Comm const comm, QuantumState const& psi,
+    int const root) -> DistributedState
+{
+    DistributedState state{comm, psi.empty_successor()};
+    if (state.rank() == root) { state.accumulate(psi); }
+    else {
+        state.accumulate(QuantumState{psi.soft_max(), 0, 1});
+    }
+    return state;
+}
+
+auto DistributedState::empty_successor() const -> DistributedState
+{
+    return DistributedState{_comm, _local.empty_successor()};
+}
+
+auto DistributedState::size() const -> std::size_t
+{
+    std::uint64_t count = _local.size();
+    MPI_Allreduce(MPI_IN_PLACE, &count, 1, MPI_UINT64_T, MPI_SUM, _comm);
+    return count;
+}
+
+auto DistributedState::normalize() -> DistributedState&
+{
+    auto norm = _local.squared_norm();
+    MPI_Allreduce(MPI_IN_PLACE, &norm, 1, MPI_DOUBLE, MPI_SUM, _comm);
+    _local.scale(1.0 / std::sqrt(norm));
+    return *this;
+}
+
+auto DistributedState::shrink() -> double
+{
+    std::uint64_t const soft_max = _local.soft_max();
+    if (size() <= soft_max) { return 0.0; }
+
+    std::vector<double> norms;
+    norms.reserve(_local.size());
+    _local.for_each(
+        [&norms](auto const& x) { norms.push_back(std::norm(x.second)); });
+    std::sort(std::begin(norms), std::end(norms));
+
+    auto const count_above = [this, &norms](double const threshold) {
+        std::uint64_t count = static_cast<std::uint64_t>(std::end(norms)
+            - std::upper_bound(std::begin(norms), std::end(norms), threshold));
+        MPI_Allreduce(MPI_IN_PLACE, &count, 1, MPI_UINT64_T, MPI_SUM, _comm);
+        return count;
+    };
+
+    // Non-negative doubles are ordered in the same way as their bit patterns,
+    // so we can bisect over integers and find the exact threshold.
+    auto max_norm = norms.empty() ? 0.0 : norms.back();
+    MPI_Allreduce(MPI_IN_PLACE, &max_norm, 1, MPI_DOUBLE, MPI_MAX, _comm);
+    std::uint64_t lower = 0;
+    std::uint64_t upper = to_bits(max_norm);
+    while (lower < upper) {
+        auto const middle = lower + (upper - lower) / 2;
+        if (count_above(from_bits(middle)) <= soft_max) { upper = middle; }
+        else {
+            lower = middle + 1;
+        }
+    }
+    auto const threshold = from_bits(upper);
+    auto const above     = count_above(threshold);
+
+    // Elements equal to the threshold are kept in rank order until soft_max
+    // is reached.
+    auto const [first, last] =
+        std::equal_range(std::begin(norms), std::end(norms), threshold);
+    std::uint64_t const ties        = static_cast<std::uint64_t>(last - first);
+    std::uint64_t       ties_before = 0;
+    MPI_Exscan(&ties, &ties_before, 1, MPI_UINT64_T, MPI_SUM, _comm);
+    if (_rank == 0) { ties_before = 0; }
+    auto const wanted    = soft_max - above;
+    auto       keep_ties = wanted > ties_before
+                         ? std::min(ties, wanted - ties_before)
+                         : std::uint64_t{0};
+
+    std::vector<SpinVector> removed;
+    double                  discarded = 0.0;
+    _local.for_each([threshold, &keep_ties, &removed, &discarded](
+                        auto const& x) {
+        auto const norm = std::norm(x.second);
+        if (norm > threshold) { return; }
+        if (norm == threshold && keep_ties > 0) {
+            --keep_ties;
+            return;
+        }
+        removed.push_back(x.first);
+        discarded += norm;
+    });
+    for (auto const& spin : removed) {
+        _local.erase(spin);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &discarded, 1, MPI_DOUBLE, MPI_SUM, _comm);
+    return discarded;
+}
+
+auto DistributedState::accumulate(QuantumState const& generated) -> void
+{
+    auto const number_ranks = static_cast<std::size_t>(_size);
+    auto const batch_size   = std::max<std::size_t>(
+        1, max_batch_bytes / (sizeof(Packed) * number_ranks));
+
+    std::vector<std::vector<Packed>> outgoing(number_ranks);
+    generated.for_each([this, &outgoing](auto const& x) {
+        outgoing[static_cast<std::size_t>(owner(x.first))].push_back(
+            {x.first, x.second});
+    });
+
+    std::uint64_t rounds = 0;
+    for (auto const& bucket : outgoing) {
+        rounds = std::max<std::uint64_t>(
+            rounds, (bucket.size() + batch_size - 1) / batch_size);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_UINT64_T, MPI_MAX, _comm);
+
+    std::vector<int>    send_counts(number_ranks);
+    std::vector<int>    send_displs(number_ranks);
+    std::vector<int>    recv_counts(number_ranks);
+    std::vector<int>    recv_displs(number_ranks);
+    std::vector<Packed> send_buffer;
+    std::vector<Packed> recv_buffer;
+    for (std::uint64_t round = 0; round < rounds; ++round) {
+        send_buffer.clear();
+        for (std::size_t i = 0; i < number_ranks; ++i) {
+            auto const& bucket = outgoing[i];
+            auto const  first  = std::min(bucket.size(), round * batch_size);
+            auto const  last   = std::min(bucket.size(), first + batch_size);
+            send_displs[i] =
+                static_cast<int>(send_buffer.size() * sizeof(Packed));
+            send_counts[i] = static_cast<int>((last - first) * sizeof(Packed));
+            send_buffer.insert(std::end(send_buffer),
+                std::begin(bucket) + static_cast<std::ptrdiff_t>(first),
+                std::begin(bucket) + static_cast<std::ptrdiff_t>(last));
+        }
+        MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1,
+            MPI_INT, _comm);
+        auto total = 0;
+        for (std::size_t i = 0; i < number_ranks; ++i) {
+            recv_displs[i] = total;
+            total += recv_counts[i];
+        }
+        recv_buffer.resize(static_cast<std::size_t>(total) / sizeof(Packed));
+        MPI_Alltoallv(send_buffer.data(), send_counts.data(),
+            send_displs.data(), MPI_BYTE, recv_buffer.data(),
+            recv_counts.data(), recv_displs.data(), MPI_BYTE, _comm);
+        for (auto const& x : recv_buffer) {
+            add_to(_local, x);
+        }
+    }
+}
+
+auto DistributedState::write(std::ostream& out, int const root) const -> void
+{
+    auto const batch_size = max_batch_bytes / sizeof(Packed);
+    auto const print      = [&out](auto const& spin, auto const& coeff) {
+        out << spin << '\t' << coeff.real() << '\t' << coeff.imag() << '\n';
+    };
+
+    if (_rank == root) {
+        out << _local;
+        std::vector<Packed> buffer;
+        for (auto source = 0; source < _size; ++source) {
+            if (source == root) { continue; }
+            std::uint64_t remaining;
+            MPI_Recv(&remaining, 1, MPI_UINT64_T, source, write_tag, _comm,
+                MPI_STATUS_IGNORE);
+            while (remaining > 0) {
+                auto const n = std::min<std::uint64_t>(remaining, batch_size);
+                buffer.resize(n);
+                MPI_Recv(buffer.data(), static_cast<int>(n * sizeof(Packed)),
+                    MPI_BYTE, source, write_tag, _comm, MPI_STATUS_IGNORE);
+                for (auto const& x : buffer) {
+                    print(x.spin, x.coeff);
+                }
+                remaining -= n;
+            }
+        }
+    }
+    else {
+        std::uint64_t count = _local.size();
+        MPI_Send(&count, 1, MPI_UINT64_T, root, write_tag, _comm);
+        std::vector<Packed> buffer;
+        buffer.reserve(std::min<std::size_t>(count, batch_size));
+        auto const flush = [this, root, &buffer]() {
+            MPI_Send(buffer.data(),
+                static_cast<int>(buffer.size() * sizeof(Packed)), MPI_BYTE,
+                root, write_tag, _comm);
+            buffer.clear();
+        };
+        _local.for_each([batch_size, &buffer, &flush](auto const& x) {
+            buffer.push_back({x.first, x.second});
+            if (buffer.size() == batch_size) { flush(); }
+        });
+        if (!buffer.empty()) { flush(); }
+    }
+}
+
+auto energy(Hamiltonian const& hamiltonian, DistributedState const& psi)
+    -> std::complex<double>
+{
+    auto const h_psi = apply(hamiltonian, 1.0, 0.0, psi, 0.0, nullptr);
+
+    std::complex<double> energy;
+    psi.local().for_each([&energy, &h_psi](auto const& x) {
+        auto const where = h_psi.local().find(x.first);
+        if (where != nullptr) { energy += std::conj(x.second) * *where; }
+    });
+    double buffer[2] = {energy.real(), energy.imag()};
+    MPI_Allreduce(MPI_IN_PLACE, buffer, 2, MPI_DOUBLE, MPI_SUM, psi.comm());
+    return {buffer[0], buffer[1]};
+}
+
+auto diffusion_loop(double const lambda, PolynomialFilter const& filter,
+    Hamiltonian const& hamiltonian, DistributedState const& psi,
+    std::size_t const iterations) -> DistributedState
+{
+    if (iterations == 0) {
+        throw_with_trace(
+            std::runtime_error{"Number of iterations must be positive!"});
+    }
+    auto const step = [lambda, &filter, &hamiltonian](
+                          DistributedState const& x) {
+        auto y = evaluate_filter(lambda, filter, x,
+            [&hamiltonian](auto const alpha, auto const beta,
+                DistributedState const& a, auto const gamma,
+                DistributedState const* b) {
+                return apply(hamiltonian, alpha, beta, a, gamma, b);
+            });
+        y.normalize();
+        return y;
+    };
+    auto const verbose = psi.rank() == 0;
+
+    if (verbose) { std::cerr << "[1/" << iterations << "]"; }
+    auto state = step(psi);
+    for (auto i = 1ul; i < iterations; ++i) {
+        if (verbose) {
+            std::cerr << "\r[" << (i + 1) << "/" << iterations << "]";
+        }
+        state = step(state);
+        state.shrink();
+    }
+    if (verbose) { std::cerr << std::endl; }
+    return state;
+}
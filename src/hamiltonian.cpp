@@ -30,27 +30,330 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "hamiltonian.hpp"
+#include "kernels.hpp"
+#include "parallel.hpp"
 #include "quantum_state.hpp"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
 
 auto Heisenberg::operator()(SpinVector spin, std::complex<double> coeff,
-    QuantumStateBuilder& psi) const -> void
+    QuantumStateBuilder& psi, bool const with_diagonal) const -> void
 {
+    auto&                screening = psi.screening();
+    std::complex<double> diagonal  = 0.0;
     for (auto const& [coupling, edges] : _specs) {
+        auto const off_diagonal = 2.0 * coeff * coupling;
+        // All off-diagonal terms of one spec have the same magnitude.
+        auto const skip = !screening.stochastic()
+                          && std::abs(off_diagonal) < screening.threshold();
         for (auto const& [i, j] : edges) {
             auto const aligned = spin[i] == spin[j];
             auto const sign    = static_cast<double>(-1 + 2 * aligned);
-            psi += {sign * coeff * coupling, spin};
-            if (!aligned) {
-                psi += {2.0 * coeff * coupling, spin.flipped({i, j})};
+            diagonal += sign * coeff * coupling;
+            if (!aligned && !skip) {
+                auto const amplitude = screening(off_diagonal);
+                if (amplitude != 0.0) {
+                    psi += {amplitude, spin.flipped({i, j})};
+                }
             }
         }
     }
+    if (with_diagonal) { psi += {diagonal, spin}; }
 }
 
+auto Heisenberg::operator()(SpinVector const* spins,
+    std::complex<double> const* coeffs, std::size_t const count,
+    QuantumStateBuilder& psi, bool const with_diagonal) const -> void
+{
+    static_assert(batch_size == kernel_lanes);
+    TCM_ASSERT(count <= batch_size);
+    if (count == 0) { return; }
+    auto const n = spins[0].size();
+    if (n > 64
+        || std::any_of(spins, spins + count,
+            [n](auto const& x) { return x.size() != n; })) {
+        for (std::size_t lane = 0; lane < count; ++lane) {
+            (*this)(spins[lane], coeffs[lane], psi, with_diagonal);
+        }
+        return;
+    }
+
+    // Unused lanes are processed, too, but their results are ignored.
+    std::uint64_t s[batch_size] = {};
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        s[lane] = spins[lane].bits();
+    }
+    auto const position = [n](auto const i) { return n - 1 - i; };
+
+    auto const           antiparallel = kernels().antiparallel;
+    auto&                screening    = psi.screening();
+    std::complex<double> diagonal[batch_size] = {};
+    for (auto const& [coupling, edges] : _specs) {
+        // Edges are processed in chunks of 64, so that bit e of `anti` can
+        // tell whether edge e of the chunk is anti-aligned.
+        for (std::size_t first = 0; first < edges.size(); first += 64) {
+            auto const    last = std::min(first + 64, edges.size());
+            std::uint64_t anti[batch_size];
+            int           counts[batch_size];
+            antiparallel(
+                s, edges.data() + first, last - first, n, anti, counts);
+            auto const size = static_cast<double>(last - first);
+            for (std::size_t lane = 0; lane < count; ++lane) {
+                auto const number_anti = static_cast<double>(counts[lane]);
+                diagonal[lane] +=
+                    (size - 2.0 * number_anti) * coeffs[lane] * coupling;
+                auto const off_diagonal = 2.0 * coeffs[lane] * coupling;
+                if (!screening.stochastic()
+                    && std::abs(off_diagonal) < screening.threshold()) {
+                    continue;
+                }
+                for (auto bits = anti[lane]; bits != 0; bits &= bits - 1) {
+                    auto const& edge =
+                        edges[first + static_cast<std::size_t>(
+                                          __builtin_ctzll(bits))];
+                    auto const amplitude = screening(off_diagonal);
+                    if (amplitude != 0.0) {
+                        auto const mask =
+                            (std::uint64_t{1} << position(edge.first))
+                            | (std::uint64_t{1} << position(edge.second));
+                        psi += {amplitude, SpinVector::from_bits(
+                                               s[lane] ^ mask, n)};
+                    }
+                }
+            }
+        }
+    }
+    if (!with_diagonal) { return; }
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        psi += {diagonal[lane], spins[lane]};
+    }
+}
+
+auto Heisenberg::diagonal(SpinVector const* spins, std::size_t const count,
+    std::complex<double>* out) const -> void
+{
+    TCM_ASSERT(count <= batch_size);
+    std::fill(out, out + count, std::complex<double>{0.0});
+    if (count == 0) { return; }
+    auto const n = spins[0].size();
+    if (n > 64
+        || std::any_of(spins, spins + count,
+            [n](auto const& x) { return x.size() != n; })) {
+        for (std::size_t lane = 0; lane < count; ++lane) {
+            auto const& spin = spins[lane];
+            for (auto const& [coupling, edges] : _specs) {
+                for (auto const& [i, j] : edges) {
+                    out[lane] += spin[i] == spin[j] ? coupling : -coupling;
+                }
+            }
+        }
+        return;
+    }
+
+    std::uint64_t s[batch_size] = {};
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        s[lane] = spins[lane].bits();
+    }
+    auto const antiparallel = kernels().antiparallel;
+    for (auto const& [coupling, edges] : _specs) {
+        for (std::size_t first = 0; first < edges.size(); first += 64) {
+            auto const    last = std::min(first + 64, edges.size());
+            std::uint64_t anti[batch_size];
+            int           counts[batch_size];
+            antiparallel(
+                s, edges.data() + first, last - first, n, anti, counts);
+            auto const size = static_cast<double>(last - first);
+            for (std::size_t lane = 0; lane < count; ++lane) {
+                out[lane] += (size - 2.0 * static_cast<double>(counts[lane]))
+                             * coupling;
+            }
+        }
+    }
+}
+
+auto Heisenberg::number_edges() const noexcept -> std::size_t
+{
+    std::size_t count = 0;
+    for (auto const& [_, edges] : _specs) {
+        count += edges.size();
+    }
+    return count;
+}
+
+CouplingMatrix::CouplingMatrix(
+    int const number_spins, std::vector<double> couplings)
+    : _number_spins{number_spins}
+    , _couplings{std::move(couplings)}
+    , _total{0.0}
+{
+    auto const n = static_cast<std::size_t>(number_spins);
+    if (number_spins <= 0 || _couplings.size() != n * n) {
+        throw_with_trace(std::invalid_argument{
+            "Coupling matrix must be square and non-empty."});
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        _couplings[i * n + i] = 0.0;
+        for (auto j = i + 1; j < n; ++j) {
+            auto& upper = _couplings[i * n + j];
+            auto& lower = _couplings[j * n + i];
+            upper       = 0.5 * (upper + lower);
+            lower       = upper;
+            _total += upper;
+        }
+    }
+}
+
+auto CouplingMatrix::operator()(SpinVector const spin,
+    std::complex<double> const coeff, QuantumStateBuilder& psi) const -> void
+{
+    TCM_ASSERT(spin.size() == _number_spins);
+    auto&      screening = psi.screening();
+    auto const n         = _number_spins;
+    auto const row       = [this](auto const i) {
+        return _couplings.data() + static_cast<std::size_t>(i * _number_spins);
+    };
+    // Sum of the couplings of all antiparallel pairs.
+    double anti = 0.0;
+    if (n <= 64) {
+        // Bit p of `x` is spin n - 1 - p, see SpinVector::bits.
+        auto const x    = spin.bits();
+        auto const all  = n == 64 ? ~std::uint64_t{0}
+                                  : (std::uint64_t{1} << n) - 1;
+        auto const down = ~x & all;
+        for (auto up = x; up != 0; up &= up - 1) {
+            auto const  p         = __builtin_ctzll(up);
+            auto const* couplings = row(n - 1 - p);
+            for (auto rest = down; rest != 0; rest &= rest - 1) {
+                auto const q        = __builtin_ctzll(rest);
+                auto const coupling = couplings[n - 1 - q];
+                if (coupling == 0.0) { continue; }
+                anti += coupling;
+                auto const amplitude = screening(2.0 * coeff * coupling);
+                if (amplitude != 0.0) {
+                    auto const mask =
+                        (std::uint64_t{1} << p) | (std::uint64_t{1} << q);
+                    psi += {amplitude, SpinVector::from_bits(x ^ mask, n)};
+                }
+            }
+        }
+    }
+    else {
+        for (auto i = 0; i < n; ++i) {
+            auto const* couplings = row(i);
+            for (auto j = i + 1; j < n; ++j) {
+                auto const coupling = couplings[j];
+                if (spin[i] == spin[j] || coupling == 0.0) { continue; }
+                anti += coupling;
+                auto const amplitude = screening(2.0 * coeff * coupling);
+                if (amplitude != 0.0) {
+                    psi += {amplitude, spin.flipped({i, j})};
+                }
+            }
+        }
+    }
+    psi += {(_total - 2.0 * anti) * coeff, spin};
+}
+
+auto CouplingMatrix::number_edges() const noexcept -> std::size_t
+{
+    // Every pair is stored twice.
+    return static_cast<std::size_t>(std::count_if(std::begin(_couplings),
+               std::end(_couplings), [](auto const x) { return x != 0.0; }))
+           / 2;
+}
+
+auto number_edges(Hamiltonian const& hamiltonian) -> std::size_t
+{
+    if (auto const* x = hamiltonian.target<Heisenberg>()) {
+        return x->number_edges();
+    }
+    if (auto const* x = hamiltonian.target<CouplingMatrix>()) {
+        return x->number_edges();
+    }
+    throw_with_trace(std::invalid_argument{
+        "Expected a Heisenberg Hamiltonian or a coupling matrix."});
+}
+
+namespace {
+/// Returns 〈ψ|H|ψ〉 = Σσ c*σ·(H|ψ〉)σ for a Heisenberg H. Every element
+/// gathers (H|ψ〉)σ from the configurations it is connected to by looking
+/// them up in |ψ〉, so H|ψ〉 is never accumulated. Shards are processed in
+/// parallel.
+auto heisenberg_energy(Heisenberg const& hamiltonian, QuantumState const& psi)
+    -> std::complex<double>
+{
+    std::vector<std::complex<double>> partial(psi.number_workers());
+    if (psi.has_diagonal(hamiltonian)) {
+        // Only the antiparallel edges need a lookup.
+        parallel_for(partial.size(), [&](auto const shard) {
+            std::complex<double> sum = 0.0;
+            psi.for_each_diagonal_in_shard(
+                shard, [&](auto const& x, auto const diagonal) {
+                    auto const& [spin, coeff] = x;
+                    std::complex<double> h_coeff = diagonal * coeff;
+                    for (auto const& [coupling, edges] : hamiltonian.specs()) {
+                        for (auto const& [i, j] : edges) {
+                            if (spin[i] == spin[j]) { continue; }
+                            auto const* other = psi.find(spin.flipped({i, j}));
+                            if (other != nullptr) {
+                                h_coeff += 2.0 * coupling * *other;
+                            }
+                        }
+                    }
+                    sum += std::conj(coeff) * h_coeff;
+                });
+            partial[shard] = sum;
+        });
+        return std::accumulate(std::begin(partial), std::end(partial),
+            std::complex<double>{0.0});
+    }
+    parallel_for(partial.size(), [&](auto const shard) {
+        std::complex<double> sum = 0.0;
+        psi.for_each_in_shard(shard, [&](auto const& x) {
+            auto const& [spin, coeff] = x;
+            std::complex<double> h_coeff = 0.0;
+            for (auto const& [coupling, edges] : hamiltonian.specs()) {
+                for (auto const& [i, j] : edges) {
+                    if (spin[i] == spin[j]) {
+                        h_coeff += coupling * coeff;
+                        continue;
+                    }
+                    h_coeff -= coupling * coeff;
+                    auto const* other = psi.find(spin.flipped({i, j}));
+                    if (other != nullptr) {
+                        h_coeff += 2.0 * coupling * *other;
+                    }
+                }
+            }
+            sum += std::conj(coeff) * h_coeff;
+        });
+        partial[shard] = sum;
+    });
+    return std::accumulate(
+        std::begin(partial), std::end(partial), std::complex<double>{0.0});
+}
+} // namespace
+
 auto energy(Hamiltonian const& hamiltonian, QuantumState const& psi)
     -> std::complex<double>
 {
-    QuantumState h_psi{psi.soft_max(), psi.hard_max(), psi.number_workers()};
+    if (psi.backend() == Backend::dense) {
+        auto const h_psi =
+            apply_dense(hamiltonian, 1.0, 0.0, psi, 0.0, nullptr);
+        auto const&          xs = psi.amplitudes();
+        auto const&          ys = h_psi.amplitudes();
+        std::complex<double> energy;
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            energy += std::conj(xs[i]) * ys[i];
+        }
+        return energy;
+    }
+    if (auto const* heisenberg = hamiltonian.target<Heisenberg>()) {
+        return heisenberg_energy(*heisenberg, psi);
+    }
+
+    auto                h_psi = psi.empty_successor();
     QuantumStateBuilder h_psi_builder{h_psi};
 
     h_psi_builder.start();
@@ -62,9 +365,7 @@ auto energy(Hamiltonian const& hamiltonian, QuantumState const& psi)
     std::complex<double> energy;
     psi.for_each([&energy, &h_psi](auto const& x) {
         auto const where = h_psi.find(x.first);
-        if (where.has_value()) {
-            energy += std::conj(x.second) * (*where)->second;
-        }
+        if (where != nullptr) { energy += std::conj(x.second) * *where; }
     });
     return energy;
 }
@@ -151,3 +452,52 @@ auto operator>>(std::istream& is, Heisenberg& x) -> std::istream&
     return is;
 }
 
+namespace {
+constexpr char couplings_magic[8] = {'L', 'A', 'N', 'C', 'Z', 'O', 'S', 'J'};
+} // namespace
+
+auto write_binary(std::ostream& out, CouplingMatrix const& x) -> std::ostream&
+{
+    auto const n = static_cast<std::uint64_t>(x._number_spins);
+    out.write(couplings_magic, sizeof(couplings_magic));
+    out.write(reinterpret_cast<char const*>(&n), sizeof(n));
+    out.write(reinterpret_cast<char const*>(x._couplings.data()),
+        static_cast<std::streamsize>(x._couplings.size() * sizeof(double)));
+    return out;
+}
+
+auto read_binary(std::istream& in, CouplingMatrix& x) -> std::istream&
+{
+    char          magic[sizeof(couplings_magic)];
+    std::uint64_t n;
+    if (!in.read(magic, sizeof(magic))
+        || std::memcmp(magic, couplings_magic, sizeof(magic)) != 0
+        || !in.read(reinterpret_cast<char*>(&n), sizeof(n)) || n == 0
+        // Capacity of SpinVector
+        || n > 112) {
+        in.setstate(std::ios_base::failbit);
+        throw_with_trace(std::runtime_error{
+            "Failed to parse the Hamiltonian: Not a binary coupling matrix."});
+    }
+    std::vector<double> couplings(n * n);
+    if (!in.read(reinterpret_cast<char*>(couplings.data()),
+            static_cast<std::streamsize>(couplings.size() * sizeof(double)))) {
+        throw_with_trace(std::runtime_error{
+            "Failed to parse the Hamiltonian: Unexpected end of file."});
+    }
+    x = CouplingMatrix{static_cast<int>(n), std::move(couplings)};
+    return in;
+}
+
+auto is_binary_couplings(std::istream& in) -> bool
+{
+    char       magic[sizeof(couplings_magic)];
+    auto const start = in.tellg();
+    auto const match =
+        in.read(magic, sizeof(magic))
+        && std::memcmp(magic, couplings_magic, sizeof(magic)) == 0;
+    in.clear();
+    in.seekg(start);
+    return match;
+}
+
@@ -0,0 +1,152 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "config.hpp"
+#include "kernels_impl.hpp"
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr std::size_t number_isas = 4;
+
+auto index(Isa const isa) noexcept -> std::size_t
+{
+    return static_cast<std::size_t>(isa);
+}
+
+/// Returns the kernels for `isa` if they are compiled in and the CPU
+/// supports the instructions they were compiled for, and nullptr otherwise.
+auto find_kernels(Isa const isa) noexcept -> Kernels const*
+{
+    __builtin_cpu_init();
+    if (isa == Isa::generic) { return &generic_kernels(); }
+#if defined(TCM_KERNELS_SSE4_2)
+    if (isa == Isa::sse4_2 && __builtin_cpu_supports("sse4.2")
+        && __builtin_cpu_supports("popcnt")) {
+        return &sse4_2_kernels();
+    }
+#endif
+#if defined(TCM_KERNELS_AVX2)
+    if (isa == Isa::avx2 && __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2")
+        && __builtin_cpu_supports("popcnt")) {
+        return &avx2_kernels();
+    }
+#endif
+#if defined(TCM_KERNELS_AVX512)
+    if (isa == Isa::avx512 && __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq")
+        && __builtin_cpu_supports("avx512vl")) {
+        return &avx512_kernels();
+    }
+#endif
+    return nullptr;
+}
+
+/// Kernel tables of all supported instruction sets and the selected one.
+class Registry {
+    std::array<Kernels const*, number_isas> _tables;
+    Isa                                     _best;
+    std::atomic<Isa>                        _current;
+
+  public:
+    Registry() noexcept : _tables{}, _best{Isa::generic}, _current{}
+    {
+        for (std::size_t i = 0; i < number_isas; ++i) {
+            auto const isa = static_cast<Isa>(i);
+            _tables[i]     = find_kernels(isa);
+            if (_tables[i] != nullptr) { _best = isa; }
+        }
+        _current = _best;
+    }
+
+    auto table(Isa const isa) const noexcept -> Kernels const*
+    {
+        return _tables[index(isa)];
+    }
+
+    auto best() const noexcept -> Isa { return _best; }
+
+    auto current() const noexcept -> Isa
+    {
+        return _current.load(std::memory_order_relaxed);
+    }
+
+    auto current(Isa const isa) noexcept -> void
+    {
+        _current.store(isa, std::memory_order_relaxed);
+    }
+};
+
+auto registry() noexcept -> Registry&
+{
+    static Registry instance;
+    return instance;
+}
+} // namespace
+
+auto to_string(Isa const isa) -> char const*
+{
+    constexpr std::array<char const*, number_isas> names = {
+        "generic", "sse4.2", "avx2", "avx512"};
+    return names[index(isa)];
+}
+
+auto supported(Isa const isa) noexcept -> bool
+{
+    return registry().table(isa) != nullptr;
+}
+
+auto detected_isa() noexcept -> Isa { return registry().best(); }
+
+auto current_isa() noexcept -> Isa { return registry().current(); }
+
+auto select_isa(Isa const isa) -> void
+{
+    if (!supported(isa)) {
+        throw_with_trace(std::runtime_error{"Instruction set '"
+                                            + std::string{to_string(isa)}
+                                            + "' is not supported."});
+    }
+    registry().current(isa);
+}
+
+auto kernels(Isa const isa) noexcept -> Kernels const&
+{
+    TCM_ASSERT(supported(isa));
+    return *registry().table(isa);
+}
+
+auto kernels() noexcept -> Kernels const& { return kernels(current_isa()); }
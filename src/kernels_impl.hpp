@@ -0,0 +1,169 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include "config.hpp"
+#include "kernels.hpp"
+
+/// \file
+/// \brief Implementation of the kernels, compiled once per instruction set.
+///
+/// Each `kernels_<isa>.cpp` defines `TCM_KERNEL_TABLE` to the name of its
+/// table and includes this file; CMake defines `TCM_KERNEL_TARGET` to the
+/// instruction sets of the variant. Only the kernels are compiled for them
+/// (`TCM_KERNEL`), everything else in the translation unit, in particular
+/// inline functions of other headers which the linker may pick from any
+/// unit, sticks to the baseline. The kernels have internal linkage, so the
+/// variants do not clash.
+
+auto generic_kernels() noexcept -> Kernels const&;
+auto sse4_2_kernels() noexcept -> Kernels const&;
+auto avx2_kernels() noexcept -> Kernels const&;
+auto avx512_kernels() noexcept -> Kernels const&;
+
+#if defined(TCM_KERNEL_TABLE)
+#if defined(TCM_KERNEL_TARGET)
+#define TCM_KERNEL __attribute__((target(TCM_KERNEL_TARGET)))
+#else
+#define TCM_KERNEL
+#endif
+
+namespace {
+/// Number of independent partial sums in reductions: enough to hide the
+/// latency of the additions with four 512-bit accumulators. It is the same
+/// for all instruction sets, so variants only differ by fused multiply-adds.
+constexpr std::size_t reduction_width = 32;
+
+auto as_doubles(std::complex<double> const* x) noexcept -> double const*
+{
+    // std::complex<T> is required to be layout-compatible with T[2].
+    return reinterpret_cast<double const*>(x);
+}
+
+auto as_doubles(std::complex<double>* x) noexcept -> double*
+{
+    return reinterpret_cast<double*>(x);
+}
+
+TCM_KERNEL auto squared_norm(std::complex<double> const* x, std::size_t const n)
+    -> double
+{
+    auto const* data = as_doubles(x);
+    auto const  size = 2 * n;
+    // Without -ffast-math the compiler may not reorder a single sum, but it
+    // does vectorise independent partial sums.
+    double      partial[reduction_width] = {};
+    std::size_t i = 0;
+    for (; i + reduction_width <= size; i += reduction_width) {
+        for (std::size_t k = 0; k < reduction_width; ++k) {
+            partial[k] += data[i + k] * data[i + k];
+        }
+    }
+    double sum = 0.0;
+    for (; i < size; ++i) {
+        sum += data[i] * data[i];
+    }
+    for (auto const p : partial) {
+        sum += p;
+    }
+    return sum;
+}
+
+TCM_KERNEL auto norms(std::complex<double> const* x, std::size_t const n,
+    double* const out) -> void
+{
+    auto const* data = as_doubles(x);
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = data[2 * i] * data[2 * i] + data[2 * i + 1] * data[2 * i + 1];
+    }
+}
+
+TCM_KERNEL auto scale(std::complex<double>* x, std::size_t const n,
+    std::complex<double> const c) -> void
+{
+    auto* const data = as_doubles(x);
+    if (c.imag() == 0.0) {
+        for (std::size_t i = 0; i < 2 * n; ++i) {
+            data[i] *= c.real();
+        }
+        return;
+    }
+    // Unlike std::complex::operator*=, no special handling of infinities,
+    // which keeps the loop vectorisable.
+    for (std::size_t i = 0; i < n; ++i) {
+        auto const re   = data[2 * i];
+        auto const im   = data[2 * i + 1];
+        data[2 * i]     = re * c.real() - im * c.imag();
+        data[2 * i + 1] = re * c.imag() + im * c.real();
+    }
+}
+
+TCM_KERNEL auto count_less(
+    double const* x, std::size_t const n, double const threshold) -> std::size_t
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        count += x[i] < threshold;
+    }
+    return count;
+}
+
+TCM_KERNEL auto antiparallel(std::uint64_t const* spins,
+    std::pair<int, int> const* edges, std::size_t const number_edges,
+    int const n, std::uint64_t* masks, int* counts) -> void
+{
+    TCM_ASSERT(number_edges <= 64 && 0 < n && n <= 64);
+    // Spin 0 is the most significant of the n bits.
+    std::uint64_t result[kernel_lanes] = {};
+    for (std::size_t e = 0; e < number_edges; ++e) {
+        auto const i = static_cast<unsigned>(n - 1 - edges[e].first);
+        auto const j = static_cast<unsigned>(n - 1 - edges[e].second);
+        for (std::size_t lane = 0; lane < kernel_lanes; ++lane) {
+            result[lane] |= (((spins[lane] >> i) ^ (spins[lane] >> j)) & 1u)
+                            << e;
+        }
+    }
+    for (std::size_t lane = 0; lane < kernel_lanes; ++lane) {
+        masks[lane]  = result[lane];
+        counts[lane] = __builtin_popcountll(result[lane]);
+    }
+}
+} // namespace
+
+auto TCM_KERNEL_TABLE() noexcept -> Kernels const&
+{
+    static constexpr Kernels table{
+        &squared_norm, &norms, &scale, &count_less, &antiparallel};
+    return table;
+}
+#endif
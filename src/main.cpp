@@ -29,16 +29,29 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include "block.hpp"
+#include "dense.hpp"
 #include "diffusion.hpp"
 #include "hamiltonian.hpp"
+#include "kernels.hpp"
+#include "observables.hpp"
 #include "quantum_state.hpp"
+#include "trace.hpp"
+#include "unix_socket.hpp"
 #include <boost/exception/get_error_info.hpp>
 #include <boost/optional.hpp>
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <optional>
+#include <sstream>
+#include <string_view>
+#include <unistd.h>
 
 namespace po = boost::program_options;
 
@@ -46,39 +59,200 @@ using IStreamPtr = std::unique_ptr<std::istream, void (*)(std::istream*)>;
 using OStreamPtr = std::unique_ptr<std::ostream, void (*)(std::ostream*)>;
 
 namespace {
-auto parse_options(int argc, char** argv, IStreamPtr& input_file,
-    OStreamPtr& output_file, std::string& hamiltonian_file_name, double& lambda,
-    std::size_t& iterations, std::size_t& soft_max,
-    boost::optional<std::size_t>& hard_max) -> bool
+/// Parses sizes like "1024", "512M" or "16G" (powers of 1024).
+auto parse_size(std::string const& str) -> std::size_t
+{
+    constexpr std::string_view units = "KMGT";
+    std::size_t                end   = 0;
+    double                     value = 0.0;
+    try {
+        value = std::stod(str, &end);
+    }
+    catch (std::logic_error const&) {
+        end = 0;
+    }
+    auto scale = 1.0;
+    if (end != 0 && end + 1 == str.size()) {
+        auto const unit = units.find(str[end]);
+        if (unit != units.npos) {
+            scale = std::pow(1024.0, static_cast<double>(unit + 1));
+            ++end;
+        }
+    }
+    if (end == 0 || end != str.size() || !(value > 0)) {
+        throw std::runtime_error{"Invalid size '" + str + "'."};
+    }
+    return static_cast<std::size_t>(value * scale);
+}
+
+/// Memory which `--backend auto` may use for a dense state if no
+/// `--memory-limit` is given: half of the physical memory.
+auto default_memory_budget() -> std::size_t
+{
+    auto const pages     = sysconf(_SC_PHYS_PAGES);
+    auto const page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0) { return 0; }
+    return static_cast<std::size_t>(pages) * static_cast<std::size_t>(page_size)
+           / 2;
+}
+
+/// Parses the command line of a job. The help message and, unless `-o` is
+/// given, the results are written to `console`.
+auto parse_options(int argc, char const* const* argv, std::ostream& console,
+    std::vector<std::string>& input_file_names,
+    std::vector<IStreamPtr>& input_files,
+    OStreamPtr& output_file, OStreamPtr& metrics_file,
+    OStreamPtr& observables_file, OStreamPtr& trace_file,
+    std::string& hamiltonian_file_name, double& lambda,
+    std::size_t& iterations, PolynomialFilter& filter, std::size_t& soft_max,
+    boost::optional<std::size_t>& hard_max, std::size_t& number_shards,
+    bool& pin, std::optional<Backend>& backend,
+    std::optional<std::string>& sparse_option, std::size_t& memory_limit,
+    Truncation& truncation, std::uint64_t& seed,
+    boost::optional<std::size_t>& average_from, double& screening,
+    bool& orthogonalize, std::optional<Isa>& isa,
+    boost::optional<std::string>& sweep_file_name) -> bool
 {
-    std::string                  input_file_name;
     boost::optional<std::string> output_file_name;
+    boost::optional<std::string> metrics_file_name;
+    boost::optional<std::string> observables_file_name;
+    boost::optional<std::string> trace_file_name;
+    std::string                  filter_name;
+    std::string                  backend_name;
+    boost::optional<std::string> memory_limit_string;
+    std::string                  truncation_name;
+    std::string                  isa_name;
     po::options_description      cmdline_options{"Command-line options"};
     // clang-format off
     cmdline_options.add_options()
         ("help", "Produce the help message.")
-        ("input-file", po::value(&input_file_name)->required(),
+        ("input-file", po::value(&input_file_names)->required(),
             "File containing the initial quantum state. '-' can be used to "
-            "indicate that the initial state should be read from the standard input.")
+            "indicate that the initial state should be read from the standard "
+            "input. If several files are given, all states are propagated "
+            "together as a block, which shares the work of applying H between "
+            "them.")
         ("output-file,o", po::value(&output_file_name),
             "Where to save the final quantum state.")
         ("hamiltonian,H", po::value(&hamiltonian_file_name)->required(),
-            "The file containing the Hamiltonian specification.")
+            "The file containing the Hamiltonian specification: either lines "
+            "of the form 'J [(i, j), ...]', or a binary n×n coupling matrix "
+            "('LANCZOSJ', n as uint64, row-major doubles) for long-range "
+            "models.")
         ("lambda,L", po::value(&lambda)->default_value(1.0),
             "Value of Λ in the diffusion operator (H - Λ).")
         ("iterations,n", po::value(&iterations)->default_value(1.0),
-            "Number of application of (H - Λ) to perform.")
+            "Number of applications of the filter to perform. The state is "
+            "truncated after each application.")
+        ("filter", po::value(&filter_name)->default_value("power"),
+            "Polynomial in H to apply between truncations: 'power' for "
+            "(Λ - H)ᵏ or 'chebyshev' for the Chebyshev polynomial Tₖ which "
+            "suppresses the interval [lower, Λ] of the spectrum.")
+        ("degree,k", po::value(&filter.degree)->default_value(1),
+            "Degree k of the filter, i.e. the number of applications of H "
+            "between truncations.")
+        ("lower", po::value(&filter.lower),
+            "Lower bound of the suppressed part of the spectrum. Required for "
+            "the Chebyshev filter; should lie above the ground state energy.")
         ("max", po::value(&soft_max)->default_value(1000),
-            "Maximum number of elements to keep after each application of (H - Λ).")
+            "Maximum number of elements to keep after each application of "
+            "(H - Λ). If omitted and --memory-limit is given, the largest "
+            "value which fits into the limit is used.")
         ("hard-max", po::value(&hard_max),
-            "Initial number of buckets in the hash table. This parameter should "
-            "be chosen carefully, because too low a value will result in a lot of "
-            "rehashing, but too high a value will use more memory and result in "
-            "more cache misses.")
+            "Total capacity of the hash tables (summed over all shards). If "
+            "omitted, the capacity is predicted every iteration from the "
+            "growth observed in the previous one and the number of edges in "
+            "the Hamiltonian, which avoids both rehashing and over-allocation.")
+        ("shards", po::value(&number_shards)->default_value(1),
+            "Number of hash table shards, each filled by its own thread. Must "
+            "be a power of two not larger than 128.")
+        ("pin", po::bool_switch(&pin),
+            "Pin the worker of each shard to a core, spreading shards evenly "
+            "over NUMA nodes, and allocate its table on that node.")
+        ("backend", po::value(&backend_name)->default_value("auto"),
+            "How H|ψ〉 is accumulated: 'hash' merges contributions into the "
+            "shards as they are produced, 'sort' buffers them per shard, "
+            "radix-sorts the buffers and merges the sorted runs, 'dense' "
+            "stores all amplitudes of the S^z sector of |ψ₀〉 in an array and "
+            "never truncates. 'auto' uses 'dense' if it fits into the memory "
+            "limit (half of the physical memory by default) and none of "
+            "--max, --truncation and --screening is given, and 'sort' or "
+            "'hash' otherwise, depending on whether --memory-limit is given. "
+            "The options which truncate are rejected with '--backend dense'.")
+        ("memory-limit", po::value(&memory_limit_string),
+            "Memory available for the state and for accumulating H|ψ〉, e.g. "
+            "512M or 16G. With '--backend hash', the hash tables are sized to "
+            "fit, and once they are full, their smaller half is evicted (it "
+            "counts as truncated) and screening is tightened for the "
+            "following iterations. '--truncation stochastic' evicts nothing "
+            "and may exceed the limit. With '--backend sort', "
+            "contributions which do not fit are sorted and spilled to files "
+            "in $TMPDIR, which are merged and truncated at the end of every "
+            "step. The memory in use is shown in the progress output.")
+        ("truncation", po::value(&truncation_name)->default_value("largest"),
+            "How the state is reduced to --max elements: 'largest' keeps the "
+            "largest amplitudes, 'stochastic' keeps large amplitudes exactly "
+            "and rounds small ones stochastically to a threshold, which "
+            "preserves the state in expectation.")
+        ("seed", po::value(&seed)->default_value(0),
+            "Seed of the random numbers used by stochastic truncation.")
+        ("screening", po::value(&screening)->default_value(0.0),
+            "Do not generate contributions to H|ψ〉 smaller than this factor "
+            "times the truncation cutoff of the previous iteration (scaled to "
+            "the norm of H|ψ〉). With stochastic truncation such "
+            "contributions are generated stochastically instead. 0 disables "
+            "screening; values up to 0.1 are usually safe, larger ones screen "
+            "out too much and make the state size oscillate.")
+        ("average-from", po::value(&average_from),
+            "Starting with the given iteration (counting from 0), fix its "
+            "state as a trial vector |φ〉, compute the projected energy "
+            "〈φ|H|ψᵢ〉/〈φ|ψᵢ〉 after every iteration and report the average. "
+            "Mostly useful with stochastic truncation.")
+        ("observables", po::value(&observables_file_name),
+            "Where to write observables of the final state as a JSON object: "
+            "〈SᶻᵢSᶻⱼ〉 for all pairs, 〈Sᵢ·Sⱼ〉 on the edges of the Hamiltonian, "
+            "the distribution of the magnetisation and the structure factor "
+            "Sᶻᶻ(q) of the sites placed on a line.")
+        ("metrics", po::value(&metrics_file_name),
+            "Where to write per-iteration performance metrics (one JSON "
+            "object per line).")
+        ("trace", po::value(&trace_file_name),
+            "Where to write a timeline of what every thread was doing, in "
+            "the Chrome trace format (open it in chrome://tracing or "
+            "ui.perfetto.dev). Requires a build with -DLANCZOS_TRACING=ON.")
+        ("orthogonalize", po::bool_switch(&orthogonalize),
+            "Orthonormalise the states of a block after every iteration "
+            "(Gram-Schmidt in the order of the input files), so that they "
+            "converge to the lowest eigenstates rather than all to the ground "
+            "state.")
+        ("isa", po::value(&isa_name)->default_value("auto"),
+            "Instruction set of the hot loops: 'generic', 'sse4.2', 'avx2' or "
+            "'avx512'. 'auto' uses the best one supported by the CPU.")
+        ("sweep", po::value(&sweep_file_name),
+            "File with one point of a parameter sweep per line: Λ followed "
+            "by optional couplings which replace those of the lines of a "
+            "Heisenberg Hamiltonian, in order. Points are run one after the "
+            "other, each starting from the final state of the previous one, "
+            "and the results of every point are written as soon as it is "
+            "done. '-L' is ignored.")
+        ("serve", po::value<std::string>(),
+            "Run as a server listening on the given UNIX socket, which keeps "
+            "parsed Hamiltonians and initial states between jobs (they are "
+            "read again when the files change), as well as its threads and "
+            "hash tables. Only the user running the server may connect. A "
+            "job is the working "
+            "directory on one line followed by the other options on the "
+            "next, separated by whitespace. The reply is what 'main' would "
+            "print, with errors on lines starting with 'Error: '. Must be the "
+            "only option.")
+        ("connect", po::value<std::string>(),
+            "Send the remaining options as a job to the server listening on "
+            "the given socket and print its reply. Must be the first "
+            "option.")
     ;
     // clang-format on
     po::positional_options_description positional;
-    positional.add("input-file", 1);
+    positional.add("input-file", -1);
 
     po::variables_map vm;
     store(po::command_line_parser(argc, argv)
@@ -87,39 +261,146 @@ auto parse_options(int argc, char** argv, IStreamPtr& input_file,
               .run(),
         vm);
     if (vm.count("help")) {
-        std::cout << cmdline_options << '\n';
+        console << cmdline_options << '\n';
         return false;
     }
+    if (vm.count("serve") || vm.count("connect")) {
+        throw std::runtime_error{
+            "'--serve' and '--connect' must be the first option."};
+    }
     po::notify(vm);
 
-    if (input_file_name == "-") {
-        input_file = IStreamPtr{std::addressof(std::cin), [](auto*) {}};
+    if (input_file_names.size() > 1) {
+        for (auto const* name : {"hard-max", "pin", "backend", "memory-limit",
+                 "truncation", "screening", "average-from", "metrics",
+                 "observables", "sweep"}) {
+            if (vm.count(name) && !vm[name].defaulted()) {
+                throw std::runtime_error{"'--" + std::string{name}
+                                         + "' is not supported with several "
+                                           "input files."};
+            }
+        }
     }
-    else if (!std::filesystem::exists({input_file_name})) {
+    else if (orthogonalize) {
+        throw std::runtime_error{
+            "'--orthogonalize' requires several input files."};
+    }
+
+    if (number_shards == 0 || number_shards > 128
+        || (number_shards & (number_shards - 1)) != 0) {
         throw std::runtime_error{
-            "Input file '" + input_file_name + "' does not exist."};
+            "Number of shards must be a power of two between 1 and 128."};
+    }
+
+    if (filter_name == "power") { filter.kind = PolynomialFilter::Kind::power; }
+    else if (filter_name == "chebyshev") {
+        filter.kind = PolynomialFilter::Kind::chebyshev;
+        if (!vm.count("lower")) {
+            throw std::runtime_error{
+                "'--lower' is required when using the Chebyshev filter."};
+        }
     }
     else {
-        input_file = IStreamPtr{new std::ifstream{input_file_name},
-            [](auto* p) { std::default_delete<std::istream>{}(p); }};
-        if (!*input_file) {
+        throw std::runtime_error{"Unknown filter '" + filter_name
+                                 + "': expected 'power' or 'chebyshev'."};
+    }
+
+    if (backend_name == "auto") { backend = std::nullopt; }
+    else if (backend_name == "hash") {
+        backend = Backend::hash;
+    }
+    else if (backend_name == "sort") {
+        backend = Backend::sort;
+    }
+    else if (backend_name == "dense") {
+        backend = Backend::dense;
+    }
+    else {
+        throw std::runtime_error{
+            "Unknown backend '" + backend_name
+            + "': expected 'auto', 'hash', 'sort' or 'dense'."};
+    }
+    // The first of the given options which only the sparse backends use.
+    sparse_option = std::nullopt;
+    for (auto const* name : {"max", "truncation", "screening"}) {
+        if (!sparse_option && vm.count(name) && !vm[name].defaulted()) {
+            sparse_option = name;
+        }
+    }
+
+    if (truncation_name == "largest") { truncation = Truncation::largest; }
+    else if (truncation_name == "stochastic") {
+        truncation = Truncation::stochastic;
+    }
+    else {
+        throw std::runtime_error{"Unknown truncation '" + truncation_name
+                                 + "': expected 'largest' or 'stochastic'."};
+    }
+
+    isa = std::nullopt;
+    if (isa_name != "auto") {
+        for (auto const candidate :
+            {Isa::generic, Isa::sse4_2, Isa::avx2, Isa::avx512}) {
+            if (isa_name == to_string(candidate)) { isa = candidate; }
+        }
+        if (!isa.has_value()) {
+            throw std::runtime_error{"Unknown instruction set '" + isa_name
+                                     + "': expected 'auto', 'generic', "
+                                       "'sse4.2', 'avx2' or 'avx512'."};
+        }
+    }
+
+    memory_limit = 0;
+    if (memory_limit_string) {
+        memory_limit = parse_size(*memory_limit_string);
+        // 0 asks `run` to derive it from the limit. Blocks, which would
+        // need a share for every state, rejected the limit above.
+        if (vm["max"].defaulted()) { soft_max = 0; }
+    }
+
+    if (std::count(std::begin(input_file_names), std::end(input_file_names),
+            "-")
+        > 1) {
+        throw std::runtime_error{
+            "The standard input can only be used for one input file."};
+    }
+    for (auto const& input_file_name : input_file_names) {
+        if (input_file_name == "-") {
+            input_files.emplace_back(std::addressof(std::cin), [](auto*) {});
+        }
+        else if (!std::filesystem::exists({input_file_name})) {
             throw std::runtime_error{
-                "Could not open '" + input_file_name + "' for reading."};
+                "Input file '" + input_file_name + "' does not exist."};
+        }
+        else {
+            input_files.emplace_back(new std::ifstream{input_file_name},
+                [](auto* p) { std::default_delete<std::istream>{}(p); });
+            if (!*input_files.back()) {
+                throw std::runtime_error{
+                    "Could not open '" + input_file_name + "' for reading."};
+            }
         }
     }
 
+    if (sweep_file_name && !std::filesystem::exists({*sweep_file_name})) {
+        throw std::runtime_error{
+            "Sweep file '" + *sweep_file_name + "' does not exist."};
+    }
+
     if (!output_file_name) {
-        output_file = OStreamPtr{std::addressof(std::cout), [](auto*) {}};
+        output_file = OStreamPtr{std::addressof(console), [](auto*) {}};
     }
     else {
         // Issue #1: Prevent the user from overwriting the input file.
-        if (std::filesystem::exists({*output_file_name})
-            && input_file_name != "-"
-            && std::filesystem::equivalent(
-                   {*output_file_name}, {input_file_name})) {
-            throw std::runtime_error{"Input file '" + input_file_name
-                                     + "' and output file '" + *output_file_name
-                                     + "' are the same."};
+        for (auto const& input_file_name : input_file_names) {
+            if (std::filesystem::exists({*output_file_name})
+                && input_file_name != "-"
+                && std::filesystem::equivalent(
+                       {*output_file_name}, {input_file_name})) {
+                throw std::runtime_error{
+                    "Input file '" + input_file_name + "' and output file '"
+                    + *output_file_name + "' are the same."};
+            }
         }
         output_file = OStreamPtr{new std::ofstream{*output_file_name},
             [](auto* p) { std::default_delete<std::ostream>{}(p); }};
@@ -128,55 +409,643 @@ auto parse_options(int argc, char** argv, IStreamPtr& input_file,
                 "Could not open '" + *output_file_name + "' for writing."};
         }
     }
+
+    if (metrics_file_name) {
+        metrics_file = OStreamPtr{new std::ofstream{*metrics_file_name},
+            [](auto* p) { std::default_delete<std::ostream>{}(p); }};
+        if (!*metrics_file) {
+            throw std::runtime_error{
+                "Could not open '" + *metrics_file_name + "' for writing."};
+        }
+    }
+
+    if (trace_file_name) {
+#if !defined(TCM_TRACING)
+        // Checked here rather than by start_tracing, so that a build
+        // without tracing does not truncate the file.
+        throw std::runtime_error{
+            "Tracing is not compiled in, rebuild with -DLANCZOS_TRACING=ON."};
+#endif
+        trace_file = OStreamPtr{new std::ofstream{*trace_file_name},
+            [](auto* p) { std::default_delete<std::ostream>{}(p); }};
+        if (!*trace_file) {
+            throw std::runtime_error{
+                "Could not open '" + *trace_file_name + "' for writing."};
+        }
+    }
+
+    if (observables_file_name) {
+        observables_file = OStreamPtr{new std::ofstream{*observables_file_name},
+            [](auto* p) { std::default_delete<std::ostream>{}(p); }};
+        if (!*observables_file) {
+            throw std::runtime_error{"Could not open '" + *observables_file_name
+                                     + "' for writing."};
+        }
+    }
     return true;
 }
 
+/// Reads either a Heisenberg Hamiltonian (text) or a binary coupling matrix.
 auto read_hamiltonian(std::string const& hamiltonian_file_name) -> Hamiltonian
 {
     if (!std::filesystem::exists({hamiltonian_file_name})) {
         throw std::runtime_error{"Hamiltonian specification file '"
                                  + hamiltonian_file_name + "' does not exist."};
     }
-    std::ifstream hamiltonian_file{hamiltonian_file_name};
+    std::ifstream hamiltonian_file{
+        hamiltonian_file_name, std::ios::in | std::ios::binary};
     if (!hamiltonian_file) {
         throw std::runtime_error{
             "Could not open '" + hamiltonian_file_name + "' for reading."};
     }
 
+    if (is_binary_couplings(hamiltonian_file)) {
+        CouplingMatrix couplings;
+        read_binary(hamiltonian_file, couplings);
+        return couplings;
+    }
     Heisenberg hamiltonian;
     if (!(hamiltonian_file >> hamiltonian) && !hamiltonian_file.eof()) {
         throw std::runtime_error{"Failed to parse the Hamiltonian."};
     }
-    return {std::move(hamiltonian)};
+    return hamiltonian;
+}
+
+/// \brief One point of a parameter sweep.
+struct SweepPoint {
+    double              lambda;
+    std::vector<double> couplings; ///< Empty to keep those of the file.
+};
+
+auto read_sweep(std::string const& file_name) -> std::vector<SweepPoint>
+{
+    std::ifstream in{file_name};
+    if (!in) {
+        throw std::runtime_error{
+            "Could not open '" + file_name + "' for reading."};
+    }
+    std::vector<SweepPoint> points;
+    std::string             line;
+    while (std::getline(in, line)) {
+        std::istringstream line_stream{line};
+        SweepPoint         point;
+        if (!(line_stream >> point.lambda)) {
+            // Empty lines and comments.
+            line_stream.clear();
+            char first = '#';
+            if ((line_stream >> first) && first != '#') {
+                throw std::runtime_error{"Failed to parse the sweep: '"
+                                         + line + "'."};
+            }
+            continue;
+        }
+        double coupling;
+        while (line_stream >> coupling) {
+            point.couplings.push_back(coupling);
+        }
+        if (!line_stream.eof()) {
+            throw std::runtime_error{
+                "Failed to parse the sweep: '" + line + "'."};
+        }
+        points.push_back(std::move(point));
+    }
+    if (points.empty()) {
+        throw std::runtime_error{"Sweep '" + file_name + "' is empty."};
+    }
+    return points;
+}
+
+/// Returns `hamiltonian` with the couplings of its lines replaced by
+/// `couplings`.
+auto with_couplings(Hamiltonian const& hamiltonian,
+    std::vector<double> const& couplings) -> Hamiltonian
+{
+    auto const* heisenberg = hamiltonian.target<Heisenberg>();
+    if (heisenberg == nullptr) {
+        throw std::runtime_error{
+            "Couplings of a sweep require a Heisenberg Hamiltonian."};
+    }
+    auto specs = heisenberg->specs();
+    if (specs.size() != couplings.size()) {
+        throw std::runtime_error{"A point of the sweep has "
+                                 + std::to_string(couplings.size())
+                                 + " couplings, but the Hamiltonian has "
+                                 + std::to_string(specs.size()) + " lines."};
+    }
+    for (std::size_t i = 0; i < specs.size(); ++i) {
+        specs[i].first = couplings[i];
+    }
+    return Heisenberg{std::move(specs)};
+}
+
+/// \brief Hamiltonians and initial states which a server keeps between jobs.
+///
+/// Entries are keyed by absolute file name and are read again if the
+/// modification time of the file has changed. Entries whose file has
+/// disappeared are dropped, and the least recently used ones are evicted
+/// once the cache holds more than `capacity` bytes. Hash tables of the
+/// states of finished jobs are kept for the next ones, up to another
+/// `capacity` bytes.
+class JobCache {
+    template <class T> struct Entry {
+        std::filesystem::file_time_type time;
+        std::shared_ptr<T const>        value;
+        std::size_t                     bytes = 0;
+        std::uint64_t                   used  = 0; ///< Time of the last lookup
+    };
+
+    std::size_t                                _capacity;
+    std::uint64_t                              _clock;
+    std::map<std::string, Entry<Hamiltonian>> _hamiltonians;
+    std::map<std::string, Entry<std::vector<QuantumState::value_type>>>
+        _states;
+    std::shared_ptr<TableCache> _tables;
+
+    /// Approximate number of bytes of an entry. Edge lists and coupling
+    /// matrices both need about two words per edge.
+    static auto footprint(Hamiltonian const& x) -> std::size_t
+    {
+        return 2 * sizeof(double) * number_edges(x);
+    }
+    static auto footprint(std::vector<QuantumState::value_type> const& x)
+        -> std::size_t
+    {
+        return sizeof(QuantumState::value_type) * x.size();
+    }
+
+    auto evict() -> void
+    {
+        auto const drop_vanished = [](auto& entries) {
+            for (auto i = std::begin(entries); i != std::end(entries);) {
+                i = std::filesystem::exists(i->first) ? std::next(i)
+                                                      : entries.erase(i);
+            }
+        };
+        drop_vanished(_hamiltonians);
+        drop_vanished(_states);
+        for (;;) {
+            std::size_t   bytes  = 0;
+            std::uint64_t oldest = _clock;
+            auto const    scan   = [&bytes, &oldest](auto const& entries) {
+                for (auto const& [_, entry] : entries) {
+                    bytes += entry.bytes;
+                    oldest = std::min(oldest, entry.used);
+                }
+            };
+            scan(_hamiltonians);
+            scan(_states);
+            // The entry of the current lookup is never evicted.
+            if (bytes <= _capacity || oldest == _clock) { return; }
+            auto const erase = [oldest](auto& entries) {
+                auto const i = std::find_if(std::begin(entries),
+                    std::end(entries), [oldest](auto const& x) {
+                        return x.second.used == oldest;
+                    });
+                if (i != std::end(entries)) { entries.erase(i); }
+            };
+            erase(_hamiltonians);
+            erase(_states);
+        }
+    }
+
+    template <class T, class Load>
+    auto lookup(std::map<std::string, Entry<T>>& entries,
+        std::string const& file_name, Load&& load) -> std::shared_ptr<T const>
+    {
+        auto const path = std::filesystem::absolute(file_name).string();
+        // Let `load` report missing files.
+        if (!std::filesystem::exists(path)) {
+            return std::make_shared<T const>(load());
+        }
+        auto const time  = std::filesystem::last_write_time(path);
+        auto&      entry = entries[path];
+        if (entry.value == nullptr || entry.time != time) {
+            entry.value = nullptr;
+            entry.value = std::make_shared<T const>(load());
+            entry.time  = time;
+            entry.bytes = footprint(*entry.value);
+        }
+        entry.used = ++_clock;
+        auto value = entry.value;
+        evict();
+        return value;
+    }
+
+  public:
+    explicit JobCache(std::size_t const capacity)
+        : _capacity{capacity}
+        , _clock{0}
+        , _hamiltonians{}
+        , _states{}
+        , _tables{std::make_shared<TableCache>(capacity)}
+    {
+    }
+
+    auto tables() const noexcept { return _tables; }
+
+    auto hamiltonian(std::string const& file_name)
+        -> std::shared_ptr<Hamiltonian const>
+    {
+        return lookup(_hamiltonians, file_name,
+            [&file_name]() { return read_hamiltonian(file_name); });
+    }
+
+    /// Returns the elements of the state stored in `file_name`. `in` must
+    /// be open for reading that file.
+    auto state(std::string const& file_name, std::istream& in)
+        -> std::shared_ptr<std::vector<QuantumState::value_type> const>
+    {
+        return lookup(_states, file_name, [&in]() {
+            QuantumState state{0, 0, 1};
+            in >> state;
+            std::vector<QuantumState::value_type> elements;
+            elements.reserve(state.size());
+            state.for_each([&elements](auto const& x) {
+                elements.push_back(x);
+            });
+            return elements;
+        });
+    }
+};
+
+auto load_hamiltonian(std::string const& file_name, JobCache* cache)
+    -> std::shared_ptr<Hamiltonian const>
+{
+    if (cache != nullptr) { return cache->hamiltonian(file_name); }
+    return std::make_shared<Hamiltonian const>(read_hamiltonian(file_name));
+}
+
+/// Reads the initial state stored in `file_name` from `in`, unless `cache`
+/// already holds it.
+auto read_state(std::istream& in, std::string const& file_name,
+    JobCache* cache, QuantumState& state) -> void
+{
+    if (cache == nullptr || file_name == "-") {
+        in >> state;
+        return;
+    }
+    state.clear();
+    for (auto const& x : *cache->state(file_name, in)) {
+        state.insert(QuantumState::value_type{x});
+    }
+}
+
+/// Resolves `--backend auto` and switches `state` to the dense representation
+/// if needed. The dense backend never truncates, so `auto` only selects it if
+/// `sparse_option` (see `parse_options`) is not set, and an explicit
+/// `--backend dense` rejects it.
+auto select_backend(QuantumState& state, std::optional<Backend> backend,
+    std::optional<std::string> const& sparse_option,
+    std::size_t const memory_limit, bool const averaging) -> void
+{
+    auto const sector   = smallest_basis(state);
+    if (!backend.has_value()) {
+        auto const budget =
+            memory_limit != 0 ? memory_limit : default_memory_budget();
+        auto const fits =
+            !sparse_option && sector.has_value()
+            && DenseBasis::dimension(sector->first, sector->second)
+                   <= budget / dense_footprint(1, averaging);
+        backend = fits ? Backend::dense
+                       : (memory_limit != 0 ? Backend::sort : Backend::hash);
+    }
+    if (*backend != Backend::dense) {
+        state.backend(*backend);
+        return;
+    }
+    if (sparse_option) {
+        throw std::runtime_error{"'--" + *sparse_option
+                                 + "' has no effect with the dense backend."};
+    }
+    if (!sector.has_value()) {
+        throw std::runtime_error{"'--backend dense' requires all spin "
+                                 "configurations to have the same length, "
+                                 "which may not exceed 63."};
+    }
+    state.make_dense(
+        std::make_shared<DenseBasis const>(sector->first, sector->second));
+}
+
+auto write_header(std::ostream& out, double const lambda,
+    PolynomialFilter const& filter, std::size_t const iterations) -> void
+{
+    out << "# Result of evaluating Pₖ(H)ⁿ|ψ₀〉for\n"
+        << "# Pₖ(H) = "
+        << (filter.kind == PolynomialFilter::Kind::power ? "(Λ - H)ᵏ"
+                                                         : "Tₖ((c - H) / e)")
+        << '\n'
+        << "# Λ = " << lambda << '\n'
+        << "# k = " << filter.degree << '\n'
+        << "# n = " << iterations << '\n'
+        << "# Kernels: " << to_string(current_isa()) << '\n';
+    if (filter.kind == PolynomialFilter::Kind::chebyshev) {
+        out << "# [lower, Λ] = [" << filter.lower << ", " << lambda << "]\n";
+    }
+}
+
+/// Propagates the states from `input_files` together as a BlockState and
+/// writes them to `out` one after the other.
+auto run_block(std::vector<IStreamPtr> const& input_files,
+    std::vector<std::string> const& input_file_names, JobCache* cache,
+    std::ostream& out, Hamiltonian const& hamiltonian, double const lambda,
+    PolynomialFilter const& filter, std::size_t const iterations,
+    std::size_t const soft_max, std::size_t const number_shards,
+    bool const orthogonalize) -> void
+{
+    std::vector<QuantumState> columns;
+    for (std::size_t i = 0; i < input_files.size(); ++i) {
+        columns.emplace_back(soft_max, 0, number_shards);
+        read_state(
+            *input_files[i], input_file_names[i], cache, columns.back());
+    }
+    auto block = BlockState::from_columns(columns);
+    columns.clear();
+
+    write_header(out, lambda, filter, iterations);
+    auto const initial_energies = energies(hamiltonian, block);
+    for (std::size_t j = 0; j < initial_energies.size(); ++j) {
+        out << "# E₀[" << j << "] = 〈ψ₀|H|ψ₀〉= " << initial_energies[j]
+            << '\n';
+    }
+    block = diffusion_loop(
+        lambda, filter, hamiltonian, block, iterations, orthogonalize);
+    auto const final_energies = energies(hamiltonian, block);
+    for (std::size_t j = 0; j < final_energies.size(); ++j) {
+        out << "# => E[" << j << "] = " << final_energies[j] << '\n';
+    }
+    for (std::size_t j = 0; j < block.block_size(); ++j) {
+        out << "# State " << j << '\n' << block.column(j);
+    }
+}
+
+/// \brief Records spans while a job runs, if `out` is not `nullptr`.
+class TraceSession {
+    std::ostream* _out;
+
+  public:
+    explicit TraceSession(std::ostream* const out) : _out{out}
+    {
+        if (_out != nullptr) { start_tracing(); }
+    }
+
+    TraceSession(TraceSession const&) = delete;
+    TraceSession& operator=(TraceSession const&) = delete;
+
+    /// A job which failed leaves no trace.
+    ~TraceSession()
+    {
+        if (_out != nullptr) { stop_tracing(); }
+    }
+
+    /// Writes the spans recorded so far.
+    auto finish() -> void
+    {
+        if (_out == nullptr) { return; }
+        stop_tracing();
+        write_trace(*_out);
+        _out = nullptr;
+    }
+};
+
+/// Runs the job described by the command line `argv`. `cache` is only
+/// given to jobs of a server.
+auto run(int argc, char const* const* argv, std::ostream& console,
+    JobCache* cache) -> void
+{
+    std::vector<std::string>     input_file_names;
+    std::vector<IStreamPtr>      input_files;
+    OStreamPtr                   output_file{nullptr, [](auto*) {}};
+    OStreamPtr                   metrics_file{nullptr, [](auto*) {}};
+    OStreamPtr                   observables_file{nullptr, [](auto*) {}};
+    OStreamPtr                   trace_file{nullptr, [](auto*) {}};
+    std::string                  hamiltonian_file_name;
+    double                       lambda;
+    std::size_t                  iterations;
+    PolynomialFilter             filter;
+    std::size_t                  soft_max;
+    boost::optional<std::size_t> hard_max;
+    std::size_t                  number_shards;
+    bool                         pin;
+    std::optional<Backend>       backend;
+    std::optional<std::string>   sparse_option;
+    std::size_t                  memory_limit;
+    Truncation                   truncation;
+    std::uint64_t                seed;
+    boost::optional<std::size_t> average_from;
+    double                       screening;
+    bool                         orthogonalize;
+    std::optional<Isa>           isa;
+    boost::optional<std::string> sweep_file_name;
+
+    auto const proceed = parse_options(argc, argv, console, input_file_names,
+        input_files, output_file, metrics_file, observables_file, trace_file,
+        hamiltonian_file_name, lambda, iterations, filter, soft_max, hard_max,
+        number_shards, pin, backend, sparse_option, memory_limit, truncation,
+        seed, average_from, screening, orthogonalize, isa, sweep_file_name);
+    if (!proceed) { return; }
+    if (cache != nullptr
+        && std::count(std::begin(input_file_names),
+               std::end(input_file_names), "-")
+               > 0) {
+        throw std::runtime_error{
+            "Jobs of a server cannot read from the standard input."};
+    }
+    // A server must not keep the choice of a previous job.
+    select_isa(isa.value_or(detected_isa()));
+    TraceSession trace{trace_file.get()};
+
+    auto const hamiltonian = load_hamiltonian(hamiltonian_file_name, cache);
+    if (input_files.size() > 1) {
+        run_block(input_files, input_file_names, cache, *output_file,
+            *hamiltonian, lambda, filter, iterations, soft_max, number_shards,
+            orthogonalize);
+        trace.finish();
+        return;
+    }
+
+    auto const derived = soft_max == 0;
+    if (derived) {
+        soft_max = QuantumState::soft_max_within(memory_limit,
+            static_cast<double>(number_edges(*hamiltonian) + 1),
+            live_vectors(filter), number_shards,
+            backend.value_or(Backend::sort));
+        if (soft_max == 0) {
+            throw std::runtime_error{
+                "Memory limit is too small to hold a single configuration."};
+        }
+    }
+    QuantumState state{soft_max, hard_max ? *hard_max : 0, number_shards};
+    read_state(*input_files.front(), input_file_names.front(), cache, state);
+    state.memory_limit(memory_limit);
+    state.truncation(truncation, seed);
+    state.screening(screening);
+    if (cache != nullptr) { state.table_cache(cache->tables()); }
+    if (pin) {
+        state.placement(std::make_shared<Placement const>(
+            Placement::spread(number_shards)));
+    }
+    select_backend(state, backend, sparse_option, memory_limit,
+        average_from.has_value());
+
+    // Without a sweep there is a single point. Otherwise every point starts
+    // from the final state of the previous one.
+    auto const points = sweep_file_name
+                            ? read_sweep(*sweep_file_name)
+                            : std::vector<SweepPoint>{{lambda, {}}};
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        auto const& point = points[i];
+        auto const  h =
+            point.couplings.empty()
+                ? hamiltonian
+                : std::make_shared<Hamiltonian const>(
+                    with_couplings(*hamiltonian, point.couplings));
+        state.max_growth(static_cast<double>(number_edges(*h) + 1));
+        auto const initial_energy = energy(*h, state);
+        write_header(*output_file, point.lambda, filter, iterations);
+        if (points.size() > 1) {
+            *output_file << "# Sweep point " << (i + 1) << "/"
+                         << points.size();
+            for (auto const coupling : point.couplings) {
+                *output_file << ' ' << coupling;
+            }
+            *output_file << '\n';
+        }
+        if (state.basis() != nullptr) {
+            *output_file << "# Dense basis of " << state.basis()->size()
+                         << " configurations\n";
+        }
+        else if (derived) {
+            *output_file << "# --max = " << soft_max
+                         << " (from the memory limit)\n";
+        }
+        *output_file << "# E₀ = 〈ψ₀|H|ψ₀〉= " << initial_energy << '\n';
+        EnergyAverage average;
+        if (average_from) { average.skip = *average_from; }
+        state = diffusion_loop(point.lambda, filter, *h, state, iterations,
+            metrics_file.get(), average_from ? &average : nullptr);
+        auto const final_energy = energy(*h, state);
+        if (average.count > 0) {
+            *output_file << "# <E> = " << average.mean() << " ± "
+                         << average.standard_error() << " (" << average.count
+                         << " iterations";
+            if (average.skipped > 0) {
+                *output_file << ", " << average.skipped
+                             << " skipped with 〈φ|ψᵢ〉= 0";
+            }
+            *output_file << ")\n";
+        }
+        *output_file << "# => E = " << final_energy << '\n'
+                     << state << std::flush;
+        if (observables_file) {
+            *observables_file << measure(state, bonds(*h)) << std::endl;
+        }
+    }
+    trace.finish();
+}
+
+/// The last line of the reply to a job is `job_done` if the job succeeded and
+/// "Error: " followed by the message otherwise. A reply without either was
+/// cut short.
+constexpr std::string_view job_done = "Done.";
+
+/// Serves jobs sent to the UNIX socket at `path` one after the other, until
+/// the process is killed.
+auto serve(std::string const& path) -> void
+{
+    UnixListener listener{path};
+    // An eighth of the physical memory for inputs and another one for spare
+    // tables. Jobs get half of it by default.
+    JobCache     cache{default_memory_budget() / 4};
+    auto const   directory = std::filesystem::current_path();
+    std::cerr << "Listening on " << path << '\n';
+    for (;;) {
+        SocketBuffer  buffer{listener.accept()};
+        std::iostream stream{std::addressof(buffer)};
+        std::string   working_directory;
+        std::string   line;
+        if (!std::getline(stream, working_directory)
+            || !std::getline(stream, line)) {
+            continue;
+        }
+        std::istringstream       words{line};
+        std::vector<std::string> args{"main"};
+        std::copy(std::istream_iterator<std::string>{words},
+            std::istream_iterator<std::string>{}, std::back_inserter(args));
+        std::vector<char const*> argv;
+        for (auto const& arg : args) {
+            argv.push_back(arg.c_str());
+        }
+        try {
+            std::filesystem::current_path(working_directory);
+            run(static_cast<int>(argv.size()), argv.data(), stream,
+                std::addressof(cache));
+            stream << job_done << '\n';
+        }
+        catch (std::exception const& e) {
+            // The status must be a single line.
+            std::string message{e.what()};
+            std::replace(std::begin(message), std::end(message), '\n', ' ');
+            stream << "Error: " << message << '\n';
+        }
+        catch (...) {
+            stream << "Error: Unknown error occured.\n";
+        }
+        std::filesystem::current_path(directory);
+        stream.flush();
+    }
+}
+
+/// Sends `argv` as a job to the server at `path`, prints the reply, and
+/// returns whether the job succeeded.
+auto run_client(
+    std::string const& path, int argc, char const* const* argv) -> bool
+{
+    SocketBuffer  buffer{unix_connect(path)};
+    std::iostream stream{std::addressof(buffer)};
+    stream << std::filesystem::current_path().string() << '\n';
+    for (auto i = 0; i < argc; ++i) {
+        std::string_view const arg{argv[i]};
+        if (arg.empty() || arg.find_first_of(" \t\n") != arg.npos) {
+            throw std::runtime_error{"Option '" + std::string{arg}
+                                     + "' cannot be sent to a server."};
+        }
+        stream << (i != 0 ? " " : "") << arg;
+    }
+    stream << '\n';
+    buffer.shutdown_output();
+    // Every line is printed once the next one has arrived, so that the last
+    // one can be checked for the status.
+    std::optional<std::string> last;
+    std::string                line;
+    while (std::getline(stream, line)) {
+        if (last.has_value()) { std::cout << *last << '\n'; }
+        last = std::move(line);
+    }
+    if (last == job_done) { return true; }
+    if (last.has_value() && last->rfind("Error: ", 0) == 0) {
+        std::cerr << *last << '\n';
+        return false;
+    }
+    if (last.has_value()) { std::cout << *last << '\n'; }
+    std::cerr << "Error: The server closed the connection before the job "
+                 "finished.\n";
+    return false;
 }
 } // namespace
 
 int main(int argc, char** argv)
 {
     try {
-        IStreamPtr                   input_file{nullptr, [](auto*) {}};
-        OStreamPtr                   output_file{nullptr, [](auto*) {}};
-        std::string                  hamiltonian_file_name;
-        double                       lambda;
-        std::size_t                  iterations;
-        std::size_t                  soft_max;
-        boost::optional<std::size_t> hard_max;
-
-        auto const proceed = parse_options(argc, argv, input_file, output_file,
-            hamiltonian_file_name, lambda, iterations, soft_max, hard_max);
-        if (!proceed) { return EXIT_SUCCESS; }
-
-        QuantumState state{soft_max, hard_max ? *hard_max : 2 * soft_max, 1};
-        *input_file >> state;
-        auto const hamiltonian    = read_hamiltonian(hamiltonian_file_name);
-        auto const initial_energy = energy(hamiltonian, state);
-        *output_file << "# Result of evaluating (Λ - H)ⁿ|ψ₀〉for\n"
-                     << "# Λ = " << lambda << '\n'
-                     << "# n = " << iterations << '\n'
-                     << "# E₀ = 〈ψ₀|H|ψ₀〉= " << initial_energy << '\n';
-        state = diffusion_loop(lambda, hamiltonian, state, iterations);
-        auto const final_energy = energy(hamiltonian, state);
-        *output_file << "# => E = " << final_energy << '\n' << state;
+        std::string_view const first{argc > 1 ? argv[1] : ""};
+        if (first == "--serve" && argc == 3) {
+            serve(argv[2]);
+            return EXIT_SUCCESS;
+        }
+        if (first == "--connect" && argc > 2) {
+            return run_client(argv[2], argc - 3, argv + 3) ? EXIT_SUCCESS
+                                                           : EXIT_FAILURE;
+        }
+        run(argc, argv, std::cout, nullptr);
         return EXIT_SUCCESS;
     }
     catch (std::exception const& e) {
@@ -0,0 +1,229 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "diffusion.hpp"
+#include "distributed.hpp"
+#include "hamiltonian.hpp"
+#include "quantum_state.hpp"
+#include <boost/exception/get_error_info.hpp>
+#include <boost/optional.hpp>
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <iostream>
+#include <mpi.h>
+
+// Distributed-memory version of `main`. Configurations are owned by MPI
+// ranks; the initial state is read and the final state is written by rank 0
+// only. Example:
+//
+//     mpirun -np 4 ./main_mpi Kagome-12.in -H Kagome-12.hamiltonian -n 100
+
+namespace po = boost::program_options;
+
+namespace {
+struct Options {
+    std::string                  input_file_name;
+    boost::optional<std::string> output_file_name;
+    std::string                  hamiltonian_file_name;
+    double                       lambda;
+    std::size_t                  iterations;
+    PolynomialFilter             filter;
+    std::size_t                  soft_max;
+    boost::optional<std::size_t> hard_max;
+    std::size_t                  number_shards;
+};
+
+auto parse_options(int argc, char** argv, Options& options) -> bool
+{
+    std::string             filter_name;
+    po::options_description cmdline_options{"Command-line options"};
+    // clang-format off
+    cmdline_options.add_options()
+        ("help", "Produce the help message.")
+        ("input-file", po::value(&options.input_file_name)->required(),
+            "File containing the initial quantum state.")
+        ("output-file,o", po::value(&options.output_file_name),
+            "Where to save the final quantum state.")
+        ("hamiltonian,H", po::value(&options.hamiltonian_file_name)->required(),
+            "The file containing the Hamiltonian specification.")
+        ("lambda,L", po::value(&options.lambda)->default_value(1.0),
+            "Value of Λ in the diffusion operator (H - Λ).")
+        ("iterations,n", po::value(&options.iterations)->default_value(1),
+            "Number of applications of the filter to perform.")
+        ("filter", po::value(&filter_name)->default_value("power"),
+            "Polynomial in H to apply between truncations: 'power' or "
+            "'chebyshev'.")
+        ("degree,k", po::value(&options.filter.degree)->default_value(1),
+            "Degree k of the filter.")
+        ("lower", po::value(&options.filter.lower),
+            "Lower bound of the suppressed part of the spectrum (Chebyshev).")
+        ("max", po::value(&options.soft_max)->default_value(1000),
+            "Maximum number of elements (summed over all ranks) to keep after "
+            "each application of the filter.")
+        ("hard-max", po::value(&options.hard_max),
+            "Capacity of the hash tables of one rank. Chosen automatically if "
+            "omitted.")
+        ("shards", po::value(&options.number_shards)->default_value(1),
+            "Number of hash table shards per rank.")
+    ;
+    // clang-format on
+    po::positional_options_description positional;
+    positional.add("input-file", 1);
+
+    po::variables_map vm;
+    store(po::command_line_parser(argc, argv)
+              .options(cmdline_options)
+              .positional(positional)
+              .run(),
+        vm);
+    if (vm.count("help")) {
+        std::cout << cmdline_options << '\n';
+        return false;
+    }
+    po::notify(vm);
+
+    if (options.number_shards == 0 || options.number_shards > 128
+        || (options.number_shards & (options.number_shards - 1)) != 0) {
+        throw std::runtime_error{
+            "Number of shards must be a power of two between 1 and 128."};
+    }
+    if (filter_name == "power") {
+        options.filter.kind = PolynomialFilter::Kind::power;
+    }
+    else if (filter_name == "chebyshev") {
+        options.filter.kind = PolynomialFilter::Kind::chebyshev;
+        if (!vm.count("lower")) {
+            throw std::runtime_error{
+                "'--lower' is required when using the Chebyshev filter."};
+        }
+    }
+    else {
+        throw std::runtime_error{"Unknown filter '" + filter_name
+                                 + "': expected 'power' or 'chebyshev'."};
+    }
+    return true;
+}
+
+auto read_hamiltonian(std::string const& hamiltonian_file_name) -> Heisenberg
+{
+    std::ifstream hamiltonian_file{hamiltonian_file_name};
+    if (!hamiltonian_file) {
+        throw std::runtime_error{
+            "Could not open '" + hamiltonian_file_name + "' for reading."};
+    }
+    Heisenberg hamiltonian;
+    if (!(hamiltonian_file >> hamiltonian) && !hamiltonian_file.eof()) {
+        throw std::runtime_error{"Failed to parse the Hamiltonian."};
+    }
+    return hamiltonian;
+}
+
+auto run(int argc, char** argv) -> int
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    Options options;
+    if (!parse_options(argc, argv, options)) { return EXIT_SUCCESS; }
+
+    auto const heisenberg = read_hamiltonian(options.hamiltonian_file_name);
+    Hamiltonian const hamiltonian{heisenberg};
+
+    QuantumState initial{options.soft_max,
+        options.hard_max ? *options.hard_max : 0, options.number_shards};
+    initial.max_growth(static_cast<double>(heisenberg.number_edges() + 1));
+    if (rank == 0) {
+        std::ifstream input_file{options.input_file_name};
+        if (!input_file) {
+            throw std::runtime_error{"Could not open '"
+                                     + options.input_file_name
+                                     + "' for reading."};
+        }
+        input_file >> initial;
+    }
+    auto state = DistributedState::scatter(MPI_COMM_WORLD, initial);
+
+    std::unique_ptr<std::ofstream> output_file;
+    if (rank == 0 && options.output_file_name) {
+        output_file =
+            std::make_unique<std::ofstream>(*options.output_file_name);
+        if (!*output_file) {
+            throw std::runtime_error{"Could not open '"
+                                     + *options.output_file_name
+                                     + "' for writing."};
+        }
+    }
+    std::ostream& out = output_file != nullptr
+                            ? *output_file
+                            : static_cast<std::ostream&>(std::cout);
+
+    int number_ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &number_ranks);
+    auto const initial_energy = energy(hamiltonian, state);
+    if (rank == 0) {
+        out << "# Result of evaluating Pₖ(H)ⁿ|ψ₀〉for\n"
+            << "# Λ = " << options.lambda << '\n'
+            << "# k = " << options.filter.degree << '\n'
+            << "# n = " << options.iterations << '\n'
+            << "# ranks = " << number_ranks << '\n'
+            << "# E₀ = 〈ψ₀|H|ψ₀〉= " << initial_energy << '\n';
+    }
+    state = diffusion_loop(options.lambda, options.filter, hamiltonian, state,
+        options.iterations);
+    auto const final_energy = energy(hamiltonian, state);
+    if (rank == 0) { out << "# => E = " << final_energy << '\n'; }
+    state.write(out);
+    return EXIT_SUCCESS;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+    auto status = EXIT_FAILURE;
+    try {
+        status = run(argc, argv);
+    }
+    catch (std::exception const& e) {
+        auto const* st = boost::get_error_info<errinfo_backtrace>(e);
+        std::cerr << "Error: " << e.what() << '\n';
+        if (st != nullptr) { std::cerr << "Backtrace:\n" << *st << '\n'; }
+        // Other ranks are most likely blocked in a collective.
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    catch (...) {
+        std::cerr << "Error: "
+                  << "Unknown error occured." << '\n';
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Finalize();
+    return status;
+}
@@ -0,0 +1,109 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "metrics.hpp"
+#include "quantum_state.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+/// A number in the JSON output. JSON has no NaN or infinity, so values
+/// which are not finite are written as `null`.
+struct JsonNumber {
+    double value;
+};
+
+auto operator<<(std::ostream& out, JsonNumber const x) -> std::ostream&
+{
+    if (!std::isfinite(x.value)) { return out << "null"; }
+    return out << x.value;
+}
+} // namespace
+
+auto IterationMetrics::record(
+    QuantumStateBuilder const& builder, QuantumState const& psi) -> void
+{
+    auto const& updaters = builder.updaters();
+    auto const& tables   = psi.tables();
+    TCM_ASSERT(updaters.size() == tables.size());
+    shards.resize(tables.size());
+    auto last = std::chrono::steady_clock::time_point{};
+    for (auto const& updater : updaters) {
+        last = std::max(last, updater->statistics().finished);
+    }
+    for (std::size_t i = 0; i < tables.size(); ++i) {
+        auto const& stats = updaters[i]->statistics();
+        generated += stats.generated;
+        dropped += stats.dropped;
+        shards[i].size         = tables[i].size();
+        shards[i].bucket_count = tables[i].bucket_count();
+        shards[i].load_factor  = tables[i].load_factor();
+        shards[i].rehashes     = stats.rehashes;
+        shards[i].stalls       = stats.stalls;
+        shards[i].dropped      = stats.dropped;
+        shards[i].idle =
+            std::chrono::duration<double>{last - stats.finished}.count();
+    }
+}
+
+auto operator<<(std::ostream& out, IterationMetrics const& x) -> std::ostream&
+{
+    out << "{\"iteration\": " << x.iteration
+        << ", \"time\": {\"apply\": " << JsonNumber{x.apply_time}
+        << ", \"drain\": " << JsonNumber{x.drain_time}
+        << ", \"normalize\": " << JsonNumber{x.normalize_time}
+        << ", \"shrink\": " << JsonNumber{x.shrink_time} << "}"
+        << ", \"generated\": " << x.generated << ", \"unique\": " << x.unique
+        << ", \"kept\": " << x.kept
+        << ", \"discarded_squared_norm\": "
+        << JsonNumber{x.discarded_squared_norm}
+        << ", \"spilled_bytes\": " << x.spilled_bytes
+        << ", \"dropped\": " << x.dropped
+        << ", \"memory_bytes\": " << x.memory_bytes;
+    if (x.energy.has_value()) {
+        out << ", \"energy\": " << JsonNumber{*x.energy};
+    }
+    out << ", \"shards\": [";
+    for (std::size_t i = 0; i < x.shards.size(); ++i) {
+        auto const& shard = x.shards[i];
+        if (i != 0) { out << ", "; }
+        out << "{\"size\": " << shard.size
+            << ", \"buckets\": " << shard.bucket_count
+            << ", \"load_factor\": " << JsonNumber{shard.load_factor}
+            << ", \"rehashes\": " << shard.rehashes
+            << ", \"stalls\": " << shard.stalls
+            << ", \"dropped\": " << shard.dropped
+            << ", \"idle\": " << JsonNumber{shard.idle} << "}";
+    }
+    out << "]}";
+    return out;
+}
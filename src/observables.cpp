@@ -0,0 +1,285 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "observables.hpp"
+#include "parallel.hpp"
+#include "quantum_state.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+/// Sums of |ψ_σ|²-weighted quantities over the part of the state seen by
+/// one thread. They are normalised only after all threads are done.
+class Accumulator {
+    std::vector<std::pair<int, int>> const* _bonds;
+    int                                     _number_spins;
+    double                                  _norm;
+    std::vector<double>                     _szsz;
+    std::vector<double>                     _bond_values;
+    std::vector<double>                     _magnetisation;
+
+    auto initialise(int const n) -> void
+    {
+        for (auto const& [i, j] : *_bonds) {
+            if (i < 0 || j < 0 || i >= n || j >= n) {
+                throw_with_trace(std::runtime_error{
+                    "Bond is out of range of the spin configurations."});
+            }
+        }
+        auto const size = static_cast<std::size_t>(n);
+        _number_spins   = n;
+        _szsz.assign(size * size, 0.0);
+        _bond_values.assign(_bonds->size(), 0.0);
+        _magnetisation.assign(size + 1, 0.0);
+    }
+
+  public:
+    explicit Accumulator(std::vector<std::pair<int, int>> const& bonds)
+        : _bonds{&bonds}
+        , _number_spins{0}
+        , _norm{0.0}
+        , _szsz{}
+        , _bond_values{}
+        , _magnetisation{}
+    {
+    }
+
+    auto operator()(QuantumState const& psi, SpinVector const& spin,
+        std::complex<double> const coeff) -> void
+    {
+        auto const n = spin.size();
+        if (_number_spins == 0) { initialise(n); }
+        else if (n != _number_spins) {
+            throw_with_trace(std::runtime_error{
+                "Observables require all configurations to have the same "
+                "length."});
+        }
+        auto const weight = std::norm(coeff);
+        auto const size   = static_cast<std::size_t>(n);
+        _norm += weight;
+
+        int number_up = 0;
+        if (n <= 64) {
+            // Bit n - 1 - i of `x` is spin i, see SpinVector::bits. For every
+            // i, `aligned` has the bits of the spins equal to spin i set.
+            auto const x     = spin.bits();
+            auto const shift = [n](auto const i) {
+                return static_cast<unsigned>(n - 1 - i);
+            };
+            number_up = __builtin_popcountll(x);
+            for (auto i = 0; i < n; ++i) {
+                auto const  aligned = ((x >> shift(i)) & 1u) ? x : ~x;
+                auto* const row =
+                    _szsz.data() + static_cast<std::size_t>(i) * size;
+                for (auto j = 0; j < n; ++j) {
+                    auto const bit =
+                        static_cast<double>((aligned >> shift(j)) & 1u);
+                    row[j] += weight * (2.0 * bit - 1.0);
+                }
+            }
+        }
+        else {
+            for (auto i = 0; i < n; ++i) {
+                number_up += spin[i] == Spin::up;
+                auto* const row =
+                    _szsz.data() + static_cast<std::size_t>(i) * size;
+                for (auto j = 0; j < n; ++j) {
+                    row[j] += spin[i] == spin[j] ? weight : -weight;
+                }
+            }
+        }
+        _magnetisation[static_cast<std::size_t>(number_up)] += weight;
+
+        // Sᵢ·Sⱼ = SᶻᵢSᶻⱼ + (S⁺ᵢS⁻ⱼ + S⁻ᵢS⁺ⱼ) / 2, where the second term maps σ
+        // to σ with spins i and j flipped if they are antiparallel.
+        for (std::size_t b = 0; b < _bonds->size(); ++b) {
+            auto const [i, j] = (*_bonds)[b];
+            if (spin[i] == spin[j]) {
+                _bond_values[b] += 0.25 * weight;
+                continue;
+            }
+            _bond_values[b] -= 0.25 * weight;
+            if (auto const* other = psi.find(spin.flipped({i, j}))) {
+                _bond_values[b] += 0.5 * std::real(std::conj(*other) * coeff);
+            }
+        }
+    }
+
+    /// Adds the sums of `other` to these ones.
+    auto merge(Accumulator const& other) -> void
+    {
+        if (other._number_spins == 0) { return; }
+        if (_number_spins == 0) {
+            *this = other;
+            return;
+        }
+        if (other._number_spins != _number_spins) {
+            throw_with_trace(std::runtime_error{
+                "Observables require all configurations to have the same "
+                "length."});
+        }
+        _norm += other._norm;
+        auto const add = [](auto& xs, auto const& ys) {
+            std::transform(std::begin(xs), std::end(xs), std::begin(ys),
+                std::begin(xs), std::plus<>{});
+        };
+        add(_szsz, other._szsz);
+        add(_bond_values, other._bond_values);
+        add(_magnetisation, other._magnetisation);
+    }
+
+    auto finish() && -> Observables
+    {
+        Observables result;
+        result.number_spins = _number_spins;
+        result.bonds        = *_bonds;
+        if (_norm == 0.0) { return result; }
+        // SᶻᵢSᶻⱼ = ±1/4, so the sign accumulated above still has to be scaled.
+        for (auto& x : _szsz) {
+            x *= 0.25 / _norm;
+        }
+        for (auto& x : _bond_values) {
+            x /= _norm;
+        }
+        for (auto& x : _magnetisation) {
+            x /= _norm;
+        }
+        result.szsz          = std::move(_szsz);
+        result.bond_values   = std::move(_bond_values);
+        result.magnetisation = std::move(_magnetisation);
+        return result;
+    }
+};
+} // namespace
+
+auto Observables::structure_factor(double const q) const -> double
+{
+    auto const n      = static_cast<std::size_t>(number_spins);
+    double     result = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+            auto const distance =
+                static_cast<double>(i) - static_cast<double>(j);
+            result += std::cos(q * distance) * szsz[i * n + j];
+        }
+    }
+    return n > 0 ? result / static_cast<double>(n) : 0.0;
+}
+
+auto bonds(Hamiltonian const& hamiltonian) -> std::vector<std::pair<int, int>>
+{
+    std::vector<std::pair<int, int>> result;
+    if (auto const* heisenberg = hamiltonian.target<Heisenberg>()) {
+        for (auto const& [_, edges] : heisenberg->specs()) {
+            for (auto const& [i, j] : edges) {
+                if (i != j) { result.emplace_back(std::minmax(i, j)); }
+            }
+        }
+        std::sort(std::begin(result), std::end(result));
+        result.erase(std::unique(std::begin(result), std::end(result)),
+            std::end(result));
+    }
+    else if (auto const* matrix = hamiltonian.target<CouplingMatrix>()) {
+        auto const n = matrix->number_spins();
+        for (auto i = 0; i < n; ++i) {
+            for (auto j = i + 1; j < n; ++j) {
+                if (matrix->coupling(i, j) != 0.0) {
+                    result.emplace_back(i, j);
+                }
+            }
+        }
+    }
+    else {
+        throw_with_trace(std::invalid_argument{
+            "Expected a Heisenberg Hamiltonian or a coupling matrix."});
+    }
+    return result;
+}
+
+auto measure(QuantumState const& psi, std::vector<std::pair<int, int>> bonds)
+    -> Observables
+{
+    auto const               number_shards = psi.number_workers();
+    std::vector<Accumulator> accumulators(number_shards, Accumulator{bonds});
+    parallel_for(number_shards, [&](auto const shard) {
+        auto& accumulator = accumulators[shard];
+        psi.for_each_in_shard(shard, [&](auto const& x) {
+            accumulator(psi, x.first, x.second);
+        });
+    });
+    auto& result = accumulators.front();
+    for (std::size_t i = 1; i < number_shards; ++i) {
+        result.merge(accumulators[i]);
+    }
+    return std::move(result).finish();
+}
+
+auto operator<<(std::ostream& out, Observables const& x) -> std::ostream&
+{
+    auto const n          = static_cast<std::size_t>(x.number_spins);
+    auto const write_list = [&out](auto first, auto last) {
+        out << '[';
+        for (auto it = first; it != last; ++it) {
+            if (it != first) { out << ", "; }
+            out << *it;
+        }
+        out << ']';
+    };
+    out << "{\"number_spins\": " << x.number_spins << ", \"magnetisation\": ";
+    write_list(std::begin(x.magnetisation), std::end(x.magnetisation));
+    out << ", \"szsz\": [";
+    for (std::size_t i = 0; i < n && !x.szsz.empty(); ++i) {
+        if (i != 0) { out << ", "; }
+        auto const row =
+            std::begin(x.szsz) + static_cast<std::ptrdiff_t>(i * n);
+        write_list(row, row + static_cast<std::ptrdiff_t>(n));
+    }
+    out << "], \"bonds\": [";
+    for (std::size_t b = 0; b < x.bond_values.size(); ++b) {
+        if (b != 0) { out << ", "; }
+        out << "{\"i\": " << x.bonds[b].first
+            << ", \"j\": " << x.bonds[b].second
+            << ", \"value\": " << x.bond_values[b] << "}";
+    }
+    out << "], \"structure_factor\": [";
+    auto const pi = std::acos(-1.0);
+    for (std::size_t k = 0; k < n && !x.szsz.empty(); ++k) {
+        auto const q =
+            2.0 * pi * static_cast<double>(k) / static_cast<double>(n);
+        if (k != 0) { out << ", "; }
+        out << "{\"q\": " << q << ", \"value\": " << x.structure_factor(q)
+            << "}";
+    }
+    out << "]}";
+    return out;
+}
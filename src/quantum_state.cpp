@@ -30,21 +30,531 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "quantum_state.hpp"
+#include "hamiltonian.hpp"
+#include "kernels.hpp"
+#include "parallel.hpp"
+#include "sort_merge.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <numeric>
+#include <random>
+#include <utility>
+
+namespace {
+/// Number of elements `table` holds without growing.
+auto room_of(TableCache::map_type const& table) noexcept -> std::size_t
+{
+    return static_cast<std::size_t>(
+        table.max_load_factor() * static_cast<float>(table.bucket_count()));
+}
+} // namespace
+
+auto TableCache::put(map_type&& table) -> void
+{
+    if (table.bucket_count() == 0) { return; }
+    table.clear();
+    auto const bytes = ::memory_usage(table);
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (_bytes + bytes > _capacity) { return; }
+    _bytes += bytes;
+    _tables.push_back(std::move(table));
+}
+
+auto TableCache::take(std::size_t const count) -> std::optional<map_type>
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (auto i = std::begin(_tables); i != std::end(_tables); ++i) {
+        auto const room = room_of(*i);
+        if (room >= count && room < 2 * count) {
+            map_type table{std::move(*i)};
+            _tables.erase(i);
+            _bytes -= ::memory_usage(table);
+            return table;
+        }
+    }
+    return std::nullopt;
+}
+
+auto TableCache::size() -> std::size_t
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _tables.size();
+}
+
+auto TableCache::bytes() -> std::size_t
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _bytes;
+}
 
 auto QuantumState::clear() -> void
 {
+    if (_basis != nullptr) {
+        std::fill(std::begin(_amplitudes), std::end(_amplitudes), 0.0);
+        _discarded = 0.0;
+        return;
+    }
     for (auto& table : _maps) {
         table.clear();
     }
+    _keys.clear();
+    _amplitudes.clear();
+    _summaries.clear();
+    drop_diagonal();
+    _sorted    = false;
+    _discarded = 0.0;
+}
+
+auto QuantumState::reserve(std::size_t const count) -> void
+{
+    if (count == 0 || _sorted || _basis != nullptr) { return; }
+    auto const per_shard = (count + _maps.size() - 1) / _maps.size();
+    if (_placement != nullptr) {
+        _deferred_capacity = std::max(_deferred_capacity, per_shard);
+        return;
+    }
+    for (auto& table : _maps) {
+        if (_table_cache != nullptr && table.size() == 0
+            && room_of(table) < per_shard) {
+            if (auto spare = _table_cache->take(per_shard)) {
+                table = std::move(*spare);
+                continue;
+            }
+        }
+        table.reserve(per_shard);
+    }
+}
+
+auto QuantumState::placement(std::shared_ptr<Placement const> placement)
+    -> void
+{
+    TCM_ASSERT(placement == nullptr || placement->size() == _maps.size());
+    _placement = std::move(placement);
+}
+
+auto QuantumState::next_capacity() const noexcept -> std::size_t
+{
+    if (_hard_max_size != 0) { return _hard_max_size; }
+    auto const growth =
+        _growth > 0.0 ? std::min(_growth, _max_growth) : _max_growth;
+    if (!std::isfinite(growth)) { return 0; }
+    return static_cast<std::size_t>(
+        std::ceil(growth_slack * growth * static_cast<double>(size())));
+}
+
+namespace {
+/// Returns the largest number of elements which can be reserved in a table
+/// like `table` without it occupying more than `bytes`. Tables round their
+/// number of buckets up to a power of two.
+auto capacity_within(QuantumState::map_type const& table,
+    std::size_t const bytes) noexcept -> std::size_t
+{
+    using mapped_type  = QuantumState::map_type::mapped_type;
+    auto const load    = static_cast<double>(table.max_load_factor());
+    auto const holding = [load](auto const buckets) {
+        return static_cast<std::size_t>(load * static_cast<double>(buckets));
+    };
+    std::size_t buckets = 1;
+    while (spin_map_bytes<mapped_type>(2 * buckets, holding(2 * buckets))
+           <= bytes) {
+        buckets *= 2;
+    }
+    return holding(buckets);
+}
+
+/// Inverse of `capacity_within`: bytes of a table reserved for `count`
+/// elements.
+auto bytes_for(QuantumState::map_type const& table,
+    std::size_t const count) noexcept -> std::size_t
+{
+    using mapped_type = QuantumState::map_type::mapped_type;
+    auto const load   = static_cast<double>(table.max_load_factor());
+    std::size_t buckets = 1;
+    while (load * static_cast<double>(buckets) < static_cast<double>(count)) {
+        buckets *= 2;
+    }
+    return spin_map_bytes<mapped_type>(buckets, count);
+}
+} // namespace
+
+auto QuantumState::memory_usage() const noexcept -> std::size_t
+{
+    auto bytes = _entries.capacity() * sizeof(_entries[0])
+                 + _keys.capacity() * sizeof(SpinVector)
+                 + _amplitudes.capacity() * sizeof(std::complex<double>);
+    for (auto const& table : _maps) {
+        bytes += ::memory_usage(table);
+    }
+    for (auto const& summary : _summaries) {
+        bytes += summary.largest.capacity() * sizeof(double);
+    }
+    bytes += _diagonal.capacity() * sizeof(std::complex<double>);
+    return bytes;
+}
+
+auto QuantumState::table_budget(std::size_t const held) const -> std::size_t
+{
+    if (_memory_limit == 0) { return 0; }
+    auto const used =
+        memory_usage() + held + number_workers() * Updater::queue_bytes;
+    // Truncation needs at least `soft_max` elements, even if that exceeds
+    // the limit.
+    auto const minimum = bytes_for(_maps.front(),
+        (_soft_max_size + number_workers() - 1) / number_workers());
+    if (used >= _memory_limit) { return minimum; }
+    return std::max((_memory_limit - used) / number_workers(), minimum);
+}
+
+auto QuantumState::soft_max_within(std::size_t const bytes,
+    double const growth, std::size_t const vectors,
+    std::size_t const number_workers, Backend const backend) -> std::size_t
+{
+    TCM_ASSERT(number_workers > 0 && vectors > 0 && std::isfinite(growth));
+    constexpr auto frozen_bytes =
+        sizeof(SpinVector) + sizeof(std::complex<double>);
+    if (backend != Backend::hash) {
+        // Half of the memory for ψ and the merged vectors, half for the
+        // buffers.
+        return bytes / (2 * (1 + vectors) * frozen_bytes);
+    }
+    if (bytes <= number_workers * Updater::queue_bytes) { return 0; }
+    auto const available = bytes - number_workers * Updater::queue_bytes;
+    map_type const table{};
+    // The frozen ψ with its cached diagonal, the tables of all vectors and
+    // the summaries of the last one (one double per element) are alive at
+    // the same time. Larger vectors of the recurrence are kept within the
+    // same tables by eviction.
+    auto const fits = [&](std::size_t const soft_max) {
+        auto const successor = static_cast<std::size_t>(std::ceil(
+            growth_slack * growth * static_cast<double>(soft_max)));
+        auto const per_shard =
+            (successor + number_workers - 1) / number_workers;
+        return soft_max * (frozen_bytes + sizeof(std::complex<double>))
+                   + vectors * number_workers * bytes_for(table, per_shard)
+                   + successor * sizeof(double)
+               <= available;
+    };
+    std::size_t lower = 0;
+    std::size_t upper = available / frozen_bytes + 1;
+    while (upper - lower > 1) {
+        auto const middle = lower + (upper - lower) / 2;
+        if (fits(middle)) { lower = middle; }
+        else {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+auto QuantumState::empty_successor(std::size_t const held) const
+    -> QuantumState
+{
+    QuantumState psi{_soft_max_size, 0, number_workers()};
+    psi._hard_max_size = _hard_max_size;
+    psi._growth        = _growth;
+    psi._max_growth    = _max_growth;
+    psi._placement     = _placement;
+    psi._backend       = _backend;
+    psi._memory_limit  = _memory_limit;
+    psi._truncation    = _truncation;
+    psi._seed          = _seed;
+    psi._generation    = _generation + 1;
+    psi._cutoff        = _cutoff;
+    psi._norm_growth   = _norm_growth;
+    psi._screening     = _screening;
+    psi._basis         = _basis;
+    psi._table_cache   = _table_cache;
+    if (_basis != nullptr) { psi._amplitudes.resize(_basis->size()); }
+    // The sort backend collects H|ψ〉 in buffers of its own.
+    if (_backend == Backend::hash) {
+        auto capacity = next_capacity();
+        if (auto const budget = table_budget(held); budget != 0) {
+            capacity = std::min(capacity,
+                number_workers() * capacity_within(_maps.front(), budget));
+        }
+        psi.reserve(capacity);
+    }
+    return psi;
+}
+
+auto QuantumState::observe_growth(QuantumState const& source) noexcept -> void
+{
+    auto const source_size = source.size();
+    if (source_size != 0) {
+        // Elements which the workers pruned had to fit into the tables too.
+        auto accumulated = size();
+        for (auto const& summary : _summaries) {
+            accumulated += summary.pruned;
+        }
+        _growth = static_cast<double>(accumulated)
+                  / static_cast<double>(source_size);
+    }
+    if (_screening > 0.0) {
+        auto const source_norm = source.squared_norm();
+        if (source_norm > 0.0) {
+            _norm_growth =
+                std::sqrt((squared_norm() + _discarded) / source_norm);
+        }
+    }
+}
+
+auto QuantumState::screening_threshold() const -> double
+{
+    if (_screening <= 0.0 || _cutoff <= 0.0 || _norm_growth <= 0.0) {
+        return 0.0;
+    }
+    return _screening * _cutoff * _norm_growth
+           * std::sqrt(squared_norm() + _discarded);
 }
 
 auto QuantumState::insert(value_type&& x) -> std::pair<map_type::iterator, bool>
 {
+    if (_basis != nullptr) {
+        throw_with_trace(std::logic_error{
+            "QuantumState::insert is not supported by Backend::dense."});
+    }
+    if (_sorted) { thaw(); }
+    _summaries.clear();
     return _maps[spin_to_index(x.first, _maps.size())].insert(std::move(x));
 }
 
-auto QuantumState::remove_least(std::size_t count) -> void
+auto QuantumState::erase(SpinVector const& spin) -> std::size_t
+{
+    if (_basis != nullptr) {
+        throw_with_trace(std::logic_error{
+            "QuantumState::erase is not supported by Backend::dense."});
+    }
+    if (_sorted) { thaw(); }
+    _summaries.clear();
+    return _maps[spin_to_index(spin, _maps.size())].erase(spin);
+}
+
+namespace {
+/// Returns the 64 most significant spins as an integer which is monotonic
+/// with respect to `SpinVector::operator<`.
+auto leading_bits(SpinVector const& spin) noexcept -> std::uint64_t
+{
+    std::uint64_t x;
+    std::memcpy(&x, spin.data(), sizeof(x));
+    return __builtin_bswap64(x);
+}
+
+/// Equivalent to `std::lower_bound`. Starts with a few steps of interpolation
+/// search which, since the keys are close to uniformly distributed, usually
+/// land right next to `spin`, and finishes with a binary search in the
+/// remaining window. Bounding the number of interpolation steps keeps the
+/// worst case logarithmic.
+auto interpolation_search(std::vector<SpinVector> const& keys,
+    SpinVector const& spin) -> std::vector<SpinVector>::const_iterator
+{
+    constexpr int            max_steps = 4;
+    constexpr std::ptrdiff_t min_size  = 16;
+
+    auto       first  = std::begin(keys);
+    auto       last   = std::end(keys);
+    auto const target = leading_bits(spin);
+    for (auto step = 0; step < max_steps && last - first > min_size; ++step) {
+        auto const low  = leading_bits(*first);
+        auto const high = leading_bits(*(last - 1));
+        if (target < low) { return first; }
+        if (target > high) { return last; }
+        if (low == high) { break; }
+        auto const fraction = static_cast<double>(target - low)
+                              / static_cast<double>(high - low);
+        auto const offset   = fraction * static_cast<double>(last - first - 1);
+        auto const guess    = first + static_cast<std::ptrdiff_t>(offset);
+        if (*guess < spin) { first = guess + 1; }
+        else if (spin < *guess) {
+            last = guess;
+        }
+        else {
+            return guess;
+        }
+    }
+    return std::lower_bound(first, last, spin);
+}
+} // namespace
+
+auto QuantumState::find(SpinVector const& spin) const
+    -> std::complex<double> const*
+{
+    if (_sorted) {
+        auto const where = interpolation_search(_keys, spin);
+        if (where == std::end(_keys) || !(*where == spin)) { return nullptr; }
+        return _amplitudes.data() + (where - std::begin(_keys));
+    }
+    if (_basis != nullptr) {
+        auto const i = _basis->find(spin);
+        if (i == DenseBasis::npos) { return nullptr; }
+        return _amplitudes.data() + i;
+    }
+    auto const& table = _maps[spin_to_index(spin, _maps.size())];
+    auto const  where = table.find(spin);
+    if (where != table.end()) { return std::addressof(where->second); }
+    return nullptr;
+}
+
+auto QuantumState::assign_sorted(std::vector<SpinVector> keys,
+    std::vector<std::complex<double>> amplitudes) -> void
+{
+    TCM_ASSERT(keys.size() == amplitudes.size() && _basis == nullptr);
+    TCM_ASSERT(std::adjacent_find(std::begin(keys), std::end(keys),
+                   [](auto const& x, auto const& y) { return !(x < y); })
+               == std::end(keys));
+    for (auto& table : _maps) {
+        table.clear();
+    }
+    _keys       = std::move(keys);
+    _amplitudes = std::move(amplitudes);
+    _sorted     = true;
+    _summaries.clear();
+    drop_diagonal();
+}
+
+auto QuantumState::freeze() -> void
+{
+    if (_sorted || _basis != nullptr) { return; }
+    TCM_TRACE_SCOPE("freeze");
+    _summaries.clear();
+    std::vector<std::size_t> offsets(_maps.size() + 1, 0);
+    for (std::size_t i = 0; i < _maps.size(); ++i) {
+        offsets[i + 1] = offsets[i] + _maps[i].size();
+    }
+    _keys.resize(offsets.back());
+    _amplitudes.resize(offsets.back());
+    // Shards occupy consecutive ranges of the sorted order, because
+    // `spin_to_index` looks at the most significant spins only.
+    parallel_for(_maps.size(), [this, &offsets](auto const i) {
+        std::vector<value_type> run{_maps[i].begin(), _maps[i].end()};
+        std::vector<value_type> scratch;
+        if (_table_cache != nullptr) {
+            _table_cache->put(std::move(_maps[i]));
+        }
+        _maps[i] = map_type{};
+        sort_and_reduce(run, scratch);
+        TCM_ASSERT(run.size() == offsets[i + 1] - offsets[i]);
+        for (std::size_t j = 0; j < run.size(); ++j) {
+            _keys[offsets[i] + j]       = run[j].first;
+            _amplitudes[offsets[i] + j] = run[j].second;
+        }
+    });
+    _sorted = true;
+}
+
+auto QuantumState::thaw() -> void
+{
+    if (!_sorted) { return; }
+    _sorted = false;
+    drop_diagonal();
+    for (std::size_t i = 0; i < _maps.size(); ++i) {
+        auto const [first, last] = shard_range(i);
+        _maps[i].reserve(last - first);
+        for (auto j = first; j < last; ++j) {
+            _maps[i].insert({_keys[j], _amplitudes[j]});
+        }
+    }
+    _keys       = {};
+    _amplitudes = {};
+}
+
+auto QuantumState::cache_diagonal(
+    std::shared_ptr<Heisenberg const> hamiltonian) -> void
+{
+    TCM_ASSERT(hamiltonian != nullptr && _basis == nullptr);
+    freeze();
+    if (has_diagonal(*hamiltonian)) { return; }
+    TCM_TRACE_SCOPE("cache diagonal");
+    _diagonal.resize(_keys.size());
+    parallel_for(_maps.size(), [this, &hamiltonian](auto const i) {
+        auto const [first, last] = shard_range(i);
+        for (auto j = first; j < last; j += Heisenberg::batch_size) {
+            hamiltonian->diagonal(_keys.data() + j,
+                std::min(Heisenberg::batch_size, last - j),
+                _diagonal.data() + j);
+        }
+    });
+    _diagonal_of = std::move(hamiltonian);
+}
+
+auto QuantumState::has_diagonal(Heisenberg const& hamiltonian) const noexcept
+    -> bool
+{
+    if (_diagonal_of == nullptr) { return false; }
+    return _diagonal_of.get() == std::addressof(hamiltonian)
+           || _diagonal_of->specs() == hamiltonian.specs();
+}
+
+auto QuantumState::make_dense(std::shared_ptr<DenseBasis const> basis)
+    -> void
+{
+    TCM_ASSERT(basis != nullptr);
+    drop_diagonal();
+    std::vector<std::complex<double>> amplitudes(basis->size());
+    for_each([&amplitudes, &basis](auto const& x) {
+        auto const i = basis->find(x.first);
+        if (i == DenseBasis::npos) {
+            throw_with_trace(std::runtime_error{
+                "Configuration is not part of the dense basis."});
+        }
+        amplitudes[i] = x.second;
+    });
+    for (auto& table : _maps) {
+        table = map_type{};
+    }
+    _keys       = {};
+    _amplitudes = std::move(amplitudes);
+    _sorted     = false;
+    _basis      = std::move(basis);
+    _summaries.clear();
+    _backend    = Backend::dense;
+}
+
+auto QuantumState::shard_range(std::size_t const i) const noexcept
+    -> std::pair<std::size_t, std::size_t>
+{
+    auto const n = _maps.size();
+    if (_basis != nullptr) {
+        // Ranks are ordered like spins, so shards are contiguous here, too.
+        // `lower(first, k)` is the first rank ≥ first in shard k or later.
+        auto const lower = [this, n](std::size_t first, std::size_t const k) {
+            auto last = _amplitudes.size();
+            while (first < last) {
+                auto const middle = first + (last - first) / 2;
+                if (spin_to_index(_basis->spin(middle), n) < k) {
+                    first = middle + 1;
+                }
+                else {
+                    last = middle;
+                }
+            }
+            return first;
+        };
+        auto const first = lower(0, i);
+        return {first, lower(first, i + 1)};
+    }
+    auto const first = std::partition_point(std::begin(_keys), std::end(_keys),
+        [i, n](auto const& x) { return spin_to_index(x, n) < i; });
+    auto const last  = std::partition_point(first, std::end(_keys),
+        [i, n](auto const& x) { return spin_to_index(x, n) <= i; });
+    return {static_cast<std::size_t>(first - std::begin(_keys)),
+        static_cast<std::size_t>(last - std::begin(_keys))};
+}
+
+auto QuantumState::size() const noexcept -> std::size_t
+{
+    if (_sorted) { return _keys.size(); }
+    if (_basis != nullptr) {
+        return static_cast<std::size_t>(
+            std::count_if(std::begin(_amplitudes), std::end(_amplitudes),
+                [](auto const x) { return x != 0.0; }));
+    }
+    return std::accumulate(std::begin(_maps), std::end(_maps), 0ul,
+        [](auto const acc, auto const& x) { return acc + x.size(); });
+}
+
+auto QuantumState::remove_least(std::size_t count) -> double
 {
     _entries.clear();
     for (auto const& table : _maps) {
@@ -54,15 +564,259 @@ auto QuantumState::remove_least(std::size_t count) -> void
     }
     std::sort(std::begin(_entries), std::end(_entries),
         [](auto const& x, auto const& y) { return x.second < y.second; });
+    double discarded = 0.0;
     for (std::size_t i = 0; i < count; ++i) {
         auto& table = _maps.at(spin_to_index(_entries[i].first, _maps.size()));
         TCM_ASSERT(table.count(_entries[i].first));
         table.erase(_entries[i].first);
+        discarded += _entries[i].second;
     }
+    if (count > 0) { _cutoff = std::sqrt(_entries[count - 1].second); }
+    return discarded;
 }
 
-auto QuantumState::normalize() -> QuantumState&
+namespace {
+/// Returns the k-th largest element of the union of the candidate lists
+/// (k ≥ 1). There must be at least k candidates in total.
+auto kth_largest(std::vector<ShardSummary> const& summaries,
+    std::size_t const k) -> double
+{
+    // Number of candidates ≥ x.
+    auto const count = [&summaries](double const x) {
+        std::size_t n = 0;
+        for (auto const& summary : summaries) {
+            auto const& xs = summary.largest;
+            n += static_cast<std::size_t>(
+                std::partition_point(std::begin(xs), std::end(xs),
+                    [x](auto const y) { return y >= x; })
+                - std::begin(xs));
+        }
+        return n;
+    };
+    // Non-negative doubles are ordered like their bit patterns, so we can
+    // bisect on those. The answer is the largest x with count(x) ≥ k, which
+    // is necessarily one of the candidates.
+    auto const to_bits = [](double const x) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    };
+    auto const from_bits = [](std::uint64_t const bits) {
+        double x;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    };
+    double largest = 0.0;
+    for (auto const& summary : summaries) {
+        if (!summary.largest.empty()) {
+            largest = std::max(largest, summary.largest.front());
+        }
+    }
+    std::uint64_t lower = 0;                     // count ≥ k
+    std::uint64_t upper = to_bits(largest) + 1;  // count < k
+    TCM_ASSERT(count(from_bits(lower)) >= k);
+    while (upper - lower > 1) {
+        auto const middle = lower + (upper - lower) / 2;
+        if (count(from_bits(middle)) >= k) { lower = middle; }
+        else {
+            upper = middle;
+        }
+    }
+    return from_bits(lower);
+}
+} // namespace
+
+auto QuantumState::remove_least_summarised(
+    std::vector<ShardSummary> const& summaries, std::size_t const count)
+    -> double
+{
+    auto const number_shards = _maps.size();
+    TCM_ASSERT(summaries.size() == number_shards);
+    auto const keep = size() - count;
+    TCM_ASSERT(keep > 0);
+    auto const threshold = kth_largest(summaries, keep);
+
+    // Only the number of elements every shard keeps is derived from the
+    // candidates. The shards then select that many elements by their current
+    // weights, because `scale` may have rounded the candidates differently.
+    // Every element above the threshold is among the candidates of its
+    // shard. Of the elements equal to the threshold, the first shards keep
+    // theirs.
+    std::vector<std::size_t> quotas(number_shards);
+    std::vector<std::size_t> ties(number_shards);
+    auto                     remaining = keep;
+    for (std::size_t i = 0; i < number_shards; ++i) {
+        auto const& xs      = summaries[i].largest;
+        auto const  greater = std::partition_point(std::begin(xs),
+            std::end(xs), [threshold](auto const x) { return x > threshold; });
+        auto const  equal   = std::partition_point(greater, std::end(xs),
+            [threshold](auto const x) { return x == threshold; });
+        quotas[i] = static_cast<std::size_t>(greater - std::begin(xs));
+        ties[i]   = static_cast<std::size_t>(equal - greater);
+        remaining -= quotas[i];
+    }
+    for (std::size_t i = 0; i < number_shards; ++i) {
+        auto const n = std::min(ties[i], remaining);
+        quotas[i] += n;
+        remaining -= n;
+    }
+
+    std::vector<double> discarded(number_shards);
+    std::vector<double> largest(number_shards);
+    parallel_for(number_shards, [&](auto const shard) {
+        auto&      table = _maps[shard];
+        auto const quota = quotas[shard];
+        if (quota >= table.size()) { return; }
+        std::vector<std::pair<double, SpinVector>> entries;
+        entries.reserve(table.size());
+        for (auto const& [spin, coeff] : table) {
+            entries.emplace_back(std::norm(coeff), spin);
+        }
+        auto const first =
+            std::begin(entries) + static_cast<std::ptrdiff_t>(quota);
+        std::nth_element(std::begin(entries), first, std::end(entries),
+            [](auto const& x, auto const& y) { return x.first > y.first; });
+        double norm = 0.0;
+        double max  = 0.0;
+        for (auto i = first; i != std::end(entries); ++i) {
+            table.erase(i->second);
+            norm += i->first;
+            max = std::max(max, i->first);
+        }
+        discarded[shard] = norm;
+        largest[shard]   = max;
+    });
+    _cutoff =
+        std::sqrt(*std::max_element(std::begin(largest), std::end(largest)));
+    return std::accumulate(std::begin(discarded), std::end(discarded), 0.0);
+}
+
+auto QuantumState::remove_least_sorted(std::size_t const count) -> double
+{
+    TCM_ASSERT(_sorted && count <= _keys.size());
+    if (count == 0) { return 0.0; }
+    auto const&         kernel = kernels();
+    std::vector<double> norms(_amplitudes.size());
+    kernel.norms(_amplitudes.data(), _amplitudes.size(), norms.data());
+    auto weights = norms;
+    std::nth_element(std::begin(weights),
+        std::begin(weights) + static_cast<std::ptrdiff_t>(count - 1),
+        std::end(weights));
+    auto const threshold = weights[count - 1];
+    _cutoff              = std::sqrt(threshold);
+    // Elements equal to the threshold may be kept as well, the earliest ones
+    // (in key order) win.
+    auto const below =
+        kernel.count_less(norms.data(), norms.size(), threshold);
+    auto        ties      = count - below;
+    double      discarded = 0.0;
+    std::size_t kept      = 0;
+    for (std::size_t i = 0; i < _keys.size(); ++i) {
+        if (norms[i] < threshold || (norms[i] == threshold && ties > 0)) {
+            if (norms[i] == threshold) { --ties; }
+            discarded += norms[i];
+            continue;
+        }
+        _keys[kept]       = _keys[i];
+        _amplitudes[kept] = _amplitudes[i];
+        ++kept;
+    }
+    _keys.resize(kept);
+    _amplitudes.resize(kept);
+    return discarded;
+}
+
+auto QuantumState::round_stochastically() -> double
 {
+    freeze();
+    auto const count = _keys.size();
+    TCM_ASSERT(count > _soft_max_size && _soft_max_size > 0);
+
+    // Find the smallest k such that the elements k, k + 1, ... are all
+    // smaller than τ = (Σ_{j≥k} |ψ|ⱼ) / (soft_max - k), where |ψ|ⱼ are the
+    // magnitudes in decreasing order. Then τ·(soft_max - k) is exactly the
+    // mass of the rounded elements, so soft_max elements survive on average.
+    std::vector<double> magnitudes(count);
+    std::transform(std::begin(_amplitudes), std::end(_amplitudes),
+        std::begin(magnitudes), [](auto const x) { return std::abs(x); });
+    std::sort(std::begin(magnitudes), std::end(magnitudes), std::greater<>{});
+    auto tail = std::accumulate(
+        std::begin(magnitudes), std::end(magnitudes), 0.0);
+    std::size_t exact = 0;
+    while (exact + 1 < _soft_max_size
+           && magnitudes[exact] * static_cast<double>(_soft_max_size - exact)
+                  >= tail) {
+        tail -= magnitudes[exact];
+        ++exact;
+    }
+    auto const threshold = tail / static_cast<double>(_soft_max_size - exact);
+    _cutoff              = threshold;
+
+    // Shards are rounded in parallel, each with its own generator. Surviving
+    // elements are first compacted within their shard.
+    auto const               number_shards = _maps.size();
+    std::vector<std::size_t> kept(number_shards);
+    std::vector<double>      errors(number_shards);
+    std::vector<std::pair<std::size_t, std::size_t>> ranges;
+    for (std::size_t i = 0; i < number_shards; ++i) {
+        ranges.push_back(shard_range(i));
+    }
+    parallel_for(number_shards, [&, threshold](auto const shard) {
+        std::seed_seq seed{static_cast<std::uint32_t>(_seed),
+            static_cast<std::uint32_t>(_seed >> 32),
+            static_cast<std::uint32_t>(_generation),
+            static_cast<std::uint32_t>(shard)};
+        std::mt19937_64                        generator{seed};
+        std::uniform_real_distribution<double> uniform{0.0, threshold};
+        auto const [first, last] = ranges[shard];
+        auto   out               = first;
+        double error             = 0.0;
+        for (auto i = first; i < last; ++i) {
+            auto       coeff     = _amplitudes[i];
+            auto const magnitude = std::abs(coeff);
+            if (magnitude < threshold) {
+                auto const rounded = uniform(generator) < magnitude
+                                         ? coeff * (threshold / magnitude)
+                                         : std::complex<double>{0.0};
+                error += std::norm(rounded - coeff);
+                if (rounded == 0.0) { continue; }
+                coeff = rounded;
+            }
+            _keys[out]       = _keys[i];
+            _amplitudes[out] = coeff;
+            ++out;
+        }
+        kept[shard]   = out - first;
+        errors[shard] = error;
+    });
+
+    std::size_t size = 0;
+    for (std::size_t shard = 0; shard < number_shards; ++shard) {
+        auto const first = static_cast<std::ptrdiff_t>(ranges[shard].first);
+        auto const last  = first + static_cast<std::ptrdiff_t>(kept[shard]);
+        auto const dest  = static_cast<std::ptrdiff_t>(size);
+        std::move(std::begin(_keys) + first, std::begin(_keys) + last,
+            std::begin(_keys) + dest);
+        std::move(std::begin(_amplitudes) + first,
+            std::begin(_amplitudes) + last, std::begin(_amplitudes) + dest);
+        size += kept[shard];
+    }
+    _keys.resize(size);
+    _amplitudes.resize(size);
+    return std::accumulate(std::begin(errors), std::end(errors), 0.0);
+}
+
+auto QuantumState::squared_norm() const -> double
+{
+    if (!_summaries.empty()) {
+        return std::accumulate(std::begin(_summaries), std::end(_summaries),
+            0.0, [](auto const acc, auto const& x) {
+                return acc + x.squared_norm;
+            });
+    }
+    if (_sorted || _basis != nullptr) {
+        return kernels().squared_norm(_amplitudes.data(), _amplitudes.size());
+    }
     double norm = 0.0;
     for (auto const& table : _maps) {
         norm += std::accumulate(
@@ -70,24 +824,93 @@ auto QuantumState::normalize() -> QuantumState&
                 return acc + std::norm(x.second);
             });
     }
-    auto const scale = 1.0 / std::sqrt(norm);
+    return norm;
+}
+
+auto QuantumState::scale(std::complex<double> const scale) -> void
+{
+    _discarded *= std::norm(scale);
+    for (auto& summary : _summaries) {
+        summary.squared_norm *= std::norm(scale);
+        for (auto& x : summary.largest) {
+            x *= std::norm(scale);
+        }
+    }
+    kernels().scale(_amplitudes.data(), _amplitudes.size(), scale);
     for (auto& table : _maps) {
         for (auto& [_, coeff] : table) {
             coeff *= scale;
         }
     }
+}
+
+auto QuantumState::normalize() -> QuantumState&
+{
+    TCM_TRACE_SCOPE("normalize");
+    scale(1.0 / std::sqrt(squared_norm() + _discarded));
     return *this;
 }
 
-auto QuantumState::shrink() -> void
+auto QuantumState::summaries(std::vector<ShardSummary> value) -> void
 {
-    auto const size = std::accumulate(std::begin(_maps), std::end(_maps), 0ul,
-        [](auto const acc, auto const& x) { return acc + x.size(); });
-    if (size > _soft_max_size) { remove_least(size - _soft_max_size); }
+    TCM_ASSERT(value.empty() || value.size() == _maps.size());
+    TCM_ASSERT(!_sorted && _basis == nullptr);
+    for (auto const& summary : value) {
+        _discarded += summary.pruned_norm;
+    }
+    _summaries = std::move(value);
+}
+
+auto QuantumState::shrink() -> double
+{
+    TCM_TRACE_SCOPE("shrink");
+    drop_diagonal();
+    auto const discarded = std::exchange(_discarded, 0.0);
+    auto const summaries = std::exchange(_summaries, {});
+    if (_basis != nullptr) { return discarded; }
+    auto const count = size();
+    if (count <= _soft_max_size) {
+        // Elements which the workers pruned were smaller than the ones they
+        // kept.
+        auto pruned = 0.0;
+        for (auto const& summary : summaries) {
+            if (summary.pruned > 0) {
+                pruned = std::max(pruned, std::sqrt(summary.largest.back()));
+            }
+        }
+        // If nothing is removed, the cutoff inherited from an earlier
+        // truncation must not screen the next accumulation.
+        if (pruned > 0.0) { _cutoff = pruned; }
+        else if (discarded == 0.0) {
+            _cutoff = 0.0;
+        }
+        return discarded;
+    }
+    if (_truncation == Truncation::stochastic) {
+        return discarded + round_stochastically();
+    }
+    if (_sorted) {
+        return discarded + remove_least_sorted(count - _soft_max_size);
+    }
+    // The summaries are only useful if no shard left out an element which
+    // might be kept.
+    auto const complete =
+        !summaries.empty()
+        && std::equal(std::begin(_maps), std::end(_maps),
+            std::begin(summaries), [this](auto const& table, auto const& x) {
+                return x.largest.size()
+                       >= std::min(table.size(), _soft_max_size);
+            });
+    if (complete) {
+        return discarded
+               + remove_least_summarised(summaries, count - _soft_max_size);
+    }
+    return discarded + remove_least(count - _soft_max_size);
 }
 
 auto operator<<(std::ostream& out, QuantumState const& psi) -> std::ostream&
 {
+    TCM_TRACE_SCOPE("write state");
     psi.for_each([&out](auto const& x) {
         out << x.first << '\t' << x.second.real() << '\t' << x.second.imag()
             << '\n';
@@ -97,6 +920,7 @@ auto operator<<(std::ostream& out, QuantumState const& psi) -> std::ostream&
 
 auto operator>>(std::istream& is, QuantumState& x) -> std::istream&
 {
+    TCM_TRACE_SCOPE("read state");
     std::string line;
     SpinVector  spin;
     double      real, imag;
@@ -121,3 +945,51 @@ auto operator>>(std::istream& is, QuantumState& x) -> std::istream&
     }
     return is;
 }
+
+namespace {
+constexpr char binary_magic[8] = {'L', 'A', 'N', 'C', 'Z', 'O', 'S', '1'};
+} // namespace
+
+auto write_binary(std::ostream& out, QuantumState const& psi) -> std::ostream&
+{
+    TCM_TRACE_SCOPE("write state");
+    static_assert(std::is_trivially_copyable_v<SpinVector>);
+    auto const count = static_cast<std::uint64_t>(psi.size());
+    out.write(binary_magic, sizeof(binary_magic));
+    out.write(reinterpret_cast<char const*>(&count), sizeof(count));
+    psi.for_each([&out](auto const& x) {
+        out.write(reinterpret_cast<char const*>(&x.first), sizeof(x.first));
+        out.write(reinterpret_cast<char const*>(&x.second), sizeof(x.second));
+    });
+    return out;
+}
+
+auto read_binary(std::istream& in, QuantumState& x) -> std::istream&
+{
+    TCM_TRACE_SCOPE("read state");
+    char          magic[sizeof(binary_magic)];
+    std::uint64_t count;
+    x.clear();
+    if (!in.read(magic, sizeof(magic))
+        || std::memcmp(magic, binary_magic, sizeof(magic)) != 0
+        || !in.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        in.setstate(std::ios_base::failbit);
+        throw_with_trace(std::runtime_error{
+            "Failed to parse |ψ₀〉: Not a binary quantum state."});
+    }
+    SpinVector           spin;
+    std::complex<double> coeff;
+    for (std::uint64_t i = 0; i < count; ++i) {
+        if (!in.read(reinterpret_cast<char*>(&spin), sizeof(spin))
+            || !in.read(reinterpret_cast<char*>(&coeff), sizeof(coeff))) {
+            throw_with_trace(std::runtime_error{
+                "Failed to parse |ψ₀〉: Unexpected end of file."});
+        }
+        if (!x.insert({spin, coeff}).second) {
+            in.setstate(std::ios_base::failbit);
+            throw_with_trace(std::runtime_error{
+                "Failed to parse |ψ₀〉: Duplicate basis elements."});
+        }
+    }
+    return in;
+}
@@ -0,0 +1,433 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sort_merge.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <queue>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+using value_type = QuantumState::value_type;
+
+/// Below this size `std::sort` is faster than the radix passes.
+constexpr std::size_t radix_threshold = 256;
+
+/// Number of elements read from a SpilledRun at once.
+constexpr std::size_t read_block = 1ul << 15;
+
+auto byte_at(SpinVector const& spin, std::size_t const i) noexcept
+    -> std::size_t
+{
+    return std::to_integer<std::size_t>(spin.data()[i]);
+}
+
+/// LSD radix sort over the first `bytes` bytes of the spins. Passes over
+/// bytes which are equal for all elements are skipped.
+auto radix_sort(std::vector<value_type>& xs, std::vector<value_type>& scratch,
+    std::size_t const bytes) -> void
+{
+    std::array<std::size_t, 256> offsets;
+    scratch.resize(xs.size());
+    for (auto i = bytes; i-- > 0;) {
+        offsets.fill(0);
+        for (auto const& x : xs) {
+            ++offsets[byte_at(x.first, i)];
+        }
+        if (std::find(std::begin(offsets), std::end(offsets), xs.size())
+            != std::end(offsets)) {
+            continue;
+        }
+        std::size_t sum = 0;
+        for (auto& offset : offsets) {
+            auto const count = offset;
+            offset           = sum;
+            sum += count;
+        }
+        for (auto const& x : xs) {
+            scratch[offsets[byte_at(x.first, i)]++] = x;
+        }
+        xs.swap(scratch);
+    }
+}
+
+/// Returns the part of the sorted range `[first, last)` which belongs to shard
+/// `i` out of `n`.
+template <class Iterator>
+auto shard_of(Iterator const first, Iterator const last, std::size_t const i,
+    std::size_t const n)
+{
+    auto const begin = std::partition_point(first, last,
+        [i, n](auto const& x) { return spin_to_index(x.first, n) < i; });
+    auto const end   = std::partition_point(begin, last,
+        [i, n](auto const& x) { return spin_to_index(x.first, n) <= i; });
+    return std::make_pair(begin, end);
+}
+
+auto throw_system_error(char const* what) -> void
+{
+    throw_with_trace(
+        std::system_error{errno, std::generic_category(), what});
+}
+
+/// \brief Sequential reader of a part of a run in memory or on disk.
+class RunCursor {
+    value_type const*       _first;
+    value_type const*       _last;
+    SpilledRun const*       _file;
+    std::size_t             _offset; ///< Next element of `_file` to read
+    std::size_t             _end;    ///< End of the range of `_file`
+    std::vector<value_type> _buffer;
+
+  public:
+    RunCursor(value_type const* first, value_type const* last) noexcept
+        : _first{first}, _last{last}, _file{nullptr}, _offset{0}, _end{0}
+    {
+    }
+
+    RunCursor(SpilledRun const& file, std::size_t const first,
+        std::size_t const last)
+        : _first{nullptr}
+        , _last{nullptr}
+        , _file{std::addressof(file)}
+        , _offset{first}
+        , _end{last}
+    {
+        refill();
+    }
+
+    auto done() const noexcept { return _first == _last; }
+    auto front() const noexcept -> value_type const& { return *_first; }
+    auto pop() -> void
+    {
+        TCM_ASSERT(!done());
+        if (++_first == _last && _file != nullptr) { refill(); }
+    }
+
+  private:
+    auto refill() -> void
+    {
+        auto const count = std::min(read_block, _end - _offset);
+        _buffer.resize(count);
+        if (count != 0) { _file->read(_offset, count, _buffer.data()); }
+        _offset += count;
+        _first = _buffer.data();
+        _last  = _buffer.data() + count;
+    }
+};
+
+/// Merges the cursors calling `sink(spin, amplitude)` for every distinct
+/// spin in increasing order.
+template <class Sink>
+auto merge_cursors(std::vector<RunCursor>& cursors, Sink&& sink) -> void
+{
+    cursors.erase(std::remove_if(std::begin(cursors), std::end(cursors),
+                      [](auto const& x) { return x.done(); }),
+        std::end(cursors));
+    // With few runs (one per producer) a linear scan for the minimum is
+    // cheaper than maintaining a heap.
+    while (!cursors.empty()) {
+        auto smallest = cursors.front().front().first;
+        for (auto const& cursor : cursors) {
+            if (cursor.front().first < smallest) {
+                smallest = cursor.front().first;
+            }
+        }
+        std::complex<double> sum = 0.0;
+        for (std::size_t i = 0; i < cursors.size();) {
+            auto& cursor = cursors[i];
+            if (cursor.front().first == smallest) {
+                sum += cursor.front().second;
+                cursor.pop();
+                if (cursor.done()) {
+                    std::swap(cursor, cursors.back());
+                    cursors.pop_back();
+                    continue;
+                }
+            }
+            ++i;
+        }
+        sink(smallest, sum);
+    }
+}
+
+/// Returns cursors over the parts of all runs which belong to `shard`.
+auto shard_cursors(std::vector<std::vector<value_type>> const& runs,
+    std::vector<SpilledRun> const& spilled, std::size_t const shard,
+    std::size_t const number_shards) -> std::vector<RunCursor>
+{
+    std::vector<RunCursor> cursors;
+    cursors.reserve(runs.size() + spilled.size());
+    for (auto const& run : runs) {
+        auto const [first, last] = shard_of(
+            run.data(), run.data() + run.size(), shard, number_shards);
+        cursors.emplace_back(first, last);
+    }
+    for (auto const& run : spilled) {
+        auto const [first, last] = run.shard(shard);
+        cursors.emplace_back(run, first, last);
+    }
+    return cursors;
+}
+} // namespace
+
+auto sort_and_reduce(
+    std::vector<value_type>& xs, std::vector<value_type>& scratch) -> void
+{
+    if (xs.size() < 2) { return; }
+    if (xs.size() < radix_threshold) {
+        std::sort(std::begin(xs), std::end(xs),
+            [](auto const& x, auto const& y) { return x.first < y.first; });
+    }
+    else {
+        radix_sort(xs, scratch,
+            static_cast<std::size_t>(xs.front().first.size() + 7) / 8);
+    }
+    std::size_t last = 0;
+    for (std::size_t i = 1; i < xs.size(); ++i) {
+        if (xs[i].first == xs[last].first) { xs[last].second += xs[i].second; }
+        else {
+            xs[++last] = xs[i];
+        }
+    }
+    xs.resize(last + 1);
+}
+
+SpilledRun::SpilledRun(
+    std::vector<value_type> const& xs, std::size_t const number_shards)
+    : _fd{-1}, _size{xs.size()}, _shard_offsets(number_shards + 1)
+{
+    auto path = (std::filesystem::temp_directory_path() / "lanczos-XXXXXX")
+                    .string();
+    _fd = ::mkstemp(path.data());
+    if (_fd < 0) { throw_system_error("Failed to create a spill file"); }
+    ::unlink(path.c_str());
+
+    for (std::size_t i = 0; i < number_shards; ++i) {
+        auto const [first, last] =
+            shard_of(std::begin(xs), std::end(xs), i, number_shards);
+        _shard_offsets[i]     = static_cast<std::size_t>(first - begin(xs));
+        _shard_offsets[i + 1] = static_cast<std::size_t>(last - begin(xs));
+    }
+    auto const* data      = reinterpret_cast<char const*>(xs.data());
+    auto        remaining = bytes();
+    while (remaining > 0) {
+        auto const written = ::write(_fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            throw_system_error("Failed to write a spill file");
+        }
+        data += written;
+        remaining -= static_cast<std::size_t>(written);
+    }
+}
+
+SpilledRun::SpilledRun(SpilledRun&& other) noexcept
+    : _fd{std::exchange(other._fd, -1)}
+    , _size{std::exchange(other._size, 0)}
+    , _shard_offsets{std::move(other._shard_offsets)}
+{
+}
+
+SpilledRun& SpilledRun::operator=(SpilledRun&& other) noexcept
+{
+    std::swap(_fd, other._fd);
+    std::swap(_size, other._size);
+    std::swap(_shard_offsets, other._shard_offsets);
+    return *this;
+}
+
+SpilledRun::~SpilledRun()
+{
+    if (_fd >= 0) { ::close(_fd); }
+}
+
+auto SpilledRun::read(std::size_t const first, std::size_t const count,
+    value_type* const out) const -> void
+{
+    TCM_ASSERT(first + count <= _size);
+    auto*      data      = reinterpret_cast<char*>(out);
+    auto       remaining = count * sizeof(value_type);
+    auto       offset    = static_cast<off_t>(first * sizeof(value_type));
+    while (remaining > 0) {
+        auto const read = ::pread(_fd, data, remaining, offset);
+        if (read <= 0) {
+            if (read < 0 && errno == EINTR) { continue; }
+            throw_system_error("Failed to read a spill file");
+        }
+        data += read;
+        offset += read;
+        remaining -= static_cast<std::size_t>(read);
+    }
+}
+
+RunCollector::RunCollector(
+    std::size_t const capacity, std::size_t const number_shards)
+    : _buffer{}
+    , _spare{}
+    , _scratch{}
+    , _spilled{}
+    , _pending{}
+    , _capacity{capacity}
+    , _number_shards{number_shards}
+    , _generated{0}
+{
+    if (_capacity != 0) { _buffer.reserve(_capacity); }
+}
+
+auto RunCollector::spill() -> void
+{
+    if (_pending.valid()) { _spilled.push_back(_pending.get()); }
+    _generated += _buffer.size();
+    std::swap(_buffer, _spare);
+    _buffer.clear();
+    _pending = std::async(std::launch::async, [this]() {
+        TCM_TRACE_SCOPE("spill");
+        sort_and_reduce(_spare, _scratch);
+        return SpilledRun{_spare, _number_shards};
+    });
+}
+
+auto RunCollector::finish() -> void
+{
+    if (_pending.valid()) { _spilled.push_back(_pending.get()); }
+    _spare   = {};
+    _scratch = {};
+    _generated += _buffer.size();
+    std::vector<value_type> scratch;
+    sort_and_reduce(_buffer, scratch);
+}
+
+auto merge_runs(std::vector<std::vector<value_type>> const& runs,
+    QuantumState& psi, std::vector<SpilledRun> const& spilled,
+    std::size_t const keep) -> std::size_t
+{
+    auto const number_shards = psi.number_workers();
+
+    if (keep != 0 && !spilled.empty()) {
+        // Min-heap (by magnitude) of the `keep` largest elements seen so far.
+        auto const greater = [](auto const& x, auto const& y) {
+            return std::norm(x.second) > std::norm(y.second);
+        };
+        std::priority_queue<value_type, std::vector<value_type>,
+            decltype(greater)>
+                    largest{greater};
+        std::size_t unique    = 0;
+        double      discarded = 0.0;
+        for (std::size_t shard = 0; shard < number_shards; ++shard) {
+            auto cursors = shard_cursors(runs, spilled, shard, number_shards);
+            merge_cursors(cursors, [&](auto const spin, auto const coeff) {
+                ++unique;
+                if (largest.size() < keep) {
+                    largest.emplace(spin, coeff);
+                }
+                else if (std::norm(coeff) > std::norm(largest.top().second)) {
+                    discarded += std::norm(largest.top().second);
+                    largest.pop();
+                    largest.emplace(spin, coeff);
+                }
+                else {
+                    discarded += std::norm(coeff);
+                }
+            });
+        }
+        // The smallest kept element bounds the dropped ones from above.
+        auto const smallest =
+            largest.empty() ? 0.0 : std::norm(largest.top().second);
+        std::vector<value_type> kept;
+        kept.reserve(largest.size());
+        double total = discarded;
+        while (!largest.empty()) {
+            kept.push_back(largest.top());
+            total += std::norm(kept.back().second);
+            largest.pop();
+        }
+        std::sort(std::begin(kept), std::end(kept),
+            [](auto const& x, auto const& y) { return x.first < y.first; });
+        std::vector<SpinVector>           keys(kept.size());
+        std::vector<std::complex<double>> amplitudes(kept.size());
+        for (std::size_t i = 0; i < kept.size(); ++i) {
+            keys[i]       = kept[i].first;
+            amplitudes[i] = kept[i].second;
+        }
+        psi.assign_sorted(std::move(keys), std::move(amplitudes));
+        psi.add_discarded(discarded);
+        if (discarded > 0.0) { psi.cutoff(std::sqrt(smallest / total)); }
+        return unique;
+    }
+
+    std::vector<std::vector<SpinVector>>           keys(number_shards);
+    std::vector<std::vector<std::complex<double>>> amplitudes(number_shards);
+    parallel_for(number_shards, [&](auto const shard) {
+        auto cursors = shard_cursors(runs, spilled, shard, number_shards);
+        std::size_t upper_bound = 0;
+        for (auto const& run : runs) {
+            auto const [first, last] = shard_of(
+                std::begin(run), std::end(run), shard, number_shards);
+            upper_bound += static_cast<std::size_t>(last - first);
+        }
+        for (auto const& run : spilled) {
+            upper_bound += run.shard(shard).second - run.shard(shard).first;
+        }
+        auto& shard_keys       = keys[shard];
+        auto& shard_amplitudes = amplitudes[shard];
+        shard_keys.reserve(upper_bound);
+        shard_amplitudes.reserve(upper_bound);
+        merge_cursors(cursors, [&](auto const spin, auto const coeff) {
+            shard_keys.push_back(spin);
+            shard_amplitudes.push_back(coeff);
+        });
+    });
+
+    std::size_t total = 0;
+    for (auto const& x : keys) {
+        total += x.size();
+    }
+    std::vector<SpinVector>           all_keys;
+    std::vector<std::complex<double>> all_amplitudes;
+    all_keys.reserve(total);
+    all_amplitudes.reserve(total);
+    for (std::size_t i = 0; i < number_shards; ++i) {
+        all_keys.insert(std::end(all_keys), std::begin(keys[i]),
+            std::end(keys[i]));
+        all_amplitudes.insert(std::end(all_amplitudes),
+            std::begin(amplitudes[i]), std::end(amplitudes[i]));
+    }
+    psi.assign_sorted(std::move(all_keys), std::move(all_amplitudes));
+    return total;
+}
@@ -0,0 +1,189 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "trace.hpp"
+#include "config.hpp"
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+struct TraceEvent {
+    char const*  name;
+    std::int64_t begin;
+    std::int64_t end;
+};
+
+/// \brief Ring buffer of the spans of one thread.
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::size_t             count; ///< Spans recorded since the start
+    std::size_t             lane;  ///< Row of the timeline ("tid")
+};
+
+struct TraceRegistry {
+    std::mutex                                mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    /// Buffers of threads which have exited. Workers of a
+    /// QuantumStateBuilder are started anew for every application of H, so
+    /// their buffers are reused rather than one being created per thread.
+    std::vector<TraceBuffer*> unused;
+    std::size_t               capacity = 0;
+    std::int64_t              origin   = 0;
+};
+
+auto registry() -> TraceRegistry&
+{
+    static TraceRegistry instance;
+    return instance;
+}
+
+/// \brief Buffer lent to the current thread until it exits.
+class TraceLease {
+    TraceBuffer* _buffer = nullptr;
+
+  public:
+    TraceLease() noexcept = default;
+    TraceLease(TraceLease const&) = delete;
+    TraceLease& operator=(TraceLease const&) = delete;
+
+    ~TraceLease()
+    {
+        if (_buffer == nullptr) { return; }
+        auto&                       trace = registry();
+        std::lock_guard<std::mutex> lock{trace.mutex};
+        trace.unused.push_back(_buffer);
+    }
+
+    auto buffer() -> TraceBuffer&
+    {
+        if (_buffer != nullptr) { return *_buffer; }
+        auto&                       trace = registry();
+        std::lock_guard<std::mutex> lock{trace.mutex};
+        if (!trace.unused.empty()) {
+            _buffer = trace.unused.back();
+            trace.unused.pop_back();
+        }
+        else {
+            trace.buffers.push_back(std::make_unique<TraceBuffer>(
+                TraceBuffer{{}, 0, trace.buffers.size()}));
+            _buffer = trace.buffers.back().get();
+        }
+        _buffer->events.resize(trace.capacity);
+        return *_buffer;
+    }
+};
+
+thread_local TraceLease lease;
+} // namespace
+
+auto start_tracing(std::size_t const capacity) -> void
+{
+#if defined(TCM_TRACING)
+    TCM_ASSERT(capacity > 0);
+    auto&                       trace = registry();
+    std::lock_guard<std::mutex> lock{trace.mutex};
+    for (auto& buffer : trace.buffers) {
+        buffer->events.resize(capacity);
+        buffer->count = 0;
+    }
+    trace.capacity = capacity;
+    trace.origin   = trace_clock();
+    tracing_enabled.store(true);
+#else
+    static_cast<void>(capacity);
+    throw_with_trace(std::runtime_error{
+        "Tracing is not compiled in, rebuild with -DLANCZOS_TRACING=ON."});
+#endif
+}
+
+auto stop_tracing() noexcept -> void { tracing_enabled.store(false); }
+
+auto begin_span() noexcept -> std::int64_t
+{
+    try {
+        lease.buffer();
+    }
+    catch (std::bad_alloc const&) {
+        // `record_span` will try again.
+    }
+    return trace_clock();
+}
+
+auto record_span(char const* const name, std::int64_t const begin,
+    std::int64_t const end) noexcept -> void
+{
+    try {
+        auto& buffer = lease.buffer();
+        auto& event  = buffer.events[buffer.count % buffer.events.size()];
+        event        = TraceEvent{name, begin, end};
+        ++buffer.count;
+    }
+    catch (std::bad_alloc const&) {
+        // A missing span is better than a crash.
+    }
+}
+
+auto write_trace(std::ostream& out) -> void
+{
+    auto&                       trace = registry();
+    std::lock_guard<std::mutex> lock{trace.mutex};
+    // Timestamps are in microseconds relative to `start_tracing`.
+    auto const microseconds = [](std::int64_t const t) {
+        return 1e-3 * static_cast<double>(t);
+    };
+    auto const flags = out.flags();
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    auto first = true;
+    for (auto const& buffer : trace.buffers) {
+        if (buffer->count == 0) { continue; }
+        out << (first ? "" : ",")
+            << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << buffer->lane << ",\"args\":{\"name\":\"thread " << buffer->lane
+            << "\"}}";
+        first = false;
+        auto const size  = buffer->events.size();
+        auto const count = std::min(buffer->count, size);
+        for (auto i = buffer->count - count; i < buffer->count; ++i) {
+            auto const& event = buffer->events[i % size];
+            out << ",\n{\"name\":\"" << event.name
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->lane
+                << ",\"ts\":" << microseconds(event.begin - trace.origin)
+                << ",\"dur\":" << microseconds(event.end - event.begin)
+                << '}';
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out.flags(flags);
+}
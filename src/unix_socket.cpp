@@ -0,0 +1,206 @@
+// Copyright Tom Westerhout (c) 2018
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of Tom Westerhout nor the names of other
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "unix_socket.hpp"
+#include "config.hpp"
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+auto throw_system_error(char const* what) -> void
+{
+    throw_with_trace(
+        std::system_error{errno, std::generic_category(), what});
+}
+
+auto make_address(std::string const& path) -> sockaddr_un
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw_with_trace(std::runtime_error{
+            "Invalid socket path '" + path + "': must be non-empty and at "
+            "most " + std::to_string(sizeof(address.sun_path) - 1)
+            + " characters long."});
+    }
+    std::memcpy(address.sun_path, path.data(), path.size());
+    return address;
+}
+
+/// Returns a connected socket or -1 if nobody is listening at `path`.
+auto try_connect(std::string const& path) -> int
+{
+    auto const address = make_address(path);
+    auto const fd      = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { throw_system_error("Failed to create a socket"); }
+    if (::connect(fd, reinterpret_cast<sockaddr const*>(&address),
+            sizeof(address))
+        != 0) {
+        auto const error = errno;
+        ::close(fd);
+        if (error == ECONNREFUSED || error == ENOENT) { return -1; }
+        errno = error;
+        throw_system_error("Failed to connect to the server");
+    }
+    return fd;
+}
+} // namespace
+
+UnixListener::UnixListener(std::string path) : _fd{-1}, _path{std::move(path)}
+{
+    auto const address = make_address(_path);
+    if (std::filesystem::is_socket(_path)) {
+        auto const other = try_connect(_path);
+        if (other >= 0) {
+            ::close(other);
+            throw_with_trace(std::runtime_error{
+                "Another server is already listening on '" + _path + "'."});
+        }
+        std::filesystem::remove(_path);
+    }
+    _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0) { throw_system_error("Failed to create a socket"); }
+    // Whoever can connect can make the server run jobs as our user, so the
+    // socket is created without any permissions for group and others.
+    // chmod afterwards covers file systems which ignore the umask for
+    // sockets.
+    auto const mask  = ::umask(0077);
+    auto const bound = ::bind(_fd,
+        reinterpret_cast<sockaddr const*>(&address), sizeof(address));
+    ::umask(mask);
+    if (bound != 0 || ::chmod(_path.c_str(), 0600) != 0
+        || ::listen(_fd, SOMAXCONN) != 0) {
+        auto const error = errno;
+        ::close(_fd);
+        errno = error;
+        throw_system_error("Failed to listen on the socket");
+    }
+}
+
+UnixListener::~UnixListener()
+{
+    ::close(_fd);
+    ::unlink(_path.c_str());
+}
+
+auto UnixListener::accept() -> int
+{
+    for (;;) {
+        auto const fd = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) {
+            // Second line of defence in case the socket's mode was changed.
+            ucred      peer;
+            socklen_t  size = sizeof(peer);
+            auto const ok =
+                ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0;
+            if (ok && peer.uid == ::geteuid()) { return fd; }
+            ::close(fd);
+            continue;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) { continue; }
+        throw_system_error("Failed to accept a connection");
+    }
+}
+
+auto unix_connect(std::string const& path) -> int
+{
+    auto const fd = try_connect(path);
+    if (fd < 0) {
+        throw_with_trace(std::runtime_error{
+            "No server is listening on '" + path + "'."});
+    }
+    return fd;
+}
+
+SocketBuffer::SocketBuffer(int const fd) : _fd{fd}
+{
+    setg(_input, _input, _input);
+    setp(_output, _output + sizeof(_output));
+}
+
+SocketBuffer::~SocketBuffer()
+{
+    sync();
+    ::close(_fd);
+}
+
+auto SocketBuffer::shutdown_output() -> void
+{
+    sync();
+    ::shutdown(_fd, SHUT_WR);
+}
+
+auto SocketBuffer::underflow() -> int_type
+{
+    if (gptr() < egptr()) { return traits_type::to_int_type(*gptr()); }
+    for (;;) {
+        auto const count = ::read(_fd, _input, sizeof(_input));
+        if (count < 0 && errno == EINTR) { continue; }
+        if (count <= 0) { return traits_type::eof(); }
+        setg(_input, _input, _input + count);
+        return traits_type::to_int_type(*gptr());
+    }
+}
+
+auto SocketBuffer::overflow(int_type const c) -> int_type
+{
+    if (sync() != 0) { return traits_type::eof(); }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+auto SocketBuffer::sync() -> int
+{
+    auto const* data = pbase();
+    while (data < pptr()) {
+        auto const written = ::send(_fd, data,
+            static_cast<std::size_t>(pptr() - data), MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            // The peer has gone away. Further output is discarded.
+            setp(_output, _output + sizeof(_output));
+            return -1;
+        }
+        data += written;
+    }
+    setp(_output, _output + sizeof(_output));
+    return 0;
+}
@@ -0,0 +1,83 @@
+
+#include "block.hpp"
+#include "dense.hpp"
+#include <gtest/gtest.h>
+#include <random>
+
+
+namespace {
+constexpr auto number_spins = 10;
+
+auto ring() -> Hamiltonian
+{
+    std::vector<Heisenberg::edge_type> edges;
+    for (auto i = 0; i < number_spins; ++i) {
+        edges.emplace_back(i, (i + 1) % number_spins);
+    }
+    return Heisenberg{std::move(edges)};
+}
+
+/// Random state on every `stride`'th configuration of the S^z = 0 sector.
+auto random_state(std::size_t const stride, unsigned const seed)
+    -> QuantumState
+{
+    DenseBasis const basis{number_spins, number_spins / 2};
+    std::mt19937     generator{seed};
+    std::uniform_real_distribution<double> coeff{-1.0, 1.0};
+    QuantumState                           psi{1000, 0, 2};
+    for (std::size_t i = 0; i < basis.size(); i += stride) {
+        psi.insert({basis.spin(i), {coeff(generator), coeff(generator)}});
+    }
+    return psi;
+}
+} // namespace
+
+TEST(BlockState, MatchesColumns)
+{
+    auto const                hamiltonian = ring();
+    std::vector<QuantumState> columns;
+    for (auto const stride : {1ul, 2ul, 3ul}) {
+        columns.push_back(random_state(stride, static_cast<unsigned>(stride)));
+    }
+    auto const block = BlockState::from_columns(columns);
+    ASSERT_EQ(block.size(), columns.front().size());
+
+    auto const result = diffusion_step(5.0, hamiltonian, block);
+    for (std::size_t j = 0; j < columns.size(); ++j) {
+        auto const expected = diffusion_step(5.0, hamiltonian, columns[j]);
+        auto const actual   = result.column(j);
+        ASSERT_EQ(actual.size(), expected.size());
+        expected.for_each([&actual](auto const& x) {
+            auto const* where = actual.find(x.first);
+            ASSERT_NE(where, nullptr);
+            ASSERT_NEAR(std::abs(*where - x.second), 0.0, 1e-12);
+        });
+    }
+}
+
+TEST(BlockState, ExcitedState)
+{
+    // Two lowest eigenvalues of the ring in the S^z = 0 sector.
+    constexpr double ground = -18.0617854, excited = -16.3688294;
+
+    auto const                hamiltonian = ring();
+    std::vector<QuantumState> columns;
+    columns.push_back(random_state(1, 1));
+    columns.push_back(random_state(1, 2));
+    PolynomialFilter const filter{PolynomialFilter::Kind::chebyshev, 10, -15.0};
+    auto const             block = diffusion_loop(
+        10.0, filter, hamiltonian, BlockState::from_columns(columns), 30, true);
+
+    auto const norms = block.squared_norms();
+    ASSERT_NEAR(norms[0], 1.0, 1e-12);
+    ASSERT_NEAR(norms[1], 1.0, 1e-12);
+    auto const es = energies(hamiltonian, block);
+    ASSERT_NEAR(es[0].real(), ground, 1e-6);
+    ASSERT_NEAR(es[1].real(), excited, 1e-6);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+
+#include "dense.hpp"
+#include "diffusion.hpp"
+#include "quantum_state.hpp"
+#include <gtest/gtest.h>
+#include <random>
+
+
+TEST(DenseBasis, Ranks)
+{
+    DenseBasis const basis{10, 5};
+    ASSERT_EQ(basis.size(), 252);
+    ASSERT_EQ(DenseBasis::dimension(10, 5), 252);
+    for (std::size_t i = 0; i < basis.size(); ++i) {
+        ASSERT_EQ(__builtin_popcountll(basis.bits(i)), 5);
+        if (i > 0) { ASSERT_TRUE(basis.spin(i - 1) < basis.spin(i)); }
+        ASSERT_EQ(basis.index(basis.bits(i)), i);
+        ASSERT_EQ(basis.find(basis.spin(i)), i);
+    }
+    ASSERT_EQ(basis.find(SpinVector{1, 1, 1, 1, 0, 0, 0, 0, 0, 0}),
+        DenseBasis::npos);
+    ASSERT_EQ(basis.find(SpinVector{1, 1, 1, 1, 1, 0, 0, 0, 0}),
+        DenseBasis::npos);
+
+    DenseBasis const full{6, std::nullopt};
+    ASSERT_EQ(full.size(), 64);
+    ASSERT_EQ(full.find(SpinVector{0, 0, 0, 1, 0, 1}), 5);
+}
+
+namespace {
+/// Checks that the dense backend agrees with hashing for a state on half of
+/// the S^z = 0 sector of `n` spins.
+auto check_against_hashing(Hamiltonian const& hamiltonian, int const n) -> void
+{
+    std::mt19937                           generator{123};
+    std::uniform_real_distribution<double> coeff{-1.0, 1.0};
+    auto const basis = std::make_shared<DenseBasis const>(n, n / 2);
+    QuantumState sparse{1000, 0, 2};
+    QuantumState dense{1000, 0, 2};
+    // Half of the sector, so that H|ψ〉has more elements than |ψ〉.
+    for (std::size_t i = 0; i < basis->size(); i += 2) {
+        QuantumState::value_type x{
+            basis->spin(i), {coeff(generator), coeff(generator)}};
+        sparse.insert(QuantumState::value_type{x});
+        dense.insert(std::move(x));
+    }
+    dense.make_dense(basis);
+    ASSERT_EQ(dense.size(), sparse.size());
+    ASSERT_NEAR(
+        std::abs(energy(hamiltonian, dense) - energy(hamiltonian, sparse)),
+        0.0, 1e-10);
+
+    auto const expected = diffusion_step(3.0, hamiltonian, sparse);
+    auto const actual   = diffusion_step(3.0, hamiltonian, dense);
+    ASSERT_EQ(actual.size(), expected.size());
+    expected.for_each([&actual](auto const& x) {
+        auto const* where = actual.find(x.first);
+        ASSERT_NE(where, nullptr);
+        ASSERT_NEAR(std::abs(*where - x.second), 0.0, 1e-12);
+    });
+}
+} // namespace
+
+TEST(DenseBackend, MatchesHashing)
+{
+    constexpr auto                     n = 10;
+    std::vector<Heisenberg::edge_type> nearest, next_nearest;
+    for (auto i = 0; i < n; ++i) {
+        nearest.emplace_back(i, (i + 1) % n);
+        next_nearest.emplace_back(i, (i + 2) % n);
+    }
+    Hamiltonian const hamiltonian{Heisenberg{
+        {{1.0, std::move(nearest)}, {0.5, std::move(next_nearest)}}}};
+    check_against_hashing(hamiltonian, n);
+}
+
+TEST(DenseBackend, CouplingMatrix)
+{
+    // Dipolar-like couplings 1/r³ on a ring of 10 spins.
+    constexpr auto      n = 10;
+    std::vector<double> couplings(n * n);
+    for (auto i = 0; i < n; ++i) {
+        for (auto j = 0; j < n; ++j) {
+            auto const r = std::min(std::abs(i - j), n - std::abs(i - j));
+            if (r > 0) {
+                couplings[static_cast<std::size_t>(i * n + j)] =
+                    1.0 / (r * r * r);
+            }
+        }
+    }
+    check_against_hashing(Hamiltonian{CouplingMatrix{n, couplings}}, n);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
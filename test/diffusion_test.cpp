@@ -0,0 +1,173 @@
+
+#include "diffusion.hpp"
+#include "quantum_state.hpp"
+#include <gtest/gtest.h>
+#include <numeric>
+#include <random>
+
+
+namespace {
+constexpr int n = 8;
+
+using Vector = std::vector<std::complex<double>>;
+using Matrix = std::vector<Vector>;
+
+/// Heisenberg model on a ring of `n` spins with next-nearest neighbours.
+auto ring() -> Heisenberg
+{
+    std::vector<Heisenberg::edge_type> nearest, next_nearest;
+    for (auto i = 0; i < n; ++i) {
+        nearest.emplace_back(i, (i + 1) % n);
+        next_nearest.emplace_back(i, (i + 2) % n);
+    }
+    return Heisenberg{
+        {{1.0, std::move(nearest)}, {0.4, std::move(next_nearest)}}};
+}
+
+/// Returns H as a dense matrix over all 2ⁿ configurations, indexed by their
+/// bits.
+auto dense_matrix(Heisenberg const& hamiltonian) -> Matrix
+{
+    constexpr std::size_t dimension = 1 << n;
+    Matrix                matrix(dimension, Vector(dimension));
+    for (std::size_t j = 0; j < dimension; ++j) {
+        std::vector<QuantumState::value_type> column;
+        QuantumStateBuilder                   builder{column};
+        hamiltonian(SpinVector::from_bits(j, n), 1.0, builder);
+        for (auto const& [spin, coeff] : column) {
+            matrix[spin.bits()][j] += coeff;
+        }
+    }
+    return matrix;
+}
+
+/// Returns (α·H + β)|x〉.
+auto apply(Matrix const& h, double const alpha, double const beta,
+    Vector const& x) -> Vector
+{
+    Vector y(x.size());
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        y[i] = beta * x[i];
+        for (std::size_t j = 0; j < x.size(); ++j) {
+            y[i] += alpha * h[i][j] * x[j];
+        }
+    }
+    return y;
+}
+
+/// Coefficients of the Chebyshev polynomial Tₖ in the monomial basis.
+auto chebyshev_coefficients(std::size_t const k) -> std::vector<double>
+{
+    std::vector<double> previous{1.0};
+    std::vector<double> current{0.0, 1.0};
+    if (k == 0) { return previous; }
+    for (std::size_t m = 1; m < k; ++m) {
+        std::vector<double> next(m + 2);
+        for (std::size_t i = 0; i <= m; ++i) {
+            next[i + 1] += 2.0 * current[i];
+        }
+        for (std::size_t i = 0; i < previous.size(); ++i) {
+            next[i] -= previous[i];
+        }
+        previous = std::move(current);
+        current  = std::move(next);
+    }
+    return current;
+}
+
+/// Checks that `filter_step` on a hashed state agrees with P(H)|ψ〉 computed
+/// from `reference` and normalised. With `cached`, the diagonal of H is
+/// cached in |ψ〉 first.
+template <class Reference>
+auto check_filter(PolynomialFilter const& filter, double const lambda,
+    Reference&& reference, bool const cached = false) -> void
+{
+    std::mt19937                           generator{17};
+    std::uniform_real_distribution<double> coeff{-1.0, 1.0};
+    auto const                             hamiltonian = ring();
+    auto const                             h = dense_matrix(hamiltonian);
+    Vector                                 x(h.size());
+    QuantumState                           psi{h.size(), 0, 2};
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        x[i] = {coeff(generator), coeff(generator)};
+        psi.insert({SpinVector::from_bits(i, n), x[i]});
+    }
+    if (cached) {
+        psi.cache_diagonal(std::make_shared<Heisenberg const>(hamiltonian));
+        ASSERT_TRUE(psi.has_diagonal(hamiltonian));
+    }
+
+    auto       expected = reference(h, x);
+    auto const norm     = std::sqrt(std::accumulate(std::begin(expected),
+        std::end(expected), 0.0,
+        [](auto const acc, auto const y) { return acc + std::norm(y); }));
+    auto const actual = filter_step(lambda, filter, hamiltonian, psi);
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        auto const* where = actual.find(SpinVector::from_bits(i, n));
+        auto const  value = where != nullptr ? *where : 0.0;
+        ASSERT_NEAR(std::abs(value - expected[i] / norm), 0.0, 1e-10);
+    }
+}
+} // namespace
+
+TEST(PolynomialFilter, Power)
+{
+    constexpr double lambda = 6.0;
+    PolynomialFilter filter;
+    filter.kind   = PolynomialFilter::Kind::power;
+    filter.degree = 3;
+    for (auto const cached : {false, true}) {
+        check_filter(
+            filter, lambda,
+            [&](auto const& h, auto x) {
+                for (std::size_t k = 0; k < filter.degree; ++k) {
+                    x = apply(h, -1.0, lambda, x);
+                }
+                return x;
+            },
+            cached);
+    }
+}
+
+TEST(PolynomialFilter, Chebyshev)
+{
+    constexpr double lambda = 6.0;
+    PolynomialFilter filter;
+    filter.kind  = PolynomialFilter::Kind::chebyshev;
+    filter.lower = -2.0;
+    for (auto const degree : {1ul, 2ul, 5ul}) {
+        filter.degree = degree;
+        // Σⱼ aⱼ·tʲ|ψ〉 with t = (c - H) / e, by Horner's scheme.
+        check_filter(filter, lambda, [&](auto const& h, auto const& x) {
+            auto const center     = 0.5 * (lambda + filter.lower);
+            auto const half_width = 0.5 * (lambda - filter.lower);
+            auto const coeffs     = chebyshev_coefficients(degree);
+            Vector     y(x.size());
+            for (auto j = coeffs.size(); j-- > 0;) {
+                y = apply(h, -1.0 / half_width, center / half_width, y);
+                for (std::size_t i = 0; i < x.size(); ++i) {
+                    y[i] += coeffs[j] * x[i];
+                }
+            }
+            return y;
+        });
+    }
+}
+
+TEST(EnergyAverage, SkipsZeroOverlap)
+{
+    EnergyAverage average;
+    ASSERT_EQ(average.add({-4.0, 0.0}, {2.0, 0.0}), -2.0);
+    ASSERT_FALSE(average.add({1.0, 0.0}, 0.0).has_value());
+    ASSERT_EQ(average.add({-6.0, 0.0}, {2.0, 0.0}), -3.0);
+    ASSERT_EQ(average.count, 2u);
+    ASSERT_EQ(average.skipped, 1u);
+    ASSERT_NEAR(average.mean(), -2.25, 1e-12);
+    ASSERT_NEAR(average.standard_error(), 0.5, 1e-12);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
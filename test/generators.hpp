@@ -0,0 +1,32 @@
+#pragma once
+
+#include "quantum_state.hpp"
+#include <random>
+#include <vector>
+
+// Inputs shared by the tests. Everything is seeded, so that failures are
+// reproducible.
+namespace test {
+
+/// Returns `count` contributions with random real amplitudes to
+/// configurations of `n` spins.
+inline auto random_contributions(std::size_t const count, std::size_t const n,
+    unsigned const seed) -> std::vector<QuantumState::value_type>
+{
+    std::mt19937                           generator{seed};
+    std::uniform_int_distribution<int>     bit{0, 1};
+    std::uniform_real_distribution<double> coeff{-1.0, 1.0};
+    std::vector<QuantumState::value_type>  xs;
+    std::vector<int>                       spins(n);
+    for (std::size_t i = 0; i < count; ++i) {
+        // Only 8 spins are random, so that there are plenty of duplicates.
+        for (std::size_t j = 0; j < n; ++j) {
+            spins[j] = (j < 4 || j >= n - 4) ? bit(generator) : 0;
+        }
+        xs.emplace_back(SpinVector{std::begin(spins), std::end(spins)},
+            std::complex{coeff(generator), 0.0});
+    }
+    return xs;
+}
+
+} // namespace test
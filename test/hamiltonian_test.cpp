@@ -0,0 +1,282 @@
+
+#include "hamiltonian.hpp"
+#include "quantum_state.hpp"
+#include "sort_merge.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+
+
+namespace {
+auto random_heisenberg(int const n, std::mt19937& generator) -> Heisenberg
+{
+    std::uniform_int_distribution<int>    site{0, n - 1};
+    std::vector<Heisenberg::spec_type>    specs;
+    for (auto const coupling : {1.0, -0.3}) {
+        std::vector<Heisenberg::edge_type> edges;
+        // More than 64 edges, so that several chunks are needed.
+        while (edges.size() < 80) {
+            auto const i = site(generator);
+            auto const j = site(generator);
+            if (i != j) { edges.emplace_back(i, j); }
+        }
+        specs.emplace_back(coupling, std::move(edges));
+    }
+    return Heisenberg{std::move(specs)};
+}
+
+/// Returns an asymmetric n×n matrix in which about a quarter of the pairs
+/// do not interact.
+auto random_couplings(int const n, std::mt19937& generator)
+    -> std::vector<double>
+{
+    std::uniform_real_distribution<double> coupling{-1.0, 1.0};
+    std::bernoulli_distribution            absent{0.25};
+    auto const                             size = static_cast<std::size_t>(n);
+    std::vector<double>                    couplings(size * size);
+    for (std::size_t i = 0; i < size; ++i) {
+        for (auto j = i; j < size; ++j) {
+            if (absent(generator)) { continue; }
+            couplings[i * size + j] = coupling(generator);
+            couplings[j * size + i] = coupling(generator);
+        }
+    }
+    return couplings;
+}
+
+auto random_spins(int const n, std::size_t const count,
+    std::mt19937& generator) -> std::vector<SpinVector>
+{
+    std::bernoulli_distribution bit;
+    std::vector<SpinVector>     spins;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::vector<int> xs(static_cast<std::size_t>(n));
+        for (auto& x : xs) {
+            x = bit(generator);
+        }
+        spins.emplace_back(std::begin(xs), std::end(xs));
+    }
+    return spins;
+}
+
+/// Returns Σᵢ cᵢ·H|σᵢ〉 as a sorted list of elements.
+template <class Apply>
+auto accumulate(Apply&& apply) -> std::vector<QuantumState::value_type>
+{
+    std::vector<QuantumState::value_type> xs;
+    std::vector<QuantumState::value_type> scratch;
+    QuantumStateBuilder                   builder{xs};
+    apply(builder);
+    sort_and_reduce(xs, scratch);
+    return xs;
+}
+} // namespace
+
+TEST(Heisenberg, BatchMatchesScalar)
+{
+    std::mt19937                           generator{7};
+    std::bernoulli_distribution            bit;
+    std::uniform_real_distribution<double> coeff{-1.0, 1.0};
+    // 70 spins exercises the fallback for configurations which do not fit
+    // into a 64-bit word.
+    for (auto const n : {12, 64, 70}) {
+        auto const              hamiltonian = random_heisenberg(n, generator);
+        std::vector<SpinVector> spins;
+        std::vector<std::complex<double>> coeffs;
+        for (std::size_t i = 0; i < Heisenberg::batch_size - 1; ++i) {
+            std::vector<int> xs(static_cast<std::size_t>(n));
+            for (auto& x : xs) {
+                x = bit(generator);
+            }
+            spins.emplace_back(std::begin(xs), std::end(xs));
+            coeffs.emplace_back(coeff(generator), coeff(generator));
+        }
+        for (auto const with_diagonal : {true, false}) {
+            auto const expected = accumulate([&](auto& builder) {
+                for (std::size_t i = 0; i < spins.size(); ++i) {
+                    hamiltonian(spins[i], coeffs[i], builder, with_diagonal);
+                }
+            });
+            auto const actual = accumulate([&](auto& builder) {
+                hamiltonian(spins.data(), coeffs.data(), spins.size(),
+                    builder, with_diagonal);
+            });
+            ASSERT_EQ(actual.size(), expected.size());
+            for (std::size_t i = 0; i < actual.size(); ++i) {
+                ASSERT_EQ(actual[i].first, expected[i].first);
+                ASSERT_NEAR(std::abs(actual[i].second - expected[i].second),
+                    0.0, 1e-12);
+            }
+        }
+
+        // H|σ〉 never contains σ apart from the diagonal term.
+        std::vector<std::complex<double>> diagonal(spins.size());
+        hamiltonian.diagonal(spins.data(), spins.size(), diagonal.data());
+        for (std::size_t i = 0; i < spins.size(); ++i) {
+            auto const h_spin = accumulate([&](auto& builder) {
+                hamiltonian(spins[i], 1.0, builder);
+            });
+            auto const where = std::find_if(std::begin(h_spin),
+                std::end(h_spin),
+                [&](auto const& x) { return x.first == spins[i]; });
+            auto const expected =
+                where != std::end(h_spin) ? where->second : 0.0;
+            ASSERT_NEAR(std::abs(diagonal[i] - expected), 0.0, 1e-12);
+        }
+    }
+}
+
+TEST(Heisenberg, Energy)
+{
+    constexpr int                          n = 12;
+    std::mt19937                           generator{5};
+    std::uniform_real_distribution<double> coeff{-1.0, 1.0};
+    auto const hamiltonian = random_heisenberg(n, generator);
+    // 300 of the 4096 configurations, so that many of the configurations
+    // H|σ〉 is made of are part of the state, but not all.
+    QuantumState psi{300, 0, 4};
+    for (auto const& spin : random_spins(n, 300, generator)) {
+        psi.insert({spin, {coeff(generator), coeff(generator)}});
+    }
+    std::vector<QuantumState::value_type> elements;
+    psi.for_each([&elements](auto const& x) { elements.push_back(x); });
+    auto const h_psi = accumulate([&](auto& builder) {
+        for (auto const& [spin, c] : elements) {
+            hamiltonian(spin, c, builder);
+        }
+    });
+    std::complex<double> expected = 0.0;
+    for (auto const& [spin, c] : h_psi) {
+        if (auto const* x = psi.find(spin)) { expected += std::conj(*x) * c; }
+    }
+
+    ASSERT_NEAR(std::abs(energy(hamiltonian, psi) - expected), 0.0, 1e-10);
+    psi.freeze();
+    ASSERT_NEAR(std::abs(energy(hamiltonian, psi) - expected), 0.0, 1e-10);
+    psi.cache_diagonal(std::make_shared<Heisenberg const>(hamiltonian));
+    ASSERT_TRUE(psi.has_diagonal(hamiltonian));
+    ASSERT_NEAR(std::abs(energy(hamiltonian, psi) - expected), 0.0, 1e-10);
+    psi.thaw();
+    ASSERT_FALSE(psi.has_diagonal(hamiltonian));
+}
+
+TEST(Heisenberg, Screening)
+{
+    std::mt19937                           generator{13};
+    std::uniform_real_distribution<double> coeff{0.5, 1.0};
+    for (auto const n : {12, 70}) {
+        auto const hamiltonian = random_heisenberg(n, generator);
+        auto const& [strong, strong_edges] = hamiltonian.specs().front();
+        auto const& [weak, weak_edges]     = hamiltonian.specs().back();
+        // Off-diagonal amplitudes are 2·c·J, i.e. between 1 and 2 for J = 1
+        // and between 0.3 and 0.6 for J = -0.3, so the threshold removes
+        // exactly the flips of the second spec.
+        Screening const screening{0.8, false, 0};
+        auto const      spins =
+            random_spins(n, Heisenberg::batch_size, generator);
+        std::vector<std::complex<double>> coeffs;
+        for (std::size_t i = 0; i < spins.size(); ++i) {
+            coeffs.emplace_back(coeff(generator));
+        }
+
+        auto const expected = accumulate([&](auto& builder) {
+            Heisenberg const flips{strong_edges, strong};
+            for (std::size_t i = 0; i < spins.size(); ++i) {
+                flips(spins[i], coeffs[i], builder);
+                auto diagonal = 0.0;
+                for (auto const& [a, b] : weak_edges) {
+                    diagonal += spins[i][a] == spins[i][b] ? 1.0 : -1.0;
+                }
+                builder += {diagonal * weak * coeffs[i], spins[i]};
+            }
+        });
+        auto const scalar = accumulate([&](auto& builder) {
+            builder.screening(screening);
+            for (std::size_t i = 0; i < spins.size(); ++i) {
+                hamiltonian(spins[i], coeffs[i], builder);
+            }
+        });
+        auto const batched = accumulate([&](auto& builder) {
+            builder.screening(screening);
+            hamiltonian(spins.data(), coeffs.data(), spins.size(), builder);
+        });
+        for (auto const* actual : {&scalar, &batched}) {
+            ASSERT_EQ(actual->size(), expected.size());
+            for (std::size_t i = 0; i < expected.size(); ++i) {
+                ASSERT_EQ((*actual)[i].first, expected[i].first);
+                ASSERT_NEAR(std::abs((*actual)[i].second - expected[i].second),
+                    0.0, 1e-12);
+            }
+        }
+    }
+}
+
+TEST(CouplingMatrix, MatchesHeisenberg)
+{
+    std::mt19937 generator{11};
+    for (auto const n : {12, 64, 70}) {
+        auto const           js = random_couplings(n, generator);
+        CouplingMatrix const matrix{n, js};
+        // The same operator as an edge list, with one spec per pair.
+        std::vector<Heisenberg::spec_type> specs;
+        auto const                         size = static_cast<std::size_t>(n);
+        for (std::size_t i = 0; i < size; ++i) {
+            for (auto j = i + 1; j < size; ++j) {
+                auto const coupling =
+                    0.5 * (js[i * size + j] + js[j * size + i]);
+                if (coupling != 0.0) {
+                    specs.push_back({coupling,
+                        {{static_cast<int>(i), static_cast<int>(j)}}});
+                }
+            }
+        }
+        ASSERT_EQ(matrix.number_edges(), specs.size());
+        Heisenberg const heisenberg{std::move(specs)};
+
+        auto const spins    = random_spins(n, 5, generator);
+        auto const expected = accumulate([&](auto& builder) {
+            for (auto const& spin : spins) {
+                heisenberg(spin, 0.5, builder);
+            }
+        });
+        auto const actual = accumulate([&](auto& builder) {
+            for (auto const& spin : spins) {
+                matrix(spin, 0.5, builder);
+            }
+        });
+        ASSERT_EQ(actual.size(), expected.size());
+        for (std::size_t i = 0; i < actual.size(); ++i) {
+            ASSERT_EQ(actual[i].first, expected[i].first);
+            ASSERT_NEAR(
+                std::abs(actual[i].second - expected[i].second), 0.0, 1e-12);
+        }
+    }
+}
+
+TEST(CouplingMatrix, Binary)
+{
+    std::mt19937         generator{3};
+    CouplingMatrix const matrix{10, random_couplings(10, generator)};
+    std::stringstream    stream;
+    write_binary(stream, matrix);
+    ASSERT_TRUE(is_binary_couplings(stream));
+    CouplingMatrix copy;
+    read_binary(stream, copy);
+    ASSERT_EQ(copy.number_spins(), 10);
+    for (auto i = 0; i < 10; ++i) {
+        for (auto j = 0; j < 10; ++j) {
+            ASSERT_EQ(copy.coupling(i, j), matrix.coupling(i, j));
+        }
+    }
+
+    std::istringstream text{"1.0 [(0, 1)]"};
+    ASSERT_FALSE(is_binary_couplings(text));
+    ASSERT_EQ(text.peek(), '1');
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,124 @@
+
+#include "kernels.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+namespace {
+auto all_isas() -> std::vector<Isa>
+{
+    std::vector<Isa> isas;
+    for (auto const isa :
+        {Isa::generic, Isa::sse4_2, Isa::avx2, Isa::avx512}) {
+        if (supported(isa)) { isas.push_back(isa); }
+    }
+    return isas;
+}
+
+auto random_amplitudes(std::size_t const n)
+    -> std::vector<std::complex<double>>
+{
+    std::mt19937                      generator{123};
+    std::normal_distribution<double>  normal;
+    std::vector<std::complex<double>> xs(n);
+    for (auto& x : xs) {
+        x = {normal(generator), normal(generator)};
+    }
+    return xs;
+}
+} // namespace
+
+TEST(Kernels, Selection)
+{
+    ASSERT_TRUE(supported(Isa::generic));
+    ASSERT_TRUE(supported(detected_isa()));
+    ASSERT_EQ(current_isa(), detected_isa());
+    select_isa(Isa::generic);
+    ASSERT_EQ(current_isa(), Isa::generic);
+    ASSERT_EQ(&kernels(), &kernels(Isa::generic));
+    select_isa(detected_isa());
+    ASSERT_STREQ(to_string(Isa::sse4_2), "sse4.2");
+}
+
+// Variants differ at most by the rounding of fused multiply-adds.
+TEST(Kernels, Reductions)
+{
+    for (auto const n : {0ul, 1ul, 7ul, 8ul, 1001ul}) {
+        auto const          xs = random_amplitudes(n);
+        std::vector<double> expected(n);
+        kernels(Isa::generic).norms(xs.data(), n, expected.data());
+        auto const norm = kernels(Isa::generic).squared_norm(xs.data(), n);
+        auto const below =
+            kernels(Isa::generic).count_less(expected.data(), n, 1.0);
+        for (auto const isa : all_isas()) {
+            auto const&         kernel = kernels(isa);
+            std::vector<double> norms(n);
+            kernel.norms(xs.data(), n, norms.data());
+            for (std::size_t i = 0; i < n; ++i) {
+                ASSERT_NEAR(norms[i], expected[i], 1e-15 * expected[i])
+                    << to_string(isa);
+            }
+            ASSERT_NEAR(kernel.squared_norm(xs.data(), n), norm, 1e-14 * norm);
+            ASSERT_EQ(kernel.count_less(expected.data(), n, 1.0), below);
+        }
+    }
+}
+
+TEST(Kernels, Scale)
+{
+    auto const                 xs = random_amplitudes(13);
+    std::complex<double> const c{0.3, -1.7};
+    for (auto const isa : all_isas()) {
+        auto ys = xs;
+        kernels(isa).scale(ys.data(), ys.size(), c);
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            ASSERT_NEAR(std::abs(ys[i] - xs[i] * c), 0.0, 1e-14)
+                << to_string(isa);
+        }
+        ys = xs;
+        kernels(isa).scale(ys.data(), ys.size(), 2.0);
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            ASSERT_EQ(ys[i], 2.0 * xs[i]) << to_string(isa);
+        }
+    }
+}
+
+TEST(Kernels, Antiparallel)
+{
+    constexpr auto                   n = 40;
+    std::mt19937_64                  generator{42};
+    std::uniform_int_distribution<>  site{0, n - 1};
+    std::vector<std::pair<int, int>> edges(64);
+    for (auto& edge : edges) {
+        edge = {site(generator), site(generator)};
+    }
+    std::uint64_t spins[kernel_lanes];
+    for (auto& x : spins) {
+        x = generator() >> (64 - n);
+    }
+    for (auto const isa : all_isas()) {
+        std::uint64_t masks[kernel_lanes];
+        int           counts[kernel_lanes];
+        kernels(isa).antiparallel(
+            spins, edges.data(), edges.size(), n, masks, counts);
+        for (std::size_t lane = 0; lane < kernel_lanes; ++lane) {
+            int expected = 0;
+            for (std::size_t e = 0; e < edges.size(); ++e) {
+                auto const spin = [&](auto const i) {
+                    return (spins[lane] >> (n - 1 - i)) & 1u;
+                };
+                auto const anti =
+                    spin(edges[e].first) != spin(edges[e].second);
+                expected += anti;
+                ASSERT_EQ((masks[lane] >> e) & 1u, anti) << to_string(isa);
+            }
+            ASSERT_EQ(counts[lane], expected);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
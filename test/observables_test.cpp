@@ -0,0 +1,93 @@
+
+#include "observables.hpp"
+#include "quantum_state.hpp"
+#include <gtest/gtest.h>
+#include <random>
+
+
+namespace {
+auto random_state(int const n, std::size_t const count,
+    std::size_t const number_shards) -> QuantumState
+{
+    std::mt19937                     generator{5};
+    std::bernoulli_distribution      bit;
+    std::normal_distribution<double> amplitude;
+    QuantumState                     psi{count, 4 * count, number_shards};
+    while (psi.size() < count) {
+        std::vector<int> xs(static_cast<std::size_t>(n));
+        for (auto& x : xs) {
+            x = bit(generator);
+        }
+        psi.insert({SpinVector{std::begin(xs), std::end(xs)},
+            {amplitude(generator), amplitude(generator)}});
+    }
+    return psi;
+}
+
+auto ring(int const n) -> Hamiltonian
+{
+    std::vector<Heisenberg::edge_type> edges;
+    for (auto i = 0; i < n; ++i) {
+        edges.emplace_back((i + 1) % n, i);
+    }
+    return Heisenberg{std::move(edges)};
+}
+} // namespace
+
+// 70 spins exercises the path for configurations longer than 64 bits.
+TEST(Observables, ConsistentWithEnergy)
+{
+    for (auto const n : {10, 70}) {
+        auto const hamiltonian = ring(n);
+        auto const psi         = random_state(n, 300, 4);
+        auto const x           = measure(psi, bonds(hamiltonian));
+        ASSERT_EQ(x.number_spins, n);
+        ASSERT_EQ(x.bonds.size(), static_cast<std::size_t>(n));
+        ASSERT_LT(x.bonds.front().first, x.bonds.front().second);
+
+        // H = Σ σᵢ·σⱼ = 4 Σ Sᵢ·Sⱼ over the bonds.
+        double sum = 0.0;
+        for (auto const value : x.bond_values) {
+            sum += 4.0 * value;
+        }
+        auto const expected = energy(hamiltonian, psi) / psi.squared_norm();
+        ASSERT_NEAR(sum, expected.real(), 1e-10);
+
+        double probability = 0.0;
+        double sz_squared  = 0.0;
+        for (std::size_t k = 0; k < x.magnetisation.size(); ++k) {
+            auto const sz = static_cast<double>(k) - 0.5 * n;
+            probability += x.magnetisation[k];
+            sz_squared += x.magnetisation[k] * sz * sz;
+        }
+        ASSERT_NEAR(probability, 1.0, 1e-12);
+        // Sᶻᶻ(0) = 〈(Sᶻ)²〉/ N
+        ASSERT_NEAR(x.structure_factor(0.0), sz_squared / n, 1e-10);
+
+        auto const size = static_cast<std::size_t>(n);
+        for (std::size_t i = 0; i < size; ++i) {
+            ASSERT_NEAR(x.szsz[i * size + i], 0.25, 1e-12);
+            for (std::size_t j = 0; j < i; ++j) {
+                ASSERT_NEAR(x.szsz[i * size + j], x.szsz[j * size + i], 1e-12);
+            }
+        }
+    }
+}
+
+TEST(Observables, SingletBond)
+{
+    // (|01〉- |10〉)/√2 has 〈S₀·S₁〉= -3/4 and 〈Sᶻ₀Sᶻ₁〉= -1/4.
+    QuantumState psi{2, 4, 1};
+    psi.insert({SpinVector{0, 1}, 1.0});
+    psi.insert({SpinVector{1, 0}, -1.0});
+    auto const x = measure(psi, {{0, 1}});
+    ASSERT_NEAR(x.bond_values.front(), -0.75, 1e-12);
+    ASSERT_NEAR(x.szsz[1], -0.25, 1e-12);
+    ASSERT_NEAR(x.magnetisation[1], 1.0, 1e-12);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,55 @@
+
+#include "parallel.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+TEST(ThreadPool, ReusesThreads)
+{
+    ThreadPool pool;
+    for (auto round = 0; round < 10; ++round) {
+        std::atomic<int> sum{0};
+        std::vector<std::future<void>> tasks;
+        for (auto i = 1; i <= 4; ++i) {
+            tasks.push_back(pool.submit([&sum, i]() { sum += i; }));
+        }
+        for (auto& task : tasks) {
+            task.get();
+        }
+        ASSERT_EQ(sum, 10);
+    }
+    ASSERT_LE(pool.size(), 4u);
+}
+
+TEST(ThreadPool, TasksDoNotWaitForEachOther)
+{
+    // The first task only finishes once the second one has run, which
+    // deadlocks if the second one has to wait for a free thread.
+    ThreadPool        pool;
+    std::atomic<bool> second{false};
+    auto first = pool.submit([&second]() {
+        while (!second)
+            std::this_thread::yield();
+    });
+    pool.submit([&second]() { second = true; }).get();
+    first.get();
+}
+
+TEST(ParallelFor, RethrowsAfterAllCalls)
+{
+    std::atomic<int> calls{0};
+    ASSERT_THROW(parallel_for(8,
+                     [&calls](auto const i) {
+                         ++calls;
+                         if (i == 3) { throw std::runtime_error{"3"}; }
+                     }),
+        std::runtime_error);
+    ASSERT_EQ(calls, 8);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
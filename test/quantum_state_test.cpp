@@ -0,0 +1,260 @@
+
+#include "generators.hpp"
+#include "quantum_state.hpp"
+#include "sort_merge.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <random>
+#include <utility>
+
+
+TEST(Screening, Deterministic)
+{
+    Screening screening{0.5, false, 0};
+    ASSERT_EQ(screening({0.3, -0.4}), std::complex(0.3, -0.4));
+    ASSERT_EQ(screening(-0.5), -0.5);
+    ASSERT_EQ(screening({0.0, 0.49}), 0.0);
+    ASSERT_EQ(Screening{}(1e-300), 1e-300);
+}
+
+TEST(Screening, StochasticIsUnbiased)
+{
+    constexpr auto samples   = 200000;
+    constexpr auto threshold = 1.0;
+    Screening      screening{threshold, true, 42};
+    for (auto const coeff : {std::complex{0.3, 0.2}, std::complex{-0.05, 0.0},
+             std::complex{0.0, 0.9}}) {
+        std::complex<double> mean = 0.0;
+        auto                 kept = 0;
+        for (auto i = 0; i < samples; ++i) {
+            auto const x = screening(coeff);
+            if (x == 0.0) { continue; }
+            // Survivors are raised to the threshold, keeping their phase.
+            ASSERT_NEAR(std::abs(x), threshold, 1e-12);
+            ASSERT_NEAR(std::abs(x / std::abs(x) - coeff / std::abs(coeff)),
+                0.0, 1e-12);
+            mean += x / double{samples};
+            ++kept;
+        }
+        // The variance of one sample is at most threshold · |c|.
+        ASSERT_NEAR(std::abs(mean - coeff), 0.0,
+            5.0 * std::sqrt(threshold * std::abs(coeff) / samples));
+        ASSERT_NEAR(static_cast<double>(kept) / samples, std::abs(coeff),
+            0.01);
+    }
+}
+
+TEST(QuantumState, ShrinkResetsCutoff)
+{
+    QuantumState psi{10, 0, 2};
+    psi.cutoff(0.5);
+    psi.screening(0.1);
+    for (auto i = 0u; i < 5; ++i) {
+        psi.insert({SpinVector::from_bits(i, 8), 1.0});
+    }
+    ASSERT_EQ(psi.shrink(), 0.0);
+    ASSERT_EQ(psi.cutoff(), 0.0);
+    ASSERT_EQ(psi.empty_successor().cutoff(), 0.0);
+    ASSERT_EQ(psi.empty_successor().screening_threshold(), 0.0);
+}
+
+TEST(QuantumState, SummarisedTruncation)
+{
+    // Random amplitudes and amplitudes with plenty of ties, with and without
+    // pruning by the workers.
+    for (auto const [tied, prune] :
+        {std::pair{false, false}, std::pair{true, false},
+            std::pair{false, true}, std::pair{true, true}}) {
+        auto xs = test::random_contributions(2000, 24, 5);
+        std::vector<QuantumState::value_type> scratch;
+        sort_and_reduce(xs, scratch);
+        if (tied) {
+            for (std::size_t i = 0; i < xs.size(); ++i) {
+                xs[i].second = i % 4 == 0 ? 2.0 : 1.0;
+            }
+        }
+        constexpr auto soft_max = 20ul;
+        QuantumState   expected{soft_max, 0, 8};
+        QuantumState   actual{soft_max, 0, 8};
+        {
+            QuantumStateBuilder builder{actual};
+            builder.summarise(soft_max, prune);
+            builder.start();
+            for (auto const& [spin, coeff] : xs) {
+                expected.insert({spin, coeff});
+                builder += {coeff, spin};
+            }
+            builder.stop();
+            actual.summaries(builder.summaries());
+        }
+        if (prune && !tied) {
+            for (auto const& table : std::as_const(actual).tables()) {
+                ASSERT_LE(table.size(), soft_max);
+            }
+        }
+        ASSERT_NEAR(actual.squared_norm() + actual.discarded(),
+            expected.squared_norm(), 1e-9);
+        expected.normalize();
+        actual.normalize();
+        ASSERT_EQ(actual.summaries().size(), 8u);
+        auto const discarded = actual.shrink();
+        ASSERT_NEAR(discarded, expected.shrink(), 1e-12);
+        ASSERT_TRUE(actual.summaries().empty());
+        ASSERT_EQ(actual.size(), soft_max);
+        ASSERT_NEAR(actual.cutoff(), expected.cutoff(), 1e-12);
+        if (!tied) {
+            expected.for_each([&actual](auto const& x) {
+                auto const* where = actual.find(x.first);
+                ASSERT_NE(where, nullptr);
+                ASSERT_NEAR(std::abs(*where - x.second), 0.0, 1e-12);
+            });
+        }
+    }
+}
+
+TEST(QuantumState, MemoryLimit)
+{
+    QuantumState expected{0, 0, 4};
+    for (auto const& [spin, coeff] :
+        test::random_contributions(2000, 24, 6)) {
+        expected.insert({spin, 0.0}).first->second += coeff;
+    }
+    std::vector<QuantumState::value_type> xs;
+    double                                norm = 0.0;
+    expected.for_each([&xs, &norm](auto const& x) {
+        xs.push_back(x);
+        norm += std::norm(x.second);
+    });
+    auto largest = xs;
+    std::sort(std::begin(largest), std::end(largest),
+        [](auto const& a, auto const& b) {
+            return std::norm(a.second) > std::norm(b.second);
+        });
+    largest.resize(4);
+
+    // Room for about 16 elements per table.
+    auto const limit = spin_map_bytes<std::complex<double>>(32, 16);
+    for (auto const reversed : {false, true}) {
+        if (reversed) { std::reverse(std::begin(xs), std::end(xs)); }
+        QuantumState                   actual{0, 0, 4};
+        std::pair<std::size_t, double> dropped;
+        {
+            QuantumStateBuilder builder{actual};
+            builder.limit(limit);
+            builder.start();
+            for (auto const& [spin, coeff] : xs) {
+                builder += {coeff, spin};
+            }
+            builder.stop();
+            dropped = builder.dropped();
+        }
+        ASSERT_GT(dropped.first, 0u);
+        ASSERT_EQ(actual.size() + dropped.first, xs.size());
+        for (auto const& table : actual.tables()) {
+            ASSERT_LE(memory_usage(table), limit);
+        }
+        // Every configuration receives a single contribution, so the evicted
+        // norm is exactly what is missing.
+        double kept = 0.0;
+        actual.for_each(
+            [&kept](auto const& x) { kept += std::norm(x.second); });
+        ASSERT_NEAR(kept + dropped.second, norm, 1e-12);
+        // The largest amplitudes survive in any order.
+        for (auto const& [spin, coeff] : largest) {
+            auto const* where = actual.find(spin);
+            ASSERT_NE(where, nullptr);
+            ASSERT_EQ(*where, coeff);
+        }
+    }
+}
+
+TEST(QuantumState, SoftMaxWithin)
+{
+    constexpr std::size_t mib = 1 << 20;
+    auto const            small =
+        QuantumState::soft_max_within(mib, 10.0, 1, 4, Backend::hash);
+    auto const large =
+        QuantumState::soft_max_within(16 * mib, 10.0, 1, 4, Backend::hash);
+    ASSERT_GT(small, 0u);
+    ASSERT_GT(large, 8 * small);
+    ASSERT_EQ(
+        QuantumState::soft_max_within(1024, 10.0, 1, 4, Backend::hash), 0u);
+    ASSERT_EQ(QuantumState::soft_max_within(mib, 10.0, 1, 4, Backend::sort),
+        mib / 128);
+    // Chebyshev filters keep three vectors alive besides ψ.
+    auto const filtered =
+        QuantumState::soft_max_within(mib, 10.0, 3, 4, Backend::hash);
+    ASSERT_GT(filtered, 0u);
+    ASSERT_LT(2 * filtered, small);
+    ASSERT_EQ(QuantumState::soft_max_within(mib, 10.0, 3, 4, Backend::sort),
+        mib / 256);
+
+    // A state of `small` elements leaves enough room for tables which hold
+    // 10 times as many (plus slack).
+    QuantumState     psi{small, 0, 4};
+    std::vector<int> spins(64);
+    for (std::size_t i = 0; i < small; ++i) {
+        for (std::size_t j = 0; j < spins.size(); ++j) {
+            spins[j] = static_cast<int>(((i * 0x9e3779b9u) >> (j % 32)) & 1u);
+        }
+        psi.insert({SpinVector{std::begin(spins), std::end(spins)}, 1.0});
+    }
+    psi.freeze();
+    psi.max_growth(10.0);
+    ASSERT_EQ(psi.table_budget(), 0u);
+    psi.memory_limit(mib);
+    auto const  successor = psi.empty_successor();
+    std::size_t capacity  = 0;
+    for (auto const& table : successor.tables()) {
+        ASSERT_LE(memory_usage(table), psi.table_budget());
+        capacity += static_cast<std::size_t>(
+            table.max_load_factor() * static_cast<float>(table.bucket_count()));
+    }
+    ASSERT_GE(capacity, psi.next_capacity());
+    // Other states which stay alive leave less room.
+    ASSERT_LT(psi.table_budget(mib / 4), psi.table_budget());
+}
+
+TEST(QuantumState, RecyclesTables)
+{
+    auto         cache = std::make_shared<TableCache>(std::size_t{1} << 30);
+    QuantumState psi{0, 4000, 4};
+    psi.table_cache(cache);
+    for (auto& x : test::random_contributions(1000, 64, 7)) {
+        psi.insert(std::move(x));
+    }
+    auto const size = psi.size();
+    psi.freeze();
+    ASSERT_EQ(psi.size(), size);
+    ASSERT_EQ(cache->size(), 4u);
+    ASSERT_GT(cache->bytes(), 0u);
+
+    // Much smaller tables are allocated rather than taken from the cache.
+    QuantumState small{0, 40, 4};
+    small.table_cache(cache);
+    small.reserve(40);
+    ASSERT_EQ(cache->size(), 4u);
+
+    QuantumState phi{0, 0, 4};
+    phi.table_cache(cache);
+    phi.reserve(4000);
+    ASSERT_EQ(cache->size(), 0u);
+    ASSERT_EQ(cache->bytes(), 0u);
+    for (auto const& table : std::as_const(phi).tables()) {
+        ASSERT_EQ(table.size(), 0u);
+    }
+
+    // Nothing is kept beyond the capacity.
+    auto         tiny = std::make_shared<TableCache>(0);
+    QuantumState chi{0, 4000, 4};
+    chi.table_cache(tiny);
+    chi.insert(QuantumState::value_type{psi.keys().front(), 1.0});
+    chi.freeze();
+    ASSERT_EQ(tiny->size(), 0u);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,144 @@
+
+#include "generators.hpp"
+#include "quantum_state.hpp"
+#include "sort_merge.hpp"
+#include <gtest/gtest.h>
+#include <random>
+
+
+TEST(SortAndReduce, MatchesHashing)
+{
+    for (auto const count : {10ul, 1000ul, 100000ul}) {
+        auto xs = test::random_contributions(count, 20, 42);
+        std::unordered_map<SpinVector, std::complex<double>, SpinHasher>
+            expected;
+        for (auto const& [spin, coeff] : xs) {
+            expected[spin] += coeff;
+        }
+        std::vector<QuantumState::value_type> scratch;
+        sort_and_reduce(xs, scratch);
+        ASSERT_EQ(xs.size(), expected.size());
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            if (i > 0) { ASSERT_TRUE(xs[i - 1].first < xs[i].first); }
+            ASSERT_NEAR(std::abs(xs[i].second - expected.at(xs[i].first)),
+                0.0, 1e-12);
+        }
+    }
+}
+
+TEST(MergeRuns, Shards)
+{
+    std::vector<std::vector<QuantumState::value_type>> runs;
+    std::unordered_map<SpinVector, std::complex<double>, SpinHasher> expected;
+    std::vector<QuantumState::value_type>                            scratch;
+    for (auto seed = 0u; seed < 3; ++seed) {
+        runs.push_back(test::random_contributions(5000, 16, seed));
+        for (auto const& [spin, coeff] : runs.back()) {
+            expected[spin] += coeff;
+        }
+        sort_and_reduce(runs.back(), scratch);
+    }
+    QuantumState psi{1000, 0, 4};
+    merge_runs(runs, psi);
+    ASSERT_TRUE(psi.sorted());
+    ASSERT_EQ(psi.size(), expected.size());
+    for (auto const& [spin, coeff] : expected) {
+        auto const* where = psi.find(spin);
+        ASSERT_NE(where, nullptr);
+        ASSERT_NEAR(std::abs(*where - coeff), 0.0, 1e-12);
+    }
+}
+
+TEST(MergeRuns, SpilledAndTruncated)
+{
+    std::vector<std::vector<QuantumState::value_type>> runs;
+    std::vector<SpilledRun>                            spilled;
+    std::vector<QuantumState::value_type>              scratch;
+    for (auto seed = 0u; seed < 4; ++seed) {
+        runs.push_back(test::random_contributions(5000, 16, seed));
+        sort_and_reduce(runs.back(), scratch);
+    }
+    QuantumState expected{100, 0, 4};
+    merge_runs(runs, expected);
+    auto const expected_norm = expected.squared_norm();
+
+    spilled.emplace_back(runs[0], 4);
+    spilled.emplace_back(runs[1], 4);
+    runs.erase(std::begin(runs), std::begin(runs) + 2);
+    QuantumState psi{100, 0, 4};
+    auto const   unique = merge_runs(runs, psi, spilled, 100);
+    ASSERT_EQ(unique, expected.size());
+    ASSERT_EQ(psi.size(), 100);
+    ASSERT_NEAR(psi.squared_norm() + psi.discarded(), expected_norm, 1e-10);
+    auto const discarded = expected.shrink();
+    ASSERT_NEAR(psi.discarded(), discarded, 1e-10);
+    expected.for_each([&psi](auto const& x) {
+        auto const* where = psi.find(x.first);
+        ASSERT_NE(where, nullptr);
+        ASSERT_NEAR(std::abs(*where - x.second), 0.0, 1e-12);
+    });
+}
+
+TEST(QuantumState, FreezeThaw)
+{
+    auto xs = test::random_contributions(20000, 24, 7);
+    std::vector<QuantumState::value_type> scratch;
+    sort_and_reduce(xs, scratch);
+    QuantumState psi{1000, 0, 8};
+    for (std::size_t i = 0; i < xs.size(); i += 2) {
+        psi.insert(QuantumState::value_type{xs[i]});
+    }
+    auto const norm = psi.squared_norm();
+    psi.freeze();
+    ASSERT_TRUE(psi.sorted());
+    ASSERT_NEAR(psi.squared_norm(), norm, 1e-10);
+    for (std::size_t i = 0; i < xs.size(); ++i) {
+        auto const* where = psi.find(xs[i].first);
+        if (i % 2 == 0) {
+            ASSERT_NE(where, nullptr);
+            ASSERT_EQ(*where, xs[i].second);
+        }
+        else {
+            ASSERT_EQ(where, nullptr);
+        }
+    }
+    psi.thaw();
+    ASSERT_FALSE(psi.sorted());
+    ASSERT_EQ(psi.size(), (xs.size() + 1) / 2);
+    ASSERT_NE(psi.find(xs.front().first), nullptr);
+}
+
+TEST(QuantumState, StochasticTruncationIsUnbiased)
+{
+    auto xs = test::random_contributions(1000, 16, 3);
+    std::vector<QuantumState::value_type> scratch;
+    sort_and_reduce(xs, scratch);
+    constexpr auto samples  = 4000;
+    constexpr auto soft_max = 64ul;
+    std::vector<std::complex<double>> mean(xs.size());
+    double                            size = 0.0;
+    for (auto seed = 0u; seed < samples; ++seed) {
+        QuantumState psi{soft_max, 0, 4};
+        for (auto const& x : xs) {
+            psi.insert(QuantumState::value_type{x});
+        }
+        psi.truncation(Truncation::stochastic, seed);
+        psi.shrink();
+        size += static_cast<double>(psi.size()) / samples;
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            auto const* where = psi.find(xs[i].first);
+            if (where != nullptr) { mean[i] += *where / double{samples}; }
+        }
+    }
+    ASSERT_NEAR(size, soft_max, 1.0);
+    for (std::size_t i = 0; i < xs.size(); ++i) {
+        ASSERT_NEAR(std::abs(mean[i] - xs[i].second),
+            0.0, 0.1 * std::abs(xs[i].second) + 0.05);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
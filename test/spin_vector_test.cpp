@@ -2,7 +2,9 @@
 #include "quantum_state.hpp"
 #include "hamiltonian.hpp"
 #include "spin_chain.hpp"
+#include "spin_map.hpp"
 #include <gtest/gtest.h>
+#include <unordered_set>
 
 
 TEST(Construction, InitializerList)
@@ -24,6 +26,57 @@ TEST(Construction, InitializerList)
     }
 }
 
+TEST(Comparison, Lexicographic)
+{
+    SpinVector const a{0, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+    SpinVector const b{1, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    SpinVector const c{1, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    ASSERT_TRUE(a < b);
+    ASSERT_TRUE(b < c);
+    ASSERT_FALSE(c < a);
+    ASSERT_FALSE(b < b);
+}
+
+TEST(Conversion, Bits)
+{
+    SpinVector const spin{1, 0, 0, 1, 1, 0, 1, 0, 1, 1};
+    ASSERT_EQ(spin.bits(), 0b1001101011u);
+    ASSERT_TRUE(SpinVector::from_bits(spin.bits(), spin.size()) == spin);
+}
+
+namespace {
+/// Checks that `Hasher` has no collisions on all configurations of 16 spins
+/// and that a SpinMap using it finds all of them.
+template <class Hasher>
+auto check_hasher() -> void
+{
+    constexpr int                   n = 16;
+    Hasher const                    hash{};
+    std::unordered_set<std::size_t> hashes;
+    SpinMap<std::uint64_t, Hasher>  table;
+    for (std::uint64_t x = 0; x < (1u << n); ++x) {
+        auto const spin = SpinVector::from_bits(x, n);
+        hashes.insert(hash(spin));
+        table.emplace(spin, x);
+    }
+    ASSERT_EQ(hashes.size(), 1u << n);
+    for (std::uint64_t x = 0; x < (1u << n); ++x) {
+        auto const where = table.find(SpinVector::from_bits(x, n));
+        ASSERT_TRUE(where != table.end());
+        ASSERT_EQ(where->second, x);
+    }
+}
+} // namespace
+
+TEST(Hashing, Collisions)
+{
+    check_hasher<SpinHasher>();
+    check_hasher<MultiplyShiftHasher>();
+#if defined(__SSE4_2__)
+    check_hasher<Crc32cHasher>();
+#endif
+}
+
 int main(int argc, char** argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,101 @@
+
+#include "spin_map.hpp"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+
+namespace {
+using Map = SwissMap<SpinVector, std::uint64_t, SpinHasher>;
+
+auto check_equal(Map const& actual,
+    std::unordered_map<SpinVector, std::uint64_t, SpinHasher> const& expected)
+    -> void
+{
+    ASSERT_EQ(actual.size(), expected.size());
+    std::size_t visited = 0;
+    for (auto const& [spin, x] : actual) {
+        auto const where = expected.find(spin);
+        ASSERT_TRUE(where != expected.end());
+        ASSERT_EQ(where->second, x);
+        ++visited;
+    }
+    ASSERT_EQ(visited, expected.size());
+    for (auto const& [spin, x] : expected) {
+        auto const where = actual.find(spin);
+        ASSERT_TRUE(where != actual.end());
+        ASSERT_EQ(where->second, x);
+    }
+}
+} // namespace
+
+TEST(SwissMap, AgreesWithUnorderedMap)
+{
+    std::mt19937                                              generator{5};
+    std::uniform_int_distribution<std::uint64_t>              bits{0, 4095};
+    std::uniform_int_distribution<int>                        operation{0, 3};
+    Map                                                       actual;
+    std::unordered_map<SpinVector, std::uint64_t, SpinHasher> expected;
+    for (std::uint64_t i = 0; i < 50000; ++i) {
+        auto const spin = SpinVector::from_bits(bits(generator), 12);
+        if (operation(generator) == 0) {
+            ASSERT_EQ(actual.erase(spin), expected.erase(spin));
+        }
+        else {
+            auto const [where, inserted] = actual.insert({spin, i});
+            ASSERT_EQ(inserted, expected.insert({spin, i}).second);
+            ASSERT_TRUE(where->first == spin);
+            where->second += 1;
+            expected[spin] += 1;
+        }
+    }
+    check_equal(actual, expected);
+
+    // Erasing while iterating visits every element once.
+    for (auto i = actual.begin(); i != actual.end();) {
+        if (i->second % 2 == 0) {
+            expected.erase(i->first);
+            i = actual.erase(i);
+        }
+        else {
+            ++i;
+        }
+    }
+    check_equal(actual, expected);
+
+    auto const copy = actual;
+    check_equal(copy, expected);
+    Map moved{std::move(actual)};
+    check_equal(moved, expected);
+    ASSERT_EQ(actual.size(), 0u);
+    ASSERT_TRUE(actual.begin() == actual.end());
+
+    auto const buckets = moved.bucket_count();
+    moved.clear();
+    ASSERT_EQ(moved.size(), 0u);
+    ASSERT_EQ(moved.bucket_count(), buckets);
+    ASSERT_TRUE(moved.find(copy.begin()->first) == moved.end());
+}
+
+TEST(SwissMap, Reserve)
+{
+    Map table;
+    ASSERT_EQ(table.bucket_count(), 0u);
+    table.reserve(0);
+    ASSERT_EQ(table.bucket_count(), 0u);
+    table.reserve(1000);
+    auto const buckets = table.bucket_count();
+    ASSERT_GE(table.max_load_factor() * static_cast<float>(buckets), 1000.0f);
+    for (std::uint64_t x = 0; x < 1000; ++x) {
+        table.emplace(SpinVector::from_bits(x, 16), x);
+    }
+    ASSERT_EQ(table.bucket_count(), buckets);
+    ASSERT_EQ(table.count(SpinVector::from_bits(999, 16)), 1u);
+    ASSERT_EQ(table.count(SpinVector::from_bits(1000, 16)), 0u);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,68 @@
+
+#include "trace.hpp"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+auto occurrences(std::string const& text, std::string const& word)
+    -> std::size_t
+{
+    std::size_t count = 0;
+    for (auto i = text.find(word); i != std::string::npos;
+         i        = text.find(word, i + 1)) {
+        ++count;
+    }
+    return count;
+}
+} // namespace
+
+#if defined(TCM_TRACING)
+TEST(Trace, ChromeFormat)
+{
+    start_tracing(4);
+    { TCM_TRACE_SCOPE("main"); }
+    std::thread worker{[]() {
+        for (auto i = 0; i < 6; ++i) {
+            TCM_TRACE_SCOPE("worker");
+        }
+    }};
+    worker.join();
+    stop_tracing();
+    { TCM_TRACE_SCOPE("ignored"); }
+
+    std::ostringstream out;
+    write_trace(out);
+    auto const trace = out.str();
+    ASSERT_EQ(trace.rfind("{\"traceEvents\":[", 0), 0);
+    // The ring buffer of the worker only keeps the last 4 spans.
+    ASSERT_EQ(occurrences(trace, "\"name\":\"worker\""), 4);
+    ASSERT_EQ(occurrences(trace, "\"name\":\"main\""), 1);
+    ASSERT_EQ(occurrences(trace, "ignored"), 0);
+    ASSERT_EQ(occurrences(trace, "\"thread_name\""), 2);
+
+    // Starting again discards the old spans.
+    start_tracing(4);
+    stop_tracing();
+    std::ostringstream empty;
+    write_trace(empty);
+    ASSERT_EQ(occurrences(empty.str(), "\"ph\""), 0);
+}
+#else
+TEST(Trace, NotCompiledIn)
+{
+    ASSERT_THROW(start_tracing(), std::runtime_error);
+    { TCM_TRACE_SCOPE("ignored"); }
+    std::ostringstream out;
+    write_trace(out);
+    ASSERT_EQ(occurrences(out.str(), "\"ph\""), 0);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,70 @@
+
+#include "unix_socket.hpp"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <istream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+auto socket_path() -> std::string
+{
+    return (std::filesystem::temp_directory_path()
+            / ("lanczos-test-" + std::to_string(::getpid()) + ".sock"))
+        .string();
+}
+} // namespace
+
+TEST(UnixSocket, RoundTrip)
+{
+    auto const path = socket_path();
+    {
+        UnixListener listener{path};
+        ASSERT_TRUE(std::filesystem::is_socket(path));
+        std::thread server{[&listener]() {
+            SocketBuffer  buffer{listener.accept()};
+            std::iostream stream{std::addressof(buffer)};
+            std::string   line;
+            while (std::getline(stream, line)) {
+                stream << line.size() << '\n';
+            }
+        }};
+        {
+            SocketBuffer  buffer{unix_connect(path)};
+            std::iostream stream{std::addressof(buffer)};
+            // More than fits into one buffer.
+            stream << "abc\n" << std::string(10000, 'x') << '\n';
+            buffer.shutdown_output();
+            std::size_t first, second;
+            ASSERT_TRUE(stream >> first >> second);
+            ASSERT_EQ(first, 3u);
+            ASSERT_EQ(second, 10000u);
+            ASSERT_FALSE(stream >> first);
+        }
+        server.join();
+        // A second server must not take over the socket.
+        ASSERT_THROW(UnixListener{path}, std::runtime_error);
+    }
+    ASSERT_FALSE(std::filesystem::exists(path));
+    ASSERT_THROW(unix_connect(path), std::runtime_error);
+}
+
+TEST(UnixSocket, OwnerOnly)
+{
+    auto const path = socket_path();
+    // Even with a permissive umask.
+    auto const mask = ::umask(0);
+    UnixListener listener{path};
+    ::umask(mask);
+    struct stat info;
+    ASSERT_EQ(::stat(path.c_str(), &info), 0);
+    ASSERT_EQ(info.st_mode & 0777, 0600u);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}